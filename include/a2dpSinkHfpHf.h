@@ -39,6 +39,42 @@ typedef void (*a2dp_audio_state_cb_t)(bool streaming);
  */
 typedef void (*hfp_call_state_cb_t)(bool call_active, int call_state);
 
+/**
+ * @brief Audio output state callback
+ * @param active true when I2S output starts, false right before it stops
+ *        (stream stopped, or A2DP stream silent for the configured hold time)
+ * @note Use it to switch an amplifier's enable/mute GPIO; keep it short
+ */
+typedef void (*audio_output_state_cb_t)(bool active);
+
+/**
+ * @brief HFP call link quality over the last few sampling intervals
+ *
+ * Counts come from the controller's (e)SCO packet statistics and from the
+ * bad-frame flag on received call audio. Rates are in tenths of a percent.
+ */
+typedef struct {
+    uint32_t window_ms;            ///< Time covered by the counts and rates below
+    uint32_t rx_total;             ///< Packets expected from the phone
+    uint32_t rx_err;               ///< ... received with errors
+    uint32_t rx_lost;              ///< ... not received, or lost
+    uint32_t tx_total;             ///< Packets sent to the phone
+    uint32_t tx_discarded;         ///< ... discarded by the controller
+    uint32_t frames;               ///< Audio frames delivered to the host
+    uint32_t bad_frames;           ///< ... flagged as bad
+    uint16_t rx_loss_permille;     ///< rx_lost / rx_total
+    uint16_t rx_err_permille;      ///< rx_err / rx_total
+    uint16_t tx_discard_permille;  ///< tx_discarded / tx_total
+    uint16_t bad_frame_permille;   ///< bad_frames / frames
+} hfp_link_quality_t;
+
+/**
+ * @brief HFP link quality callback, called once per sampling interval during a call
+ * @param quality Rolling link quality (valid only during the call)
+ * @note Runs in the Bluetooth task; keep it short
+ */
+typedef void (*hfp_link_quality_cb_t)(const hfp_link_quality_t *quality);
+
 // Configuration structure
 struct a2dpSinkHfpHf_config_t {
     const char *device_name;
@@ -265,6 +301,28 @@ void a2dp_sink_hfp_hf_register_audio_state_cb(a2dp_audio_state_cb_t callback);
  */
 void a2dp_sink_hfp_hf_register_call_state_cb(hfp_call_state_cb_t callback);
 
+/**
+ * @brief Register callback for audio output (I2S TX) state changes
+ * @param callback Callback function (NULL to unregister)
+ */
+void a2dp_sink_hfp_hf_register_output_state_cb(audio_output_state_cb_t callback);
+
+/**
+ * @brief Register callback for HFP call link quality samples
+ * @param callback Callback function (NULL to unregister)
+ */
+void a2dp_sink_hfp_hf_register_link_quality_cb(hfp_link_quality_cb_t callback);
+
+/**
+ * @brief Get the latest HFP call link quality
+ *
+ * After a call ends its last sample stays available until the next call starts.
+ *
+ * @param quality Filled with the rolling link quality
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, or ESP_ERR_INVALID_STATE if no sample was taken yet
+ */
+esp_err_t a2dpSinkHfpHf_get_link_quality(hfp_link_quality_t *quality);
+
 // ============================================================================
 // AVRC API
 // ============================================================================
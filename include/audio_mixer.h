@@ -0,0 +1,230 @@
+/**
+ * @file audio_mixer.h
+ * @brief Software mixer in front of the I2S TX channel
+ *
+ * The mixer task owns the only i2s_channel_write() on the TX channel. Producers
+ * (A2DP decoder, HFP speaker path, ringtone, prompts) each create a source with
+ * their own sample rate and channel count and push 16-bit PCM into it; the mixer
+ * resamples every source to the current output format, applies per-source gain
+ * and ducking, and writes one mixed period at a time.
+ *
+ * The number of sources is bounded by CONFIG_A2DPSINK_HFPHF_MIXER_MAX_SOURCES so
+ * the worst-case cost of a period is fixed.
+ */
+
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "driver/i2s_std.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUDIO_MIXER_GAIN_UNITY 32767  ///< Q15 unity gain
+
+/**
+ * @brief Opaque mixer source handle
+ */
+typedef struct audio_mixer_source audio_mixer_source_t;
+
+/**
+ * @brief Mixer source configuration
+ */
+typedef struct {
+    const char *name;        ///< Name used in log messages
+    int sample_rate;         ///< Source sample rate in Hz (8000 - 48000)
+    int channels;            ///< 1 (mono) or 2 (interleaved stereo), 16-bit samples
+    size_t buffer_bytes;     ///< Size of the source ringbuffer
+    size_t prefetch_bytes;   ///< Buffered bytes required before the source is mixed in
+    bool duck_others;        ///< While playing, attenuate all other sources
+} audio_mixer_source_cfg_t;
+
+/**
+ * @brief Output tap, called with every period right before it is written to I2S
+ *
+ * Runs in the mixer task with the mixer lock held; it must be short and must
+ * not call back into the mixer.
+ *
+ * @param samples  Mixed output, interleaved if channels is 2
+ * @param frames   Number of frames
+ * @param channels Output channel count
+ */
+typedef void (*audio_mixer_tap_cb_t)(const int16_t *samples, size_t frames, int channels);
+
+/**
+ * @brief Start the mixer task on an already initialized TX channel
+ *
+ * The mixer stays suspended until audio_mixer_resume() is called.
+ *
+ * @param tx_chan I2S TX channel handle
+ * @return ESP_OK on success
+ */
+esp_err_t audio_mixer_init(i2s_chan_handle_t tx_chan);
+
+/**
+ * @brief Stop the mixer task and destroy all remaining sources
+ */
+void audio_mixer_deinit(void);
+
+/**
+ * @brief Set the output format the TX channel is configured for
+ *
+ * Only call this while the mixer is suspended.
+ *
+ * @param sample_rate Output sample rate in Hz
+ * @param channels    1 for a mono 16-bit slot, 2 for stereo
+ */
+void audio_mixer_set_output(int sample_rate, int channels);
+
+/**
+ * @brief Install or remove the output tap (e.g. an echo canceller reference)
+ *
+ * Once this returns with NULL, the previous tap is no longer being called.
+ *
+ * @param cb Tap callback, or NULL to remove it
+ */
+void audio_mixer_set_tap(audio_mixer_tap_cb_t cb);
+
+/**
+ * @brief Park the mixer task before the TX channel is disabled or reconfigured
+ *
+ * Blocks until the task has finished the period it is writing. Calls nest.
+ */
+void audio_mixer_suspend(void);
+
+/**
+ * @brief Let the mixer task write to the TX channel again
+ */
+void audio_mixer_resume(void);
+
+/**
+ * @brief Create a mixer source
+ *
+ * @param cfg Source configuration
+ * @return Source handle, or NULL if all slots are used or allocation failed
+ */
+audio_mixer_source_t *audio_mixer_source_create(const audio_mixer_source_cfg_t *cfg);
+
+/**
+ * @brief Destroy a mixer source; any buffered audio is discarded
+ *
+ * @param src Source handle (NULL is ignored)
+ */
+void audio_mixer_source_destroy(audio_mixer_source_t *src);
+
+/**
+ * @brief Queue PCM data on a source
+ *
+ * @param src   Source handle
+ * @param data  16-bit PCM in the source's format
+ * @param bytes Number of bytes
+ * @param wait  Ticks to wait for space; on timeout the chunk is dropped
+ * @return Number of bytes queued (0 or bytes)
+ */
+size_t audio_mixer_source_write(audio_mixer_source_t *src, const void *data, size_t bytes, TickType_t wait);
+
+/**
+ * @brief Set the gain of a source; the change is ramped over one mixer period
+ *
+ * @param src     Source handle
+ * @param gain_q15 Gain in Q15 (0 = mute, AUDIO_MIXER_GAIN_UNITY = 0 dB)
+ */
+void audio_mixer_source_set_gain(audio_mixer_source_t *src, int16_t gain_q15);
+
+/**
+ * @brief Discard everything buffered on a source and return it to prefetching
+ *
+ * @param src Source handle
+ */
+void audio_mixer_source_flush(audio_mixer_source_t *src);
+
+/**
+ * @brief Change the sample format of an existing source
+ *
+ * Everything buffered is discarded and the source prefetches again. The
+ * ringbuffer size and prefetch level are kept.
+ *
+ * @param src         Source handle
+ * @param sample_rate New sample rate in Hz
+ * @param channels    New channel count (1 or 2)
+ */
+void audio_mixer_source_set_format(audio_mixer_source_t *src, int sample_rate, int channels);
+
+/**
+ * @brief Change how much a source buffers before it is mixed in
+ *
+ * Takes effect at the next prefetch (start or underrun). Limited to half the
+ * source ringbuffer.
+ *
+ * @param src            Source handle
+ * @param prefetch_bytes New prefetch level in bytes
+ */
+void audio_mixer_source_set_prefetch(audio_mixer_source_t *src, size_t prefetch_bytes);
+
+/**
+ * @brief Restart a source from silence, ramping up to its gain
+ *
+ * Use after a flush when playback resumes, so the first samples don't click.
+ *
+ * @param src     Source handle
+ * @param fade_ms Duration of the ramp in milliseconds
+ */
+void audio_mixer_source_fade_in(audio_mixer_source_t *src, uint32_t fade_ms);
+
+/**
+ * @brief Ramp a source down to silence and wait until it got there
+ *
+ * The gain stays at 0 afterwards; set it again (or fade in) to reuse the source.
+ * Returns at once if the source isn't being mixed.
+ *
+ * @param src     Source handle
+ * @param fade_ms Duration of the ramp in milliseconds
+ * @param timeout Maximum ticks to wait
+ * @return true once the source is silent, false on timeout
+ */
+bool audio_mixer_source_fade_out(audio_mixer_source_t *src, uint32_t fade_ms, TickType_t timeout);
+
+/**
+ * @brief Get the number of bytes currently buffered on a source
+ *
+ * @param src Source handle
+ * @return Buffered bytes
+ */
+size_t audio_mixer_source_get_fill(audio_mixer_source_t *src);
+
+/**
+ * @brief Check whether a source is past prefetch and being mixed
+ *
+ * @param src Source handle
+ * @return true if the source is playing
+ */
+bool audio_mixer_source_is_playing(audio_mixer_source_t *src);
+
+/**
+ * @brief Get the number of times a source ran dry while playing
+ *
+ * @param src Source handle
+ * @return Underruns since the source was created
+ */
+uint32_t audio_mixer_source_get_underruns(audio_mixer_source_t *src);
+
+/**
+ * @brief Block until a source has played out everything queued on it
+ *
+ * @param src     Source handle
+ * @param timeout Maximum ticks to wait
+ * @return true if the source drained, false on timeout
+ */
+bool audio_mixer_source_drain(audio_mixer_source_t *src, TickType_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AUDIO_MIXER_H
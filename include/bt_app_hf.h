@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include "esp_hf_client_api.h"
+#include "a2dpSinkHfpHf.h"
 
 
 #define BT_HF_TAG               "BT_HF"
@@ -32,5 +33,17 @@ esp_err_t bt_app_hf_connect_audio(void);
  */
 esp_err_t bt_app_hf_disconnect_audio(void);
 
+/**
+ * @brief Register the callback for periodic call link quality samples
+ */
+void bt_app_hf_register_link_quality_cb(hfp_link_quality_cb_t callback);
+
+/**
+ * @brief Copy the latest rolling call link quality
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, or ESP_ERR_INVALID_STATE before the first sample
+ */
+esp_err_t bt_app_hf_get_link_quality(hfp_link_quality_t *quality);
+
 
 #endif /* __BT_APP_HF_H__*/
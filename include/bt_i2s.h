@@ -15,6 +15,7 @@ extern "C" {
 #include <stdbool.h>
 #include <stddef.h>
 #include "driver/i2s_std.h"
+#include "codec.h"
 
 /**
  * @brief I2S pin configuration structure
@@ -35,6 +36,73 @@ typedef enum {
     I2S_TX_MODE_HFP,       ///< I2S TX streaming HFP audio (voice call)
 } i2s_tx_mode_t;
 
+/**
+ * @brief A2DP output channel mode
+ * 
+ * The mono modes are applied right after decoding, so the PCM buffer, DMA and I2S
+ * slot configuration all run mono (the sample is sent on both slots).
+ */
+typedef enum {
+    BT_I2S_OUTPUT_STEREO = 0,  ///< Stereo as received
+    BT_I2S_OUTPUT_MONO_SUM,    ///< Mono, (L + R) / 2
+    BT_I2S_OUTPUT_LEFT,        ///< Mono, left channel only
+    BT_I2S_OUTPUT_RIGHT,       ///< Mono, right channel only
+} bt_i2s_output_channels_t;
+
+#define BT_I2S_HFP_CB_HIST_BUCKETS 8  ///< HFP callback latency buckets: <50, <100, <200, <500, <1000, <2000, <5000, >=5000 us
+
+/**
+ * @brief Audio pipeline statistics
+ * 
+ * Latencies are measured from bt_i2s_a2dp_start() and describe the most recent start.
+ * The pm_* fields count since bt_i2s_init(); with CONFIG_PM_ENABLE the CPU and APB
+ * frequency locks are held exactly while the output is active.
+ */
+typedef struct {
+    uint32_t a2dp_starts;                ///< Number of A2DP stream starts
+    uint32_t a2dp_decoder_cache_hits;    ///< Starts that reused a warm decoder
+    uint32_t a2dp_decoder_cache_misses;  ///< Starts that had to open a decoder
+    uint32_t a2dp_decoder_open_us;       ///< Time spent obtaining the decoder on the start path
+    uint32_t a2dp_first_packet_us;       ///< Start to first encoded media packet
+    uint32_t a2dp_first_audio_us;        ///< Start to first PCM written to I2S
+    uint32_t a2dp_silence_idles;         ///< Times the output was idled because the stream was silent
+    uint32_t a2dp_reconfigs;             ///< In-place stream reconfigurations (no stop/start)
+    uint32_t a2dp_reconfig_us;           ///< Duration of the last in-place reconfiguration
+    uint32_t handovers;                  ///< A2DP <-> HFP handovers (call taking over music, music resuming)
+    uint32_t handover_us;                ///< Duration of the last handover (fade-out to new pipeline running)
+    uint32_t handover_max_us;            ///< Longest handover
+    uint32_t hfp_frames;                 ///< HFP audio data callbacks handled
+    uint32_t hfp_heap_ops;               ///< Heap allocations + frees on the HFP data path (should stay 0)
+    uint32_t hfp_cb_avg_us;              ///< Average time spent in the HFP audio data callback
+    uint32_t hfp_cb_max_us;              ///< Longest HFP audio data callback
+    uint32_t hfp_queue_drops;            ///< Received mSBC frames dropped because the decode task fell behind
+    uint32_t hfp_bad_frames;             ///< Frames the controller reported as bad (erroneous or lost eSCO packets)
+    uint32_t hfp_concealed_frames;       ///< Frames synthesized by packet loss concealment (bad, undecodable or missing)
+    uint32_t hfp_cb_hist[BT_I2S_HFP_CB_HIST_BUCKETS];  ///< HFP audio data callbacks per latency bucket
+    uint32_t hfp_uplink_fill_frames;     ///< Uplink frames sent as a repeat or comfort noise (no mic frame ready)
+    uint32_t hfp_dec_wakeups;            ///< HFP decode task wakeups (one per received frame burst, plus concealment deadlines)
+    uint32_t hfp_dec_timeout_wakeups;    ///< Of those, wakeups on a timeout (a frame was late) rather than a notification
+    uint32_t hfp_spk_underruns;          ///< Times the call speaker ran dry (each grows its prefetch)
+    uint32_t hfp_mic_underruns;          ///< Short microphone reads by the BT stack (each grows its prefetch)
+    uint32_t hfp_spk_prefetch_ms;        ///< Current/last call speaker prefetch
+    uint32_t hfp_mic_prefetch_ms;        ///< Current/last call microphone prefetch
+    uint32_t pm_lock_acquires;           ///< Idle -> active transitions (PM locks taken)
+    uint64_t pm_active_us;               ///< Total time with the output running and the PM locks held
+    uint64_t pm_idle_us;                 ///< Total time idle with the PM locks released
+} bt_i2s_stats_t;
+
+/**
+ * @brief TX output state callback
+ * 
+ * Called with true right after the TX channel starts clocking and with false right
+ * before it stops, e.g. to switch an amplifier's enable/mute GPIO. Runs in the
+ * context of whichever audio task changes the state; keep it short and do not call
+ * back into bt_i2s.
+ * 
+ * @param active true if audio output is running
+ */
+typedef void (*bt_i2s_output_state_cb_t)(bool active);
+
 // ============================================================================
 // INITIALIZATION & CONFIGURATION
 // ============================================================================
@@ -82,7 +150,7 @@ void bt_i2s_driver_uninstall(void);
 /**
  * @brief Start A2DP audio streaming mode
  * 
- * Configures I2S for A2DP (44.1kHz stereo), creates decode task and TX task,
+ * Configures I2S for A2DP (44.1kHz stereo), creates the decode task and the A2DP mixer source,
  * and starts audio playback. Waits for HFP mode to stop if currently active.
  */
 void bt_i2s_a2dp_start(void);
@@ -104,42 +172,115 @@ void bt_i2s_a2dp_stop(void);
 void bt_i2s_a2dp_set_packet_params(uint16_t packet_size, uint8_t frames_per_packet);
 
 /**
- * @brief Write raw SBC encoded data to A2DP decode ringbuffer
+ * @brief Write encoded A2DP media data to the decode ringbuffer
  * 
- * Called from Bluetooth stack callback. Data is queued for SBC decode task.
+ * Called from Bluetooth stack callback. Data is queued for the decode task.
+ * SBC data is byte-streamed; each AAC media packet is queued as one item.
  * 
- * @param data  Pointer to SBC encoded audio data
- * @param len   Length of SBC data in bytes
+ * @param data  Pointer to encoded audio data (SBC frames or one LATM packet)
+ * @param len   Length of data in bytes
  */
-void bt_i2s_a2dp_write_sbc_encoded_ringbuf(const uint8_t *data, uint32_t len);
+void bt_i2s_a2dp_write_encoded_ringbuf(const uint8_t *data, uint32_t len);
 
 /**
- * @brief Set A2DP audio configuration (sample rate and channel count)
+ * @brief Set A2DP audio configuration (codec, sample rate and channel count)
  * 
  * Call this from the A2DP audio configuration callback when stream parameters are received.
- * This must be called BEFORE bt_i2s_a2dp_start() to properly configure the I2S hardware.
+ * Normally this comes BEFORE bt_i2s_a2dp_start(). If the source renegotiates while the
+ * stream is running, the running pipeline is switched over in place: queued audio is
+ * played out, the decoder, I2S clock and mixer source are switched, and playback
+ * resumes after one prefetch period. Packet params must then be set again
+ * (bt_i2s_a2dp_set_packet_params()) from the next media packet.
+ * It also pre-opens a decoder for this configuration; decoders are cached per
+ * (codec, sample rate, channels) and reset, not reopened, between sessions.
  * 
+ * @param codec        Negotiated media codec (A2DP_CODEC_SBC or A2DP_CODEC_AAC)
  * @param sample_rate  Sample rate in Hz (44100, 48000, 32000, or 16000)
  * @param ch_count     Channel mode (I2S_SLOT_MODE_MONO or I2S_SLOT_MODE_STEREO)
  */
-void bt_i2s_a2dp_set_audio_config(int sample_rate, int ch_count);
+void bt_i2s_a2dp_set_audio_config(a2dp_codec_type_t codec, int sample_rate, int ch_count);
 
 // ============================================================================
 // HFP MODE CONTROL (Voice Call)
 // ============================================================================
 
+/**
+ * @brief HFP air codec, as negotiated for the SCO/eSCO link
+ */
+typedef enum {
+    BT_I2S_HFP_CODEC_MSBC = 0,  ///< Wideband speech: mSBC frames over HCI, 16 kHz
+    BT_I2S_HFP_CODEC_CVSD,      ///< Narrowband speech: the controller transcodes CVSD, 8 kHz PCM over HCI
+} bt_i2s_hfp_codec_t;
+
+/**
+ * @brief Select the air codec for the next HFP start
+ * 
+ * Call from the HFP audio state event, before bt_i2s_hfp_start(). For CVSD the
+ * whole call path (I2S TX and RX clocks, speaker source, microphone) runs at
+ * 8 kHz and no mSBC codec is opened.
+ * 
+ * @param codec       Negotiated air codec
+ * @param frame_bytes HCI frame size reported by the audio state event (CVSD only;
+ *                    0 selects the default of 120 bytes)
+ */
+void bt_i2s_hfp_set_codec(bt_i2s_hfp_codec_t codec, uint16_t frame_bytes);
+
+/**
+ * @brief HCI frame size of the selected air codec
+ * 
+ * What the audio data callback sends per call: one mSBC frame, or for CVSD the
+ * frame size passed to bt_i2s_hfp_set_codec(), rounded down to whole samples and
+ * capped at what the decode task can take in one go.
+ * 
+ * @return Frame size in bytes
+ */
+uint16_t bt_i2s_hfp_frame_bytes(void);
+
+/**
+ * @brief HFP buffering profile: audio queued in each direction before it starts
+ */
+typedef enum {
+    BT_I2S_HFP_LATENCY_NORMAL = 0,  ///< ~60 ms speaker / ~75 ms microphone, room to grow on long radio gaps
+    BT_I2S_HFP_LATENCY_LOW,         ///< 3 speaker / 2 microphone frames, grown after underruns
+} bt_i2s_hfp_latency_t;
+
+/**
+ * @brief Select the buffering profile for the next HFP start
+ * 
+ * In either profile, every underrun during a call adds two frames to the
+ * prefetch of that direction (up to half its ringbuffer), so a poor link
+ * settles at the smallest buffer it can sustain. Each call starts again from
+ * the profile's level. The default comes from CONFIG_A2DPSINK_HFPHF_HFP_LATENCY_*.
+ * 
+ * @param profile Buffering profile
+ */
+void bt_i2s_hfp_set_latency(bt_i2s_hfp_latency_t profile);
+
+/**
+ * @brief Report the call link's rolling packet loss
+ * 
+ * Takes the link quality samples during a call. A loss at or above
+ * CONFIG_A2DPSINK_HFPHF_LINK_LOSS_GROW_PERMILLE adds two frames to the speaker
+ * prefetch, as an underrun would, before the gaps make it run dry.
+ * 
+ * @param loss_permille Received packets lost over the window, in tenths of a percent
+ * @return true if the prefetch grows; the caller should not report the same
+ *         losses again
+ */
+bool bt_i2s_hfp_link_loss(uint16_t loss_permille);
+
 /**
  * @brief Start HFP audio streaming mode
  * 
- * Configures I2S for HFP (16kHz mono), opens mSBC codec, creates TX/RX tasks,
- * and starts bidirectional audio streaming. Waits for A2DP mode to stop if active.
+ * Configures I2S for HFP (16kHz mono for mSBC, 8kHz for CVSD), opens or resets the mSBC decoder, creates the speaker
+ * mixer source and RX task, and starts bidirectional audio streaming. Waits for A2DP mode to stop if active.
  */
 void bt_i2s_hfp_start(void);
 
 /**
  * @brief Stop HFP audio streaming mode
  * 
- * Unregisters HFP audio callback, closes mSBC codec, signals tasks to stop,
+ * Unregisters HFP audio callback, signals tasks to stop,
  * waits for clean shutdown, deletes ringbuffers, and disables I2S channels.
  */
 void bt_i2s_hfp_stop(void);
@@ -147,7 +288,7 @@ void bt_i2s_hfp_stop(void);
 /**
  * @brief Write decoded HFP audio data to TX ringbuffer (speaker output)
  * 
- * Called from HFP audio data callback. Data is queued for I2S TX task.
+ * Called from HFP audio data callback. Data is queued on the HFP mixer source.
  * 
  * @param data  Pointer to decoded PCM audio data
  * @param size  Size of PCM data in bytes
@@ -155,14 +296,47 @@ void bt_i2s_hfp_stop(void);
 void bt_i2s_hfp_write_tx_ringbuf(const uint8_t *data, uint32_t size);
 
 /**
- * @brief Read encoded HFP audio data from RX ringbuffer (microphone input)
+ * @brief Queue a received frame (mSBC, or PCM on narrowband calls) for the speaker
  * 
- * Called by HFP client to retrieve encoded audio data for transmission.
+ * Called from HFP audio data callback. Only copies the frame into a queue and
+ * never blocks; decoding runs in the HFP decode task, pinned away from the
+ * Bluetooth host core. If the queue is full the frame is dropped.
  * 
- * @param mic_data  Buffer to store encoded audio data (mSBC frame)
- * @return Number of bytes read (60 bytes for mSBC frame, or 0 if none available)
+ * Bad frames are queued too and replaced by the decoder's packet loss
+ * concealment, as are frames that do not arrive on schedule.
+ * 
+ * @param data         Pointer to one received frame (may be NULL for a bad frame)
+ * @param len          Length of the frame in bytes
+ * @param is_bad_frame true if the controller flagged the frame as erroneous or lost
  */
-size_t bt_i2s_hfp_read_rx_ringbuf(uint8_t *mic_data);
+void bt_i2s_hfp_write_tx_frame(const uint8_t *data, size_t len, bool is_bad_frame);
+
+/**
+ * @brief Account one HFP audio data callback
+ * 
+ * Called once per callback by the HFP client with the number of heap allocations
+ * and frees it had to make and the time it took, so that both show up in
+ * bt_i2s_get_stats() and in the per-call summary logged at HFP stop.
+ * 
+ * @param heap_ops Heap operations made while handling this frame
+ * @param cb_us    Execution time of the callback in microseconds
+ */
+void bt_i2s_hfp_account_frame(uint32_t heap_ops, uint32_t cb_us);
+
+/**
+ * @brief Read HFP audio data from RX ringbuffer (microphone input)
+ * 
+ * Called by HFP client to retrieve audio data for transmission: mSBC encoded
+ * frames, or 8 kHz PCM on narrowband (CVSD) calls. Never blocks, so it is safe
+ * in the audio data callback, and always delivers a whole frame: when no
+ * microphone frame is ready the last one is repeated once, then comfort noise
+ * is sent.
+ * 
+ * @param mic_data  Buffer to store the audio data
+ * @param len       Bytes wanted (one mSBC frame, or the CVSD frame size)
+ * @return len, or 0 if HFP audio is not running
+ */
+size_t bt_i2s_hfp_read_rx_ringbuf(uint8_t *mic_data, size_t len);
 
 // ============================================================================
 // MODE QUERY FUNCTIONS
@@ -189,10 +363,54 @@ bool bt_i2s_is_hfp_mode(void);
  */
 bool bt_i2s_is_a2dp_mode(void);
 
+/**
+ * @brief Get a snapshot of the audio pipeline statistics
+ * 
+ * @param stats Destination for the snapshot
+ */
+void bt_i2s_get_stats(bt_i2s_stats_t *stats);
+
+/**
+ * @brief Keep the TX channel running for a locally generated mixer source
+ * 
+ * Use around ringtones and prompts so they are audible while no A2DP or HFP
+ * stream is active. Every call must be balanced by bt_i2s_output_release().
+ */
+void bt_i2s_output_acquire(void);
+
+/**
+ * @brief Release a reference taken with bt_i2s_output_acquire()
+ * 
+ * The TX channel is disabled once the last reference is gone and no stream is active.
+ */
+void bt_i2s_output_release(void);
+
+/**
+ * @brief Set the A2DP output channel mode
+ * 
+ * The default comes from Kconfig (A2DPSINK_HFPHF_OUTPUT_CHANNELS). A change takes
+ * effect from the next A2DP stream start.
+ * 
+ * @param mode Output channel mode
+ */
+void bt_i2s_set_output_channels(bt_i2s_output_channels_t mode);
+
+/**
+ * @brief Register a callback for TX output enable/disable
+ * 
+ * Besides stream start/stop, the output is idled while an A2DP stream carries only
+ * digital silence for longer than CONFIG_A2DPSINK_HFPHF_SILENCE_HOLD_MS, and woken
+ * (with a short fade-in) as soon as audio returns.
+ * 
+ * @param callback Callback function (NULL to unregister)
+ */
+void bt_i2s_register_output_state_cb(bt_i2s_output_state_cb_t callback);
+
 /**
  * @brief Get TX I2S channel handle
  * 
- * @return TX channel handle (for advanced use - direct I2S writes)
+ * @return TX channel handle. All audio output goes through the mixer
+ *         (audio_mixer.h); do not write to this channel directly.
  */
 i2s_chan_handle_t bt_i2s_get_tx_chan(void);
 
@@ -7,61 +7,124 @@
 #define MSBC_FRAME_SAMPLES      120  // mSBC uses 120 samples per frame
 #define MSBC_ENCODED_SIZE       120  // or ESP_HF_MSBC_ENCODED_FRAME_SIZE (57)?
 
+#define A2DP_SBC_MAX_PCM_BYTES  2048  // one SBC frame: 16 blocks * 8 subbands * 2 ch * 2 bytes
+#define A2DP_AAC_MAX_PCM_BYTES  4096  // one AAC-LC access unit: 1024 samples * 2 ch * 2 bytes
+
+/**
+ * @brief A2DP media codec negotiated for the current stream
+ */
+typedef enum {
+    A2DP_CODEC_SBC = 0,  ///< SBC (mandatory A2DP codec)
+    A2DP_CODEC_AAC,      ///< MPEG-2/4 AAC-LC, LATM framed
+} a2dp_codec_type_t;
+
+/**
+ * @brief Opaque codec instance
+ *
+ * Every encoder/decoder lives in its own context, so any number of streams can
+ * be processed in parallel. A context is not thread-safe: it belongs to whoever
+ * created it, and only the owner may process, reset or destroy it.
+ */
+typedef struct codec_ctx codec_ctx_t;
+
+/**
+ * @brief Stream parameters for the A2DP decoders
+ */
+typedef struct {
+    int sample_rate;  ///< Negotiated sample rate (e.g. 44100, 48000)
+    int channels;     ///< Negotiated channel count (1 or 2)
+} codec_cfg_t;
+
+/**
+ * @brief Create an mSBC encoder (16 kHz mono, 120 samples per frame)
+ * 
+ * @return New context, or NULL on failure
+ */
+codec_ctx_t *msbc_enc_create(void);
+
 /**
- * @brief Initialize and open the mSBC encoder
+ * @brief Create an mSBC decoder (16 kHz mono, PLC enabled)
  * 
- * @return 0 on success, -1 on failure
+ * @return New context, or NULL on failure
  */
-int msbc_enc_open(void);
+codec_ctx_t *msbc_dec_create(void);
 
 /**
- * @brief Close the mSBC encoder and free resources
+ * @brief Create an A2DP SBC decoder
+ * 
+ * @param cfg Negotiated stream parameters
+ * 
+ * @return New context, or NULL on failure
  */
-void msbc_enc_close(void);
+codec_ctx_t *sbc_dec_create(const codec_cfg_t *cfg);
 
 /**
- * @brief Initialize and open the mSBC decoder
+ * @brief Create an A2DP AAC-LC decoder that accepts LATM framed media packets
+ * 
+ * @param cfg Negotiated stream parameters
  * 
- * @return 0 on success, -1 on failure
+ * @return New context, or NULL on failure
  */
-int msbc_dec_open(void);
+codec_ctx_t *aac_dec_create(const codec_cfg_t *cfg);
 
 /**
- * @brief Close the mSBC decoder and free resources
+ * @brief Encode or decode one chunk of data
+ * 
+ * Encoders take one frame of 16-bit PCM and produce one encoded frame. The SBC
+ * decoders decode one frame and report how much input they used, so the caller
+ * can loop over a multi-frame packet. The AAC decoder always takes a complete
+ * LATM packet.
+ * 
+ * @param ctx      Codec context
+ * @param in       Input buffer
+ * @param in_len   Input length in bytes
+ * @param out      Output buffer
+ * @param out_size Size of the output buffer in bytes
+ * @param out_len  Receives the number of bytes written to out
+ * @param consumed Receives the number of input bytes used (may be NULL)
+ * 
+ * @return 0 on success, negative value on failure
  */
-void msbc_dec_close(void);
+int codec_process(codec_ctx_t *ctx, const uint8_t *in, size_t in_len,
+                  uint8_t *out, size_t out_size, size_t *out_len, size_t *consumed);
 
 /**
- * @brief Encode PCM audio data to mSBC format
+ * @brief Produce one frame of concealment audio for a lost or corrupted frame
  * 
- * @param in_data Pointer to input PCM data buffer (16-bit samples, mono, 16kHz)
- * @param in_data_len Length of input data in bytes (should be 480 bytes = 240 samples)
- * @param out_data Pointer to output buffer for encoded mSBC data (minimum 120 bytes)
- * @param out_data_len Pointer to variable that will receive the output data length
+ * Runs the decoder's packet loss concealment, which extrapolates from the
+ * frames decoded so far, so playback stays on schedule. Only the SBC and mSBC
+ * decoders support it.
  * 
- * @return 0 on success, -1 on failure
+ * @param ctx      Decoder context
+ * @param in       The corrupted frame, or NULL if the frame never arrived
+ * @param in_len   Length of the corrupted frame in bytes
+ * @param out      Output buffer
+ * @param out_size Size of the output buffer in bytes
+ * @param out_len  Receives the number of bytes written to out
+ * 
+ * @return 0 on success, negative value on failure (or for unsupported codecs)
  */
-int msbc_enc_data(const uint8_t *in_data, size_t in_data_len, 
-                  uint8_t *out_data, size_t *out_data_len);
+int codec_conceal(codec_ctx_t *ctx, const uint8_t *in, size_t in_len,
+                  uint8_t *out, size_t out_size, size_t *out_len);
 
 /**
- * @brief Decode mSBC data to PCM audio format
+ * @brief Return a context to its just-created state
+ * 
+ * Drops filter memory, PLC history and stream framing state so the context can
+ * be reused for a new session with the same parameters.
  * 
- * @param in_data Pointer to input mSBC encoded data buffer
- * @param in_data_len Length of input data in bytes
- * @param out_data Pointer to output buffer for decoded PCM data (minimum 960 bytes)
- * @param out_data_len Pointer to variable that will receive the output data length
+ * @param ctx Codec context
  * 
- * @return 0 on success, -1 on failure
+ * @return 0 on success, -1 on failure (the context is then unusable and must be destroyed)
  */
-int msbc_dec_data(const uint8_t *in_data, size_t in_data_len, 
-                  uint8_t *out_data, size_t *out_data_len);
+int codec_reset(codec_ctx_t *ctx);
 
-int a2dp_sbc_dec_open(int sample_rate, int channels);
-void a2dp_sbc_dec_close(void);
-int a2dp_sbc_dec_data(const uint8_t *in_data, size_t in_data_len,
-                      uint8_t *out_data, size_t *out_data_len,
-                      size_t *in_bytes_consumed);
+/**
+ * @brief Destroy a context and free its resources
+ * 
+ * @param ctx Codec context (NULL is ignored)
+ */
+void codec_destroy(codec_ctx_t *ctx);
 
 /**
  * @brief Convert 32-bit I2S data from INMP441 to 16-bit PCM
@@ -72,6 +135,4 @@ int a2dp_sbc_dec_data(const uint8_t *in_data, size_t in_data_len,
  */
 void i2s_32bit_to_16bit_pcm(const int32_t *i2s_data, uint8_t *pcm_data, size_t num_samples);
 
-void msbc_enc_reset_frame_count(void);
-
 #endif // CODEC_H
@@ -0,0 +1,100 @@
+/**
+ * @file hfp_aec.h
+ * @brief Acoustic echo canceller for the HFP microphone path
+ *
+ * The far-end signal played on the speaker is picked up by the microphone and
+ * sent back to the phone. The canceller models that echo path with a fixed-point
+ * NLMS adaptive filter and subtracts its estimate from every microphone frame
+ * before it is encoded.
+ *
+ * The reference is what the mixer actually writes to the I2S TX channel. It is
+ * aligned to the microphone by a bulk delay derived from the TX and RX DMA
+ * buffer depths; the filter (CONFIG_A2DPSINK_HFPHF_AEC_TAPS long) covers what
+ * is left of the delay plus the acoustic path.
+ *
+ * Cost is about 11 CPU cycles per tap per sample: with 256 taps a 120 sample
+ * frame takes roughly 340k cycles (1.4 ms at 240 MHz) out of its 7.5 ms. The
+ * worst frame of each call is logged when the canceller stops.
+ */
+
+#ifndef HFP_AEC_H
+#define HFP_AEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Per-call echo canceller statistics
+ */
+typedef struct {
+    int32_t erle_db;          ///< Echo return loss enhancement while the far end talked (dB)
+    uint32_t frame_us_max;    ///< Longest hfp_aec_process() call
+    uint32_t realigns;        ///< Times the reference had to be re-aligned (speaker underruns)
+} hfp_aec_stats_t;
+
+/**
+ * @brief Start the canceller for a call
+ *
+ * Allocates the filter and reference ring and resets the filter.
+ *
+ * @param sample_rate        Call sample rate (8000 or 16000)
+ * @param bulk_delay_frames  Estimated speaker-to-microphone delay (the filter starts a
+ *                           quarter of its length earlier)
+ * @return ESP_OK, or ESP_ERR_NO_MEM
+ */
+esp_err_t hfp_aec_start(int sample_rate, size_t bulk_delay_frames);
+
+/**
+ * @brief Stop the canceller, log its statistics and free its buffers
+ */
+void hfp_aec_stop(void);
+
+/**
+ * @brief Feed the speaker reference (mixer output tap)
+ *
+ * Called from the mixer task for every period written to I2S. Only mono output
+ * (the HFP configuration) is used as a reference.
+ *
+ * @param samples  Output samples, interleaved if channels is 2
+ * @param frames   Number of frames
+ * @param channels Output channel count
+ */
+void hfp_aec_push_reference(const int16_t *samples, size_t frames, int channels);
+
+/**
+ * @brief Tell the canceller the microphone's conversion shift (see hfp_agc_input_shift())
+ *
+ * A change rescales the filter taps by the same factor, so the canceller keeps
+ * its model of the echo path.
+ *
+ * @param shift Left shift the frames to come were converted with
+ */
+void hfp_aec_set_input_shift(int shift);
+
+/**
+ * @brief Remove the echo from one microphone frame, in place
+ *
+ * Passes the frame through unchanged while no reference is available.
+ *
+ * @param mic    16-bit microphone samples at the call rate
+ * @param frames Number of samples
+ */
+void hfp_aec_process(int16_t *mic, size_t frames);
+
+/**
+ * @brief Get the statistics of the current (or last) call
+ *
+ * @param stats Output
+ */
+void hfp_aec_get_stats(hfp_aec_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HFP_AEC_H
@@ -0,0 +1,81 @@
+/**
+ * @file hfp_agc.h
+ * @brief Automatic gain control for the HFP microphone path
+ *
+ * Brings quiet and loud talkers to a common level before the signal is sent to
+ * the phone. The gain is applied in two parts around the echo canceller and
+ * noise suppression:
+ * - hfp_agc_convert() replaces the plain 32 to 16-bit conversion and applies
+ *   the whole 6 dB steps of the gain as a shift, so a quiet talker is lifted
+ *   using the microphone's low-order bits instead of amplifying an already
+ *   truncated signal. The shift follows the previous frame's gain and keeps
+ *   6 dB of headroom on the input. It changes rarely; the echo canceller and
+ *   noise suppressor are told through hfp_agc_input_shift() and rescale their
+ *   state, so a step does not disturb them.
+ * - hfp_agc_process() applies the rest last in the chain, where its level
+ *   detector sees the talker rather than the far-end echo or the road noise.
+ *
+ * The level is followed with a fast attack and a slow release; frames below a
+ * tracked noise floor (pauses, background only) hold the gain, so silence is
+ * not pumped up. The gain rises by at most about 9 dB per second.
+ *
+ * Cost is three passes over the frame (about 4k cycles per 120 samples),
+ * including the conversion it replaces.
+ */
+
+#ifndef HFP_AGC_H
+#define HFP_AGC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Start the AGC for a call, from 0 dB gain
+ *
+ * @param sample_rate Call sample rate (8000 or 16000)
+ */
+void hfp_agc_start(int sample_rate);
+
+/**
+ * @brief Stop the AGC and log its statistics
+ */
+void hfp_agc_stop(void);
+
+/**
+ * @brief Convert one frame of 32-bit I2S samples to 16-bit PCM with the headroom shift
+ *
+ * Without a running AGC this is the plain conversion (the top 16 bits).
+ *
+ * @param i2s_data 32-bit I2S words (left-justified samples)
+ * @param pcm      Output 16-bit PCM
+ * @param frames   Number of samples
+ */
+void hfp_agc_convert(const int32_t *i2s_data, int16_t *pcm, size_t frames);
+
+/**
+ * @brief Headroom shift of the frame between hfp_agc_convert() and hfp_agc_process()
+ *
+ * @return Left shift in bits, 6 dB each; 0 without a running AGC
+ */
+int hfp_agc_input_shift(void);
+
+/**
+ * @brief Apply the rest of the AGC gain to one frame of 16-bit PCM, in place
+ *
+ * Also picks the headroom shift for the next frame. Without a running AGC the
+ * frame is left as it is.
+ *
+ * @param pcm    Microphone PCM (after echo cancellation and noise suppression)
+ * @param frames Number of samples
+ */
+void hfp_agc_process(int16_t *pcm, size_t frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HFP_AGC_H
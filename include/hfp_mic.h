@@ -0,0 +1,102 @@
+/**
+ * @file hfp_mic.h
+ * @brief Microphone front end for the HFP uplink
+ *
+ * Turns what the I2S RX DMA delivers into the common format the rest of the
+ * microphone path works on: one left-justified 32-bit word per sample, with at
+ * most 24 significant bits (what hfp_agc_convert() and i2s_32bit_to_16bit_pcm()
+ * expect).
+ *
+ * The microphone format is chosen in menuconfig and fixed at init:
+ * - standard I2S, 16, 24 or 32 valid bits in the slot (INMP441: 24 in 32)
+ * - PDM, converted to 16-bit PCM by the I2S peripheral
+ *
+ * A configurable left shift lines up right-justified data or adds gain in 6 dB
+ * steps, and an optional first-order high-pass filter removes the DC offset
+ * many MEMS microphones have. Each format has its own conversion loop with the
+ * shift and the filter folded in; it runs in place on the DMA read buffer.
+ *
+ * Optionally two microphones share the data line as a stereo pair (L/R select
+ * tied low on one, high on the other). Their signals are combined by a
+ * delay-and-sum beamformer steered at the talker (the driver's seat), which
+ * favours the voice over road noise coming from other directions. It is folded
+ * into the same pass, a few cycles per sample (about 2k per 120-sample frame).
+ */
+
+#ifndef HFP_MIC_H
+#define HFP_MIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "driver/i2s_std.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Microphone interface formats
+ */
+typedef enum {
+    HFP_MIC_FORMAT_STD_16,   ///< Standard I2S, 16-bit samples
+    HFP_MIC_FORMAT_STD_24,   ///< Standard I2S, 24 valid bits in a 32-bit slot
+    HFP_MIC_FORMAT_STD_32,   ///< Standard I2S, 32-bit samples
+    HFP_MIC_FORMAT_PDM,      ///< PDM microphone, decimated to 16-bit PCM by the peripheral
+} hfp_mic_format_t;
+
+/**
+ * @brief Select the conversion kernel for the configured format
+ *
+ * Called once before the RX channel is created.
+ */
+void hfp_mic_init(void);
+
+/**
+ * @brief Configured microphone format
+ */
+hfp_mic_format_t hfp_mic_get_format(void);
+
+/**
+ * @brief Data bit width to configure the RX channel with
+ */
+i2s_data_bit_width_t hfp_mic_dma_bit_width(void);
+
+/**
+ * @brief Bytes per sample in the RX DMA buffer (2 or 4)
+ */
+size_t hfp_mic_sample_bytes(void);
+
+/**
+ * @brief Microphones on the RX line (1, or 2 for a beamformed pair)
+ */
+size_t hfp_mic_channels(void);
+
+/**
+ * @brief Slot mode to configure the RX channel with
+ */
+i2s_slot_mode_t hfp_mic_slot_mode(void);
+
+/**
+ * @brief Reset the high-pass filter (and the beamformer) for a call
+ *
+ * @param sample_rate Call sample rate (8000 or 16000)
+ */
+void hfp_mic_start(int sample_rate);
+
+/**
+ * @brief Convert one read from the RX DMA to left-justified 32-bit words, in place
+ *
+ * With two microphones the buffer holds interleaved pairs and one word per
+ * frame is left at its start.
+ *
+ * @param buf    Samples as read from the RX channel; must hold frames * hfp_mic_channels() 32-bit words
+ * @param frames Number of frames (samples per microphone)
+ */
+void hfp_mic_convert(void *buf, size_t frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HFP_MIC_H
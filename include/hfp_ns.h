@@ -0,0 +1,68 @@
+/**
+ * @file hfp_ns.h
+ * @brief Spectral noise suppressor for the HFP microphone path
+ *
+ * Removes stationary background noise (road, fan, engine) from the microphone
+ * signal before it is encoded. Works on the 120 sample hops of the RX task
+ * with a 256 point fixed-point FFT and overlap-add, adding one hop of latency
+ * (7.5 ms at 16 kHz).
+ *
+ * Two 256 point FFTs plus the per-bin gain take well under 1 ms per hop on a
+ * 240 MHz core; the worst hop of each call is logged when the suppressor stops.
+ */
+
+#ifndef HFP_NS_H
+#define HFP_NS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HFP_NS_HOP 120  ///< Samples per hfp_ns_process() call
+
+/**
+ * @brief Start the suppressor for a call; resets the noise estimate
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM
+ */
+esp_err_t hfp_ns_start(void);
+
+/**
+ * @brief Stop the suppressor and free its state
+ */
+void hfp_ns_stop(void);
+
+/**
+ * @brief Set the suppression aggressiveness; takes effect on the next hop
+ *
+ * @param level 0 = off, 1 = mild (-6 dB max), 2 = medium (-12 dB), 3 = strong (-18 dB)
+ */
+void hfp_ns_set_level(int level);
+
+/**
+ * @brief Tell the suppressor the input's conversion shift (see hfp_agc_input_shift())
+ *
+ * A change rescales the noise estimate and the overlap by the same factor, so
+ * the suppression carries on as before.
+ *
+ * @param shift Left shift the hops to come were converted with
+ */
+void hfp_ns_set_input_shift(int shift);
+
+/**
+ * @brief Suppress noise in one hop, in place
+ *
+ * @param pcm    16-bit microphone samples at the call rate
+ * @param frames Number of samples, must be HFP_NS_HOP
+ */
+void hfp_ns_process(int16_t *pcm, size_t frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HFP_NS_H
@@ -1,20 +1,26 @@
 /*
- * ringtone.h - Simple ringtone beep for incoming calls
+ * ringtone.h - Ringtone for incoming calls
  */
 
 #ifndef RINGTONE_H
 #define RINGTONE_H
 
+#include "esp_err.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Play a 2-second ringtone beep (non-blocking)
+// Play the ringtone (non-blocking): the configured ringtone file, or a 2-second beep
 void ringtone_play_beep(void);
 
 // Stop any playing ringtone immediately
 void ringtone_stop(void);
 
+// Play a file from SPIFFS instead of the beep (16-bit PCM .wav, raw 16 kHz mono .pcm/.raw,
+// or an SBC stream). NULL or "" selects the built-in beep. Takes effect on the next ring.
+esp_err_t ringtone_set_file(const char *path);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,7 @@
 
 #include "esp_log.h"
 #include "esp_a2dp_api.h"
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "a2dpSink.h"
@@ -79,7 +80,9 @@ static void bt_app_a2dp_audio_cfg_handler(esp_a2d_cb_param_t *param)
 
     ESP_LOGI(A2DP_SINK_TAG, "A2DP audio stream configuration, codec type: %d", p_mcc->type);
 
-    /* For now only SBC stream is supported */
+    /* A mid-stream reconfiguration may change the packet layout */
+    s_audio_data_params_set = false;
+
     if (p_mcc->type == ESP_A2D_MCT_SBC) {
         int sample_rate = 16000;
         int ch_count = 2;
@@ -100,9 +103,9 @@ static void bt_app_a2dp_audio_cfg_handler(esp_a2d_cb_param_t *param)
             ch_count = 1;
         }
 
-        bt_i2s_a2dp_set_audio_config(sample_rate, ch_count);
+        bt_i2s_a2dp_set_audio_config(A2DP_CODEC_SBC, sample_rate, ch_count);
         
-        ESP_LOGI(A2DP_SINK_TAG, "Audio codec configured:");
+        ESP_LOGI(A2DP_SINK_TAG, "Audio codec configured: SBC");
         ESP_LOGI(A2DP_SINK_TAG, "  Sample rate: %d Hz", sample_rate);
         ESP_LOGI(A2DP_SINK_TAG, "  Channels: %d", ch_count);
         ESP_LOGI(A2DP_SINK_TAG, "  Block len: %d", p_mcc->cie.sbc_info.block_len);
@@ -111,6 +114,24 @@ static void bt_app_a2dp_audio_cfg_handler(esp_a2d_cb_param_t *param)
                  p_mcc->cie.sbc_info.min_bitpool,
                  p_mcc->cie.sbc_info.max_bitpool);
     }
+#if CONFIG_A2DPSINK_HFPHF_A2DP_AAC
+    else if (p_mcc->type == ESP_A2D_MCT_M24) {
+        int sample_rate = (p_mcc->cie.m24_info.samp_freq & ESP_A2D_M24_SF_48000) ? 48000 : 44100;
+        int ch_count = (p_mcc->cie.m24_info.channels & ESP_A2D_M24_CHANNELS_1) ? 1 : 2;
+
+        bt_i2s_a2dp_set_audio_config(A2DP_CODEC_AAC, sample_rate, ch_count);
+
+        ESP_LOGI(A2DP_SINK_TAG, "Audio codec configured: AAC");
+        ESP_LOGI(A2DP_SINK_TAG, "  Sample rate: %d Hz", sample_rate);
+        ESP_LOGI(A2DP_SINK_TAG, "  Channels: %d", ch_count);
+        ESP_LOGI(A2DP_SINK_TAG, "  Object type: 0x%02x", p_mcc->cie.m24_info.object_type);
+        ESP_LOGI(A2DP_SINK_TAG, "  Bitrate: %d bps (%s)", (int)p_mcc->cie.m24_info.bit_rate,
+                 p_mcc->cie.m24_info.vbr ? "VBR" : "CBR");
+    }
+#endif
+    else {
+        ESP_LOGW(A2DP_SINK_TAG, "Unsupported codec type %d", p_mcc->type);
+    }
 }
 
 /**
@@ -131,9 +152,8 @@ static void bt_app_a2dp_audio_state_handler(esp_a2d_cb_param_t *param)
         a2dp_sink_notify_audio_state(true);
     } else if (param->audio_stat.state == ESP_A2D_AUDIO_STATE_SUSPEND) {
         s_audio_stream_active = false;
-        if (bt_i2s_is_a2dp_mode()) {
-            bt_i2s_a2dp_stop();
-        }
+        // Also while a call has taken the output over, so music isn't resumed after it
+        bt_i2s_a2dp_stop();
         ESP_LOGI(A2DP_SINK_TAG, "A2DP audio stream stopped");
         // Notify audio streaming stopped
         extern void a2dp_sink_notify_audio_state(bool streaming);
@@ -156,7 +176,7 @@ void bt_app_a2d_audio_data_cb(uint16_t conn_hdl, esp_a2d_audio_buff_t *audio_buf
         s_audio_data_params_set = true;
     }
 
-    bt_i2s_a2dp_write_sbc_encoded_ringbuf(audio_buf->data, audio_buf->data_len);
+    bt_i2s_a2dp_write_encoded_ringbuf(audio_buf->data, audio_buf->data_len);
     esp_a2d_audio_buff_free(audio_buf);
 }
 
@@ -246,6 +266,25 @@ esp_err_t a2dp_sink_init(void)
     }
     ESP_LOGI(A2DP_SINK_TAG, "A2DP SBC SEP registered");
 
+#if CONFIG_A2DPSINK_HFPHF_A2DP_AAC
+    /* AAC SEP: sources that support it (e.g. iPhones) prefer it over SBC */
+    esp_a2d_mcc_t aac_mcc = {0};
+    aac_mcc.type = ESP_A2D_MCT_M24;
+    aac_mcc.cie.m24_info.object_type = ESP_A2D_M24_OBJ_TYPE_MPEG2_AAC_LC | ESP_A2D_M24_OBJ_TYPE_MPEG4_AAC_LC;
+    aac_mcc.cie.m24_info.samp_freq = ESP_A2D_M24_SF_44100 | ESP_A2D_M24_SF_48000;
+    aac_mcc.cie.m24_info.channels = ESP_A2D_M24_CHANNELS_1 | ESP_A2D_M24_CHANNELS_2;
+    aac_mcc.cie.m24_info.vbr = 1;
+    aac_mcc.cie.m24_info.bit_rate = 320000;
+
+    ret = esp_a2d_sink_register_stream_endpoint(1, &aac_mcc);
+    if (ret != ESP_OK) {
+        /* Not fatal - SBC remains available */
+        ESP_LOGW(A2DP_SINK_TAG, "Failed to register AAC SEP: %d", ret);
+    } else {
+        ESP_LOGI(A2DP_SINK_TAG, "A2DP AAC SEP registered");
+    }
+#endif
+
     /* Register audio data callback - AFTER SEP */
     ret = esp_a2d_sink_register_audio_data_callback(&bt_app_a2d_audio_data_cb);
     if (ret != ESP_OK) {
@@ -170,11 +170,8 @@ esp_err_t a2dpSinkHfpHf_init(const a2dpSinkHfpHf_config_t *config)
     bt_i2s_init();
     ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "  ✓ I2S interface initialized");
 
-    // ===== STEP 2: Initialize audio codec =====
-    /* ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "[2/5] Initializing audio codec (mSBC)");
-    msbc_enc_open();
-    msbc_dec_open();
-    ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "  ✓ Audio codec initialized"); */
+    // ===== STEP 2: Audio codecs =====
+    // Codec contexts are created by their owners in bt_i2s when a stream starts
 
     // ===== STEP 3: Initialize GAP layer =====
     ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "[3/5] Initializing GAP layer");
@@ -281,11 +278,6 @@ esp_err_t a2dpSinkHfpHf_deinit(void)
     ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "Deinitializing GAP");
     bt_gap_deinit();
 
-    // Close codec
-    ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "Closing codec");
-    msbc_enc_close();
-    msbc_dec_close();
-
     // Deinitialize I2S
     ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "Deinitializing I2S");
     bt_i2s_driver_uninstall();
@@ -665,8 +657,7 @@ esp_err_t a2dpSinkHfpHf_start_voice_recognition(void)
         ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "Suspending A2DP for voice recognition");
         esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_SUSPEND);
         s_a2dp_was_playing = true;
-        bt_i2s_a2dp_stop();
-        vTaskDelay(pdMS_TO_TICKS(300));
+        bt_i2s_a2dp_stop();  // returns once the output is idle
     } else {
         s_a2dp_was_playing = false;
     }
@@ -823,6 +814,25 @@ void a2dp_sink_hfp_hf_register_call_state_cb(hfp_call_state_cb_t callback)
              callback ? "registered" : "unregistered");
 }
 
+void a2dp_sink_hfp_hf_register_output_state_cb(audio_output_state_cb_t callback)
+{
+    bt_i2s_register_output_state_cb(callback);
+    ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "Output state callback %s", 
+             callback ? "registered" : "unregistered");
+}
+
+void a2dp_sink_hfp_hf_register_link_quality_cb(hfp_link_quality_cb_t callback)
+{
+    bt_app_hf_register_link_quality_cb(callback);
+    ESP_LOGI(A2DP_SINK_HFP_HF_TAG, "Link quality callback %s", 
+             callback ? "registered" : "unregistered");
+}
+
+esp_err_t a2dpSinkHfpHf_get_link_quality(hfp_link_quality_t *quality)
+{
+    return bt_app_hf_get_link_quality(quality);
+}
+
 void a2dp_sink_notify_connection(bool connected, const uint8_t *bda)
 {
     if (s_connection_callback) {
@@ -0,0 +1,665 @@
+/*
+ * audio_mixer.c - Software mixer that owns the I2S TX channel
+ *
+ * Every period the mixer pulls MIXER_PERIOD_FRAMES output frames worth of audio
+ * from each playing source, resamples it with linear interpolation (Q16 phase
+ * accumulator), applies the ramped per-source gain and accumulates into a 32-bit
+ * mix buffer, which is clipped to 16 bits and written to I2S in one call. The
+ * write happens outside the mixer lock, so a full DMA queue never holds up the
+ * sources.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include "audio_mixer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+
+#define MIXER_TAG "MIXER"
+
+#ifndef CONFIG_A2DPSINK_HFPHF_MIXER_MAX_SOURCES
+#define CONFIG_A2DPSINK_HFPHF_MIXER_MAX_SOURCES 4
+#endif
+#ifndef CONFIG_A2DPSINK_HFPHF_MIXER_DUCK_LEVEL
+#define CONFIG_A2DPSINK_HFPHF_MIXER_DUCK_LEVEL 25
+#endif
+
+#define MIXER_MAX_SOURCES   CONFIG_A2DPSINK_HFPHF_MIXER_MAX_SOURCES
+#define MIXER_PERIOD_FRAMES 128                                  // 2.9 ms at 44.1 kHz, 8 ms at 16 kHz
+#define MIXER_MAX_RATIO     4                                    // highest input/output rate ratio
+#define MIXER_STAGE_FRAMES  (MIXER_PERIOD_FRAMES * MIXER_MAX_RATIO + 2)
+#define MIXER_DUCK_GAIN     ((int32_t)AUDIO_MIXER_GAIN_UNITY * CONFIG_A2DPSINK_HFPHF_MIXER_DUCK_LEVEL / 100)
+#define MIXER_WRITE_TIMEOUT_MS 100
+
+struct audio_mixer_source {
+    bool used;
+    audio_mixer_source_cfg_t cfg;
+    RingbufHandle_t ring;
+    volatile bool playing;          // past prefetch, being mixed
+    int16_t stage[MIXER_STAGE_FRAMES * 2];  // source audio pulled from the ring, not yet consumed
+    size_t stage_bytes;                     // may end mid-frame when the ring wrapped
+    uint32_t pos_q16;               // read position in stage, Q16
+    uint32_t step_q16;              // input frames per output frame, Q16
+    volatile int16_t gain_target;
+    int16_t gain_cur;
+    int32_t gain_ramp;              // max gain change per period while fading, 0 = one period
+    bool drain_waiting;
+    bool fade_waiting;
+    SemaphoreHandle_t drain_done;   // given once the waited-for drain finished (kept with the slot)
+    SemaphoreHandle_t fade_done;    // given once a fade-out reaches silence (kept with the slot)
+    uint32_t underruns;
+    uint32_t drops;
+};
+
+static audio_mixer_source_t s_sources[MIXER_MAX_SOURCES];
+static int32_t s_mix_buf[MIXER_PERIOD_FRAMES * 2];
+static int16_t s_out_buf[MIXER_PERIOD_FRAMES * 2];
+
+static i2s_chan_handle_t s_tx_chan = NULL;
+static TaskHandle_t s_mixer_task_handle = NULL;
+static SemaphoreHandle_t s_mixer_lock = NULL;       // held while a period is mixed
+static SemaphoreHandle_t s_write_lock = NULL;       // held while a period is written to I2S
+static SemaphoreHandle_t s_mixer_exit_sem = NULL;
+static volatile bool s_mixer_running = false;
+static volatile int s_suspend_count = 1;             // suspended until the TX channel is enabled
+static int s_out_sample_rate = 44100;
+static int s_out_channels = 2;
+static audio_mixer_tap_cb_t s_tap_cb = NULL;
+
+// ============================================================================
+// INTERNAL
+// ============================================================================
+
+static uint32_t mixer_calc_step(int in_rate, int out_rate)
+{
+    uint64_t step = ((uint64_t)in_rate << 16) / (uint64_t)out_rate;
+    if (step > ((uint64_t)MIXER_MAX_RATIO << 16)) {
+        ESP_LOGW(MIXER_TAG, "Rate ratio %d/%d too high, clamping", in_rate, out_rate);
+        step = (uint64_t)MIXER_MAX_RATIO << 16;
+    }
+    return (uint32_t)step;
+}
+
+static size_t mixer_ring_fill(const audio_mixer_source_t *src)
+{
+    UBaseType_t waiting = 0;
+    vRingbufferGetInfo(src->ring, NULL, NULL, NULL, NULL, &waiting);
+    return (size_t)waiting;
+}
+
+static inline size_t mixer_stage_frames(const audio_mixer_source_t *src)
+{
+    return src->stage_bytes / (src->cfg.channels * sizeof(int16_t));
+}
+
+/**
+ * @brief Top up the stage buffer so it holds at least `needed` frames
+ */
+static void mixer_fill_stage(audio_mixer_source_t *src, size_t needed)
+{
+    if (needed > MIXER_STAGE_FRAMES) {
+        needed = MIXER_STAGE_FRAMES;
+    }
+    const size_t want = needed * src->cfg.channels * sizeof(int16_t);
+
+    // At most two passes: the byte ring hands out data up to its wrap point
+    while (src->stage_bytes < want) {
+        size_t got = 0;
+        uint8_t *data = xRingbufferReceiveUpTo(src->ring, &got, 0, want - src->stage_bytes);
+        if (data == NULL || got == 0) {
+            break;
+        }
+        memcpy((uint8_t *)src->stage + src->stage_bytes, data, got);
+        vRingbufferReturnItem(src->ring, data);
+        src->stage_bytes += got;
+    }
+}
+
+/**
+ * @brief Resample one period of a source into the mix buffer
+ */
+static void mixer_mix_source(audio_mixer_source_t *src, bool ducked)
+{
+    const int in_ch = src->cfg.channels;
+    const uint32_t step = src->step_q16;
+    const size_t needed = ((src->pos_q16 + (MIXER_PERIOD_FRAMES - 1) * step) >> 16) + 2;
+
+    mixer_fill_stage(src, needed);
+
+    int32_t target = src->gain_target;
+    if (ducked) {
+        target = (target * MIXER_DUCK_GAIN) >> 15;
+    }
+    const int32_t gain_start = src->gain_cur;
+    if (src->gain_ramp > 0) {
+        if (target > gain_start + src->gain_ramp) {
+            target = gain_start + src->gain_ramp;
+        } else if (target < gain_start - src->gain_ramp) {
+            target = gain_start - src->gain_ramp;
+        } else {
+            src->gain_ramp = 0;
+        }
+    }
+    const int32_t gain_delta = target - gain_start;
+
+    const int16_t *x = src->stage;
+    const size_t avail = mixer_stage_frames(src);
+    uint32_t pos = src->pos_q16;
+    int32_t *mix = s_mix_buf;
+    size_t n;
+
+    for (n = 0; n < MIXER_PERIOD_FRAMES; n++) {
+        uint32_t idx = pos >> 16;
+        if (idx + 1 >= avail) {
+            break;
+        }
+        int32_t frac = (int32_t)((pos & 0xFFFF) >> 1);  // Q15 keeps the delta product in 32 bits
+        int32_t gain = gain_start + (gain_delta * (int32_t)n) / MIXER_PERIOD_FRAMES;
+        int32_t l, r;
+
+        if (in_ch == 2) {
+            const int16_t *a = &x[idx * 2];
+            l = a[0] + (((a[2] - a[0]) * frac) >> 15);
+            r = a[1] + (((a[3] - a[1]) * frac) >> 15);
+        } else {
+            const int16_t *a = &x[idx];
+            l = a[0] + (((a[1] - a[0]) * frac) >> 15);
+            r = l;
+        }
+
+        l = (l * gain) >> 15;
+        r = (r * gain) >> 15;
+        if (s_out_channels == 2) {
+            mix[n * 2] += l;
+            mix[n * 2 + 1] += r;
+        } else {
+            mix[n] += (l + r) >> 1;
+        }
+        pos += step;
+    }
+    src->gain_cur = (int16_t)(gain_start + (gain_delta * (int32_t)n) / MIXER_PERIOD_FRAMES);
+    if (src->fade_waiting && src->gain_cur == 0) {
+        src->fade_waiting = false;
+        xSemaphoreGive(src->fade_done);
+    }
+
+    // Drop consumed frames from the stage
+    size_t consumed = pos >> 16;
+    if (consumed > avail) {
+        consumed = avail;
+    }
+    if (consumed > 0) {
+        size_t consumed_bytes = consumed * in_ch * sizeof(int16_t);
+        memmove(src->stage, (uint8_t *)src->stage + consumed_bytes, src->stage_bytes - consumed_bytes);
+        src->stage_bytes -= consumed_bytes;
+        pos -= consumed << 16;
+    }
+    src->pos_q16 = pos;
+
+    if (n < MIXER_PERIOD_FRAMES && mixer_ring_fill(src) == 0) {
+        // Ran dry: back to prefetching. A waiting drain means this was the end of the stream.
+        src->playing = false;
+        src->stage_bytes = 0;
+        src->pos_q16 = 0;
+        if (src->fade_waiting) {
+            src->fade_waiting = false;
+            xSemaphoreGive(src->fade_done);
+        }
+        if (src->drain_waiting) {
+            src->drain_waiting = false;
+            xSemaphoreGive(src->drain_done);
+        } else {
+            src->underruns++;
+            ESP_LOGI(MIXER_TAG, "%s underflowed (%" PRIu32 "), prefetching", src->cfg.name, src->underruns);
+        }
+    }
+}
+
+/**
+ * @brief Clear a source slot, keeping the semaphores that belong to the slot
+ */
+static void mixer_source_reset(audio_mixer_source_t *src)
+{
+    SemaphoreHandle_t drain_done = src->drain_done;
+    SemaphoreHandle_t fade_done = src->fade_done;
+    memset(src, 0, sizeof(*src));
+    src->drain_done = drain_done;
+    src->fade_done = fade_done;
+}
+
+static void mixer_task_handler(void *arg)
+{
+    size_t bytes_written = 0;
+
+    while (s_mixer_running) {
+        xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+
+        bool any_playing = false;
+        bool duck = false;
+        for (int i = 0; i < MIXER_MAX_SOURCES; i++) {
+            if (s_sources[i].used && s_sources[i].playing) {
+                any_playing = true;
+                duck |= s_sources[i].cfg.duck_others;
+            }
+        }
+
+        if (s_suspend_count > 0 || !any_playing) {
+            // Nothing to do: the TX DMA plays silence (auto_clear) until a source is ready
+            xSemaphoreGive(s_mixer_lock);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        memset(s_mix_buf, 0, sizeof(s_mix_buf));
+        for (int i = 0; i < MIXER_MAX_SOURCES; i++) {
+            audio_mixer_source_t *src = &s_sources[i];
+            if (src->used && src->playing) {
+                mixer_mix_source(src, duck && !src->cfg.duck_others);
+            }
+        }
+
+        const size_t samples = MIXER_PERIOD_FRAMES * s_out_channels;
+        for (size_t i = 0; i < samples; i++) {
+            int32_t v = s_mix_buf[i];
+            s_out_buf[i] = (v > 32767) ? 32767 : (v < -32768) ? -32768 : (int16_t)v;
+        }
+        if (s_tap_cb != NULL) {
+            s_tap_cb(s_out_buf, MIXER_PERIOD_FRAMES, s_out_channels);
+        }
+
+        if (s_out_channels == 1) {
+            /*
+            https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/peripherals/i2s.html#std-tx-mode
+            for 8-bit and 16-bit mono modes, the real data on the line is swapped. To get the correct data sequence,
+            the writing buffer needs to swap the data every two bytes.
+            */
+            for (size_t i = 0; i + 1 < samples; i += 2) {
+                int16_t tmp = s_out_buf[i];
+                s_out_buf[i] = s_out_buf[i + 1];
+                s_out_buf[i + 1] = tmp;
+            }
+        }
+
+        // Write without the mixer lock, so sources and fades are not held up for
+        // as long as the DMA queue takes to accept the period. The write lock is
+        // taken first, which lets audio_mixer_suspend() wait for this write.
+        xSemaphoreTake(s_write_lock, portMAX_DELAY);
+        xSemaphoreGive(s_mixer_lock);
+        esp_err_t ret = i2s_channel_write(s_tx_chan, s_out_buf, samples * sizeof(int16_t),
+                                          &bytes_written, pdMS_TO_TICKS(MIXER_WRITE_TIMEOUT_MS));
+        xSemaphoreGive(s_write_lock);
+
+        if (ret != ESP_OK) {
+            ESP_LOGW(MIXER_TAG, "I2S write failed: %d", ret);
+        }
+    }
+
+    xSemaphoreGive(s_mixer_exit_sem);
+    ESP_LOGI(MIXER_TAG, "%s - exiting gracefully", __func__);
+    vTaskDelete(NULL);
+}
+
+// ============================================================================
+// PUBLIC API: MIXER
+// ============================================================================
+
+esp_err_t audio_mixer_init(i2s_chan_handle_t tx_chan)
+{
+    if (s_mixer_task_handle != NULL) {
+        return ESP_OK;
+    }
+
+    if (s_mixer_lock == NULL && (s_mixer_lock = xSemaphoreCreateMutex()) == NULL) {
+        ESP_LOGE(MIXER_TAG, "Failed to create mixer lock");
+        return ESP_ERR_NO_MEM;
+    }
+    if (s_write_lock == NULL && (s_write_lock = xSemaphoreCreateMutex()) == NULL) {
+        ESP_LOGE(MIXER_TAG, "Failed to create mixer write lock");
+        return ESP_ERR_NO_MEM;
+    }
+    if (s_mixer_exit_sem == NULL && (s_mixer_exit_sem = xSemaphoreCreateBinary()) == NULL) {
+        ESP_LOGE(MIXER_TAG, "Failed to create mixer exit semaphore");
+        return ESP_ERR_NO_MEM;
+    }
+    // Fade and drain waits block on the slot's own semaphores, not on the
+    // caller's task notifications, which the caller may use for other things
+    for (int i = 0; i < MIXER_MAX_SOURCES; i++) {
+        if ((s_sources[i].drain_done == NULL && (s_sources[i].drain_done = xSemaphoreCreateBinary()) == NULL) ||
+            (s_sources[i].fade_done == NULL && (s_sources[i].fade_done = xSemaphoreCreateBinary()) == NULL)) {
+            ESP_LOGE(MIXER_TAG, "Failed to create source semaphores");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    s_tx_chan = tx_chan;
+    s_suspend_count = 1;
+    s_mixer_running = true;
+    if (xTaskCreate(mixer_task_handler, "BtI2SMixer", 4096, NULL, configMAX_PRIORITIES - 3, &s_mixer_task_handle) != pdPASS) {
+        ESP_LOGE(MIXER_TAG, "Failed to create mixer task");
+        s_mixer_running = false;
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(MIXER_TAG, "Mixer started (%d sources, %d frames per period)", MIXER_MAX_SOURCES, MIXER_PERIOD_FRAMES);
+    return ESP_OK;
+}
+
+void audio_mixer_deinit(void)
+{
+    if (s_mixer_task_handle == NULL) {
+        return;
+    }
+
+    s_mixer_running = false;
+    xTaskNotifyGive(s_mixer_task_handle);
+    if (xSemaphoreTake(s_mixer_exit_sem, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        ESP_LOGW(MIXER_TAG, "Mixer task did not stop in time");
+    }
+    s_mixer_task_handle = NULL;
+
+    for (int i = 0; i < MIXER_MAX_SOURCES; i++) {
+        if (s_sources[i].used) {
+            audio_mixer_source_destroy(&s_sources[i]);
+        }
+    }
+}
+
+void audio_mixer_set_tap(audio_mixer_tap_cb_t cb)
+{
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    s_tap_cb = cb;
+    xSemaphoreGive(s_mixer_lock);
+}
+
+void audio_mixer_set_output(int sample_rate, int channels)
+{
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    s_out_sample_rate = sample_rate;
+    s_out_channels = (channels == 1) ? 1 : 2;
+    for (int i = 0; i < MIXER_MAX_SOURCES; i++) {
+        if (s_sources[i].used) {
+            s_sources[i].step_q16 = mixer_calc_step(s_sources[i].cfg.sample_rate, sample_rate);
+        }
+    }
+    xSemaphoreGive(s_mixer_lock);
+    ESP_LOGI(MIXER_TAG, "Output format: %d Hz, %d ch", sample_rate, s_out_channels);
+}
+
+void audio_mixer_suspend(void)
+{
+    if (s_mixer_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    s_suspend_count++;
+    xSemaphoreGive(s_mixer_lock);
+    // A period that was mixed before the count went up is written under the
+    // write lock: taking it waits for that write to finish
+    xSemaphoreTake(s_write_lock, portMAX_DELAY);
+    xSemaphoreGive(s_write_lock);
+}
+
+void audio_mixer_resume(void)
+{
+    if (s_mixer_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    if (s_suspend_count > 0) {
+        s_suspend_count--;
+    }
+    xSemaphoreGive(s_mixer_lock);
+    if (s_mixer_task_handle != NULL) {
+        xTaskNotifyGive(s_mixer_task_handle);
+    }
+}
+
+// ============================================================================
+// PUBLIC API: SOURCES
+// ============================================================================
+
+audio_mixer_source_t *audio_mixer_source_create(const audio_mixer_source_cfg_t *cfg)
+{
+    if (cfg == NULL || s_mixer_lock == NULL || cfg->sample_rate <= 0 ||
+        (cfg->channels != 1 && cfg->channels != 2) || cfg->buffer_bytes == 0) {
+        ESP_LOGE(MIXER_TAG, "Invalid source configuration");
+        return NULL;
+    }
+
+    RingbufHandle_t ring = xRingbufferCreate(cfg->buffer_bytes, RINGBUF_TYPE_BYTEBUF);
+    if (ring == NULL) {
+        ESP_LOGE(MIXER_TAG, "%s ringbuffer create failed", cfg->name);
+        return NULL;
+    }
+
+    audio_mixer_source_t *src = NULL;
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    for (int i = 0; i < MIXER_MAX_SOURCES; i++) {
+        if (!s_sources[i].used) {
+            src = &s_sources[i];
+            break;
+        }
+    }
+    if (src != NULL) {
+        mixer_source_reset(src);
+        src->cfg = *cfg;
+        if (src->cfg.name == NULL) {
+            src->cfg.name = "source";
+        }
+        if (src->cfg.prefetch_bytes > cfg->buffer_bytes / 2) {
+            src->cfg.prefetch_bytes = cfg->buffer_bytes / 2;
+        }
+        src->ring = ring;
+        src->step_q16 = mixer_calc_step(cfg->sample_rate, s_out_sample_rate);
+        src->gain_target = AUDIO_MIXER_GAIN_UNITY;
+        src->gain_cur = AUDIO_MIXER_GAIN_UNITY;
+        src->used = true;
+    }
+    xSemaphoreGive(s_mixer_lock);
+
+    if (src == NULL) {
+        ESP_LOGE(MIXER_TAG, "No free mixer slot for %s", cfg->name);
+        vRingbufferDelete(ring);
+        return NULL;
+    }
+
+    ESP_LOGI(MIXER_TAG, "Source %s created (%d Hz, %d ch)", src->cfg.name, cfg->sample_rate, cfg->channels);
+    return src;
+}
+
+void audio_mixer_source_destroy(audio_mixer_source_t *src)
+{
+    if (src == NULL || !src->used) {
+        return;
+    }
+
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    if (src->drain_waiting) {
+        xSemaphoreGive(src->drain_done);
+    }
+    if (src->fade_waiting) {
+        xSemaphoreGive(src->fade_done);
+    }
+    vRingbufferDelete(src->ring);
+    ESP_LOGI(MIXER_TAG, "Source %s destroyed (underruns: %" PRIu32 ", dropped: %" PRIu32 ")",
+             src->cfg.name, src->underruns, src->drops);
+    mixer_source_reset(src);
+    xSemaphoreGive(s_mixer_lock);
+}
+
+size_t audio_mixer_source_write(audio_mixer_source_t *src, const void *data, size_t bytes, TickType_t wait)
+{
+    if (src == NULL || !src->used || data == NULL || bytes == 0) {
+        return 0;
+    }
+
+    if (xRingbufferSend(src->ring, data, bytes, wait) != pdTRUE) {
+        src->drops++;
+        if ((src->drops % 100) == 1) {
+            ESP_LOGW(MIXER_TAG, "%s ringbuffer full, dropped %" PRIu32 " chunks", src->cfg.name, src->drops);
+        }
+        return 0;
+    }
+
+    if (!src->playing && mixer_ring_fill(src) >= src->cfg.prefetch_bytes) {
+        src->playing = true;
+        if (s_mixer_task_handle != NULL) {
+            xTaskNotifyGive(s_mixer_task_handle);
+        }
+    }
+    return bytes;
+}
+
+void audio_mixer_source_set_gain(audio_mixer_source_t *src, int16_t gain_q15)
+{
+    if (src == NULL) {
+        return;
+    }
+    src->gain_target = (gain_q15 < 0) ? 0 : gain_q15;
+}
+
+void audio_mixer_source_flush(audio_mixer_source_t *src)
+{
+    if (src == NULL || !src->used) {
+        return;
+    }
+
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    src->playing = false;
+    size_t len = 0;
+    void *data;
+    while ((data = xRingbufferReceiveUpTo(src->ring, &len, 0, SIZE_MAX)) != NULL) {
+        vRingbufferReturnItem(src->ring, data);
+    }
+    src->stage_bytes = 0;
+    src->pos_q16 = 0;
+    xSemaphoreGive(s_mixer_lock);
+}
+
+void audio_mixer_source_set_format(audio_mixer_source_t *src, int sample_rate, int channels)
+{
+    if (src == NULL || !src->used) {
+        return;
+    }
+
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    src->playing = false;
+    size_t len = 0;
+    void *data;
+    while ((data = xRingbufferReceiveUpTo(src->ring, &len, 0, SIZE_MAX)) != NULL) {
+        vRingbufferReturnItem(src->ring, data);
+    }
+    src->stage_bytes = 0;
+    src->pos_q16 = 0;
+    src->cfg.sample_rate = sample_rate;
+    src->cfg.channels = (channels == 1) ? 1 : 2;
+    src->step_q16 = mixer_calc_step(sample_rate, s_out_sample_rate);
+    xSemaphoreGive(s_mixer_lock);
+    ESP_LOGI(MIXER_TAG, "%s format: %d Hz, %d ch", src->cfg.name, sample_rate, src->cfg.channels);
+}
+
+void audio_mixer_source_set_prefetch(audio_mixer_source_t *src, size_t prefetch_bytes)
+{
+    if (src == NULL || !src->used) {
+        return;
+    }
+    if (prefetch_bytes > src->cfg.buffer_bytes / 2) {
+        prefetch_bytes = src->cfg.buffer_bytes / 2;
+    }
+    src->cfg.prefetch_bytes = prefetch_bytes;
+}
+
+void audio_mixer_source_fade_in(audio_mixer_source_t *src, uint32_t fade_ms)
+{
+    if (src == NULL || !src->used) {
+        return;
+    }
+
+    int32_t periods = (int32_t)((uint64_t)fade_ms * s_out_sample_rate / (1000 * MIXER_PERIOD_FRAMES));
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    src->gain_cur = 0;
+    src->gain_ramp = (periods > 1) ? (src->gain_target + periods - 1) / periods : 0;
+    xSemaphoreGive(s_mixer_lock);
+}
+
+bool audio_mixer_source_fade_out(audio_mixer_source_t *src, uint32_t fade_ms, TickType_t timeout)
+{
+    if (src == NULL || !src->used) {
+        return true;
+    }
+
+    int32_t periods = (int32_t)((uint64_t)fade_ms * s_out_sample_rate / (1000 * MIXER_PERIOD_FRAMES));
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    src->gain_target = 0;
+    src->gain_ramp = (periods > 1) ? (src->gain_cur + periods - 1) / periods : 0;
+    if (!src->playing || src->gain_cur == 0 || s_suspend_count > 0) {
+        // Not being mixed, so already silent on the output
+        xSemaphoreGive(s_mixer_lock);
+        return true;
+    }
+    xSemaphoreTake(src->fade_done, 0);  // a give left over from a wait that timed out
+    src->fade_waiting = true;
+    xSemaphoreGive(s_mixer_lock);
+
+    if (xSemaphoreTake(src->fade_done, timeout) != pdTRUE) {
+        xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+        src->fade_waiting = false;
+        xSemaphoreGive(s_mixer_lock);
+        return false;
+    }
+    return true;
+}
+
+size_t audio_mixer_source_get_fill(audio_mixer_source_t *src)
+{
+    if (src == NULL || !src->used) {
+        return 0;
+    }
+    return mixer_ring_fill(src) + src->stage_bytes;
+}
+
+bool audio_mixer_source_is_playing(audio_mixer_source_t *src)
+{
+    return src != NULL && src->used && src->playing;
+}
+
+uint32_t audio_mixer_source_get_underruns(audio_mixer_source_t *src)
+{
+    if (src == NULL || !src->used) {
+        return 0;
+    }
+    return src->underruns;
+}
+
+bool audio_mixer_source_drain(audio_mixer_source_t *src, TickType_t timeout)
+{
+    if (src == NULL || !src->used) {
+        return true;
+    }
+
+    xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+    if (mixer_ring_fill(src) == 0 && mixer_stage_frames(src) <= 1) {
+        xSemaphoreGive(s_mixer_lock);
+        return true;
+    }
+    // Play out a tail that never reached the prefetch level
+    xSemaphoreTake(src->drain_done, 0);  // a give left over from a wait that timed out
+    src->drain_waiting = true;
+    src->playing = true;
+    xSemaphoreGive(s_mixer_lock);
+
+    xTaskNotifyGive(s_mixer_task_handle);
+    if (xSemaphoreTake(src->drain_done, timeout) != pdTRUE) {
+        xSemaphoreTake(s_mixer_lock, portMAX_DELAY);
+        src->drain_waiting = false;
+        xSemaphoreGive(s_mixer_lock);
+        return false;
+    }
+    return true;
+}
@@ -24,6 +24,7 @@
 #include "time.h"
 #include "sys/time.h"
 #include "sdkconfig.h"
+#include "esp_timer.h"
 #include "driver/i2s_std.h" 
 #include "bt_i2s.h"
 #include "codec.h"
@@ -183,6 +184,7 @@ extern esp_bd_addr_t peer_addr;
 
 static esp_hf_sync_conn_hdl_t s_sync_conn_hdl;
 static bool s_msbc_air_mode = false;
+static uint16_t s_hfp_frame_size = ESP_HF_MSBC_ENCODED_FRAME_SIZE;  // bytes sent per audio data callback
 QueueHandle_t s_audio_buff_queue = NULL;
 // static int s_audio_buff_cnt = 0;
 static int s_audio_callback_cnt = 0;
@@ -190,6 +192,219 @@ static int s_audio_callback_cnt = 0;
 static bool s_hfp_audio_connected = false;
 static bool s_inband_ring_enabled = false;
 
+// ============================================================================
+// LINK QUALITY
+// ============================================================================
+
+#ifndef CONFIG_A2DPSINK_HFPHF_LINK_QUALITY_INTERVAL_MS
+#define CONFIG_A2DPSINK_HFPHF_LINK_QUALITY_INTERVAL_MS 1000
+#endif
+#ifndef CONFIG_A2DPSINK_HFPHF_LINK_QUALITY_WINDOW
+#define CONFIG_A2DPSINK_HFPHF_LINK_QUALITY_WINDOW 5
+#endif
+
+#define LINK_QUALITY_WINDOW CONFIG_A2DPSINK_HFPHF_LINK_QUALITY_WINDOW
+
+/* The controller's packet counters are cumulative for the (e)SCO link; each
+   sample keeps the difference to the previous one. Only the counts live in the
+   window slots (window_ms holds the slot's duration), the rates are worked out
+   over their sum. */
+typedef struct {
+    esp_timer_handle_t timer;
+    bool running;
+    hfp_link_quality_t last;                        // cumulative counts at the last sample
+    int64_t last_us;
+    hfp_link_quality_t window[LINK_QUALITY_WINDOW];
+    uint8_t next;
+    uint8_t filled;
+    hfp_link_quality_t call;                        // whole call
+    uint16_t worst_loss;                            // worst windowed rx loss this call
+    uint8_t grow_hold;                              // samples before the loss is reported to bt_i2s again
+    bool valid;
+    hfp_link_quality_t quality;                     // latest rolling sample, for the getter
+    hfp_link_quality_cb_t cb;
+} link_quality_t;
+
+static link_quality_t s_link;
+static portMUX_TYPE s_link_lock = portMUX_INITIALIZER_UNLOCKED;
+// Written by the audio data callback only
+static volatile uint32_t s_link_frames = 0;
+static volatile uint32_t s_link_bad_frames = 0;
+
+static inline uint32_t link_delta(uint32_t now, uint32_t last)
+{
+    // A counter that went backwards was reset by the controller
+    return (now >= last) ? now - last : now;
+}
+
+static uint16_t link_permille(uint32_t num, uint32_t den)
+{
+    if (den == 0) {
+        return 0;
+    }
+    uint64_t p = (uint64_t)num * 1000 / den;
+    return (p > 1000) ? 1000 : (uint16_t)p;
+}
+
+static void link_quality_add(hfp_link_quality_t *sum, const hfp_link_quality_t *d)
+{
+    sum->window_ms    += d->window_ms;
+    sum->rx_total     += d->rx_total;
+    sum->rx_err       += d->rx_err;
+    sum->rx_lost      += d->rx_lost;
+    sum->tx_total     += d->tx_total;
+    sum->tx_discarded += d->tx_discarded;
+    sum->frames       += d->frames;
+    sum->bad_frames   += d->bad_frames;
+}
+
+static void link_quality_rates(hfp_link_quality_t *q)
+{
+    q->rx_loss_permille    = link_permille(q->rx_lost, q->rx_total);
+    q->rx_err_permille     = link_permille(q->rx_err, q->rx_total);
+    q->tx_discard_permille = link_permille(q->tx_discarded, q->tx_total);
+    q->bad_frame_permille  = link_permille(q->bad_frames, q->frames);
+}
+
+static void link_quality_timer_cb(void *arg)
+{
+    (void)arg;
+    if (s_link.running) {
+        // Answered with ESP_HF_CLIENT_PKT_STAT_NUMS_GET_EVT
+        esp_hf_client_pkt_stat_nums_get(s_sync_conn_hdl);
+    }
+}
+
+/**
+ * @brief Start sampling for a new call (before the audio data callback runs)
+ */
+static void link_quality_start(void)
+{
+    portENTER_CRITICAL(&s_link_lock);
+    s_link.valid = false;
+    memset(&s_link.quality, 0, sizeof(s_link.quality));
+    portEXIT_CRITICAL(&s_link_lock);
+
+    memset(&s_link.last, 0, sizeof(s_link.last));
+    memset(&s_link.call, 0, sizeof(s_link.call));
+    s_link.next = 0;
+    s_link.filled = 0;
+    s_link.worst_loss = 0;
+    s_link.grow_hold = 0;
+    s_link.last_us = esp_timer_get_time();
+    s_link_frames = 0;
+    s_link_bad_frames = 0;
+    s_link.running = true;
+
+#if CONFIG_A2DPSINK_HFPHF_LINK_QUALITY_INTERVAL_MS > 0
+    if (s_link.timer == NULL) {
+        const esp_timer_create_args_t args = {
+            .callback = link_quality_timer_cb,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "hf_link_q",
+            .skip_unhandled_events = true,
+        };
+        if (esp_timer_create(&args, &s_link.timer) != ESP_OK) {
+            ESP_LOGE(BT_HF_TAG, "Failed to create link quality timer");
+            s_link.timer = NULL;
+            return;
+        }
+    }
+    esp_timer_start_periodic(s_link.timer, (uint64_t)CONFIG_A2DPSINK_HFPHF_LINK_QUALITY_INTERVAL_MS * 1000);
+#endif
+}
+
+/**
+ * @brief One packet statistics answer: update the window and report it
+ */
+static void link_quality_sample(const esp_hf_client_cb_param_t *param)
+{
+    if (!s_link.running) {
+        return;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    hfp_link_quality_t cum = {
+        .rx_total     = param->pkt_nums.rx_total,
+        .rx_err       = param->pkt_nums.rx_err,
+        .rx_lost      = param->pkt_nums.rx_none + param->pkt_nums.rx_lost,
+        .tx_total     = param->pkt_nums.tx_total,
+        .tx_discarded = param->pkt_nums.tx_discarded,
+        .frames       = s_link_frames,
+        .bad_frames   = s_link_bad_frames,
+    };
+    hfp_link_quality_t d = {
+        .window_ms    = (uint32_t)((now_us - s_link.last_us) / 1000),
+        .rx_total     = link_delta(cum.rx_total, s_link.last.rx_total),
+        .rx_err       = link_delta(cum.rx_err, s_link.last.rx_err),
+        .rx_lost      = link_delta(cum.rx_lost, s_link.last.rx_lost),
+        .tx_total     = link_delta(cum.tx_total, s_link.last.tx_total),
+        .tx_discarded = link_delta(cum.tx_discarded, s_link.last.tx_discarded),
+        .frames       = link_delta(cum.frames, s_link.last.frames),
+        .bad_frames   = link_delta(cum.bad_frames, s_link.last.bad_frames),
+    };
+    s_link.last = cum;
+    s_link.last_us = now_us;
+    link_quality_add(&s_link.call, &d);
+
+    s_link.window[s_link.next] = d;
+    s_link.next = (s_link.next + 1) % LINK_QUALITY_WINDOW;
+    if (s_link.filled < LINK_QUALITY_WINDOW) {
+        s_link.filled++;
+    }
+
+    hfp_link_quality_t q = {0};
+    for (int i = 0; i < s_link.filled; i++) {
+        link_quality_add(&q, &s_link.window[i]);
+    }
+    link_quality_rates(&q);
+    if (q.rx_loss_permille > s_link.worst_loss) {
+        s_link.worst_loss = q.rx_loss_permille;
+    }
+    // Deepen the speaker buffer on a lossy link; the window has to turn over
+    // before the same losses could do it again
+    if (s_link.grow_hold > 0) {
+        s_link.grow_hold--;
+    } else if (bt_i2s_hfp_link_loss(q.rx_loss_permille)) {
+        s_link.grow_hold = LINK_QUALITY_WINDOW;
+    }
+
+    portENTER_CRITICAL(&s_link_lock);
+    s_link.quality = q;
+    s_link.valid = true;
+    portEXIT_CRITICAL(&s_link_lock);
+
+    ESP_LOGD(BT_HF_TAG, "Link quality (%"PRIu32" ms): rx loss %u.%u%%, rx err %u.%u%%, tx discard %u.%u%%, bad frames %u.%u%%",
+             q.window_ms, q.rx_loss_permille / 10, q.rx_loss_permille % 10, q.rx_err_permille / 10, q.rx_err_permille % 10,
+             q.tx_discard_permille / 10, q.tx_discard_permille % 10, q.bad_frame_permille / 10, q.bad_frame_permille % 10);
+
+    if (s_link.cb) {
+        s_link.cb(&q);
+    }
+}
+
+/**
+ * @brief Stop sampling and log the call's link quality
+ */
+static void link_quality_stop(void)
+{
+    if (!s_link.running) {
+        return;
+    }
+    s_link.running = false;
+    if (s_link.timer != NULL) {
+        esp_timer_stop(s_link.timer);
+    }
+
+    hfp_link_quality_t c = s_link.call;
+    link_quality_rates(&c);
+    ESP_LOGI(BT_HF_TAG, "Call link quality over %"PRIu32" s: rx loss %u.%u%% (worst %u.%u%%), rx err %u.%u%%, "
+             "tx discard %u.%u%%, bad frames %u.%u%%",
+             c.window_ms / 1000, c.rx_loss_permille / 10, c.rx_loss_permille % 10,
+             s_link.worst_loss / 10, s_link.worst_loss % 10, c.rx_err_permille / 10, c.rx_err_permille % 10,
+             c.tx_discard_permille / 10, c.tx_discard_permille % 10, c.bad_frame_permille / 10, c.bad_frame_permille % 10);
+}
+
 // When incoming call received with number
 void on_incoming_call(const char *caller_number)
 {
@@ -215,46 +430,50 @@ static void bt_app_hf_client_audio_data_cb(esp_hf_sync_conn_hdl_t sync_conn_hdl,
         return;
     }
     
-    if (!is_bad_frame) {
-        /* decode our incoming data and send it to i2s tx ringbuffer */
-        uint8_t *decoded_buffer = malloc(MSBC_FRAME_SAMPLES * 2);
-        size_t decoded_len;
-        if (msbc_dec_data(audio_buf->data, audio_buf->data_len, 
-                            decoded_buffer, &decoded_len) == 0) {
-            bt_i2s_hfp_write_tx_ringbuf(decoded_buffer, decoded_len);
-        }
-        free(decoded_buffer);
-    }
-    esp_hf_client_audio_buff_free(audio_buf);
+    int64_t cb_start_us = esp_timer_get_time();
+    uint32_t heap_ops = 0;
     
-    /* fetch our msbc encoded mic data and send it to the ag */
-    uint8_t *mic_data = malloc(ESP_HF_MSBC_ENCODED_FRAME_SIZE);
-    size_t mic_data_len = bt_i2s_hfp_read_rx_ringbuf(mic_data);
+    s_link_frames++;
+    if (is_bad_frame) {
+        s_link_bad_frames++;
+    }
     
-    esp_hf_audio_buff_t *audio_data_to_send = esp_hf_client_audio_buff_alloc((uint16_t) ESP_HF_MSBC_ENCODED_FRAME_SIZE);
+    /* queue our incoming data; it is decoded (or concealed, if bad) by the bt_i2s HFP decode task */
+    bt_i2s_hfp_write_tx_frame(audio_buf->data, audio_buf->data_len, is_bad_frame);
     
-    // Only encode if we actually have mic data AND connection is still active
-    if (mic_data_len > 0 && s_hfp_audio_connected) {
-        memcpy(audio_data_to_send->data, mic_data, ESP_HF_MSBC_ENCODED_FRAME_SIZE);
-    } else {
-        // Send silence if no mic data or connection closing
-        memset(audio_data_to_send->data, 0, ESP_HF_MSBC_ENCODED_FRAME_SIZE);
+    /* Send the mic frame back in the buffer we just received, so the data path does
+       no heap traffic of its own; only fall back to a new buffer if it is too small */
+    esp_hf_audio_buff_t *audio_data_to_send = audio_buf;
+    if (audio_buf->buff_size < s_hfp_frame_size) {
+        esp_hf_client_audio_buff_free(audio_buf);
+        audio_data_to_send = esp_hf_client_audio_buff_alloc(s_hfp_frame_size);
+        heap_ops += 2;
+        if (audio_data_to_send == NULL) {
+            bt_i2s_hfp_account_frame(heap_ops, (uint32_t)(esp_timer_get_time() - cb_start_us));
+            return;
+        }
     }
     
-    audio_data_to_send->data_len = ESP_HF_MSBC_ENCODED_FRAME_SIZE;
-    free(mic_data);
+    /* fetch our mic data (msbc encoded, or pcm on cvsd) straight into the outgoing buffer;
+       this never blocks and always yields a whole frame (comfort noise if the mic is late) */
+    size_t mic_data_len = bt_i2s_hfp_read_rx_ringbuf(audio_data_to_send->data, s_hfp_frame_size);
+    
+    // Send silence if HFP audio isn't running or the connection is closing
+    if (mic_data_len == 0 || !s_hfp_audio_connected) {
+        memset(audio_data_to_send->data, 0, s_hfp_frame_size);
+    }
+    audio_data_to_send->data_len = s_hfp_frame_size;
     
     if (esp_hf_client_audio_data_send(s_sync_conn_hdl, audio_data_to_send) != ESP_OK) {
         esp_hf_client_audio_buff_free(audio_data_to_send);
+        heap_ops++;
         // Don't log warning during shutdown
         if (s_hfp_audio_connected) {
             ESP_LOGW(BT_HF_TAG, "%s failed to send audio data", __func__);
         }
     }
     
-    if (s_audio_callback_cnt % 1000 == 0) {
-        esp_hf_client_pkt_stat_nums_get(sync_conn_hdl);
-    }
+    bt_i2s_hfp_account_frame(heap_ops, (uint32_t)(esp_timer_get_time() - cb_start_us));
     s_audio_callback_cnt++;
 }
 
@@ -291,10 +510,15 @@ void bt_app_hf_client_cb(esp_hf_client_cb_event_t event, esp_hf_client_cb_param_
             if (param->audio_stat.state == ESP_HF_CLIENT_AUDIO_STATE_CONNECTED_MSBC) {
                 s_msbc_air_mode = true;
                 ESP_LOGI(BT_HF_TAG, "--audio air mode: mSBC , preferred_frame_size: %d", param->audio_stat.preferred_frame_size);
+                bt_i2s_hfp_set_codec(BT_I2S_HFP_CODEC_MSBC, 0);
+                s_hfp_frame_size = bt_i2s_hfp_frame_bytes();
             }
             else if (param->audio_stat.state == ESP_HF_CLIENT_AUDIO_STATE_CONNECTED) {
                 s_msbc_air_mode = false;
                 ESP_LOGI(BT_HF_TAG, "--audio air mode: CVSD , preferred_frame_size: %d", param->audio_stat.preferred_frame_size);
+                // Narrowband: 8 kHz PCM over HCI, sent in the controller's preferred frame size
+                bt_i2s_hfp_set_codec(BT_I2S_HFP_CODEC_CVSD, param->audio_stat.preferred_frame_size);
+                s_hfp_frame_size = bt_i2s_hfp_frame_bytes();
             }
 
             if (param->audio_stat.state == ESP_HF_CLIENT_AUDIO_STATE_CONNECTED ||
@@ -304,6 +528,7 @@ void bt_app_hf_client_cb(esp_hf_client_cb_event_t event, esp_hf_client_cb_param_
                 // Stop ringtone when phone audio connects
                 ringtone_stop();
                 s_sync_conn_hdl = param->audio_stat.sync_conn_handle;
+                link_quality_start();
                 s_hfp_audio_connected = true;
                 bt_i2s_hfp_start();
                 esp_hf_client_register_audio_data_callback(bt_app_hf_client_audio_data_cb);
@@ -313,6 +538,7 @@ void bt_app_hf_client_cb(esp_hf_client_cb_event_t event, esp_hf_client_cb_param_
                 // RESUME PHONEBOOK AFTER CALL
                 // bt_app_pbac_resume();
                 bt_hfp_audio_connection_state_changed(false);
+                link_quality_stop();
                 s_sync_conn_hdl = 0;
                 s_msbc_air_mode = false;
                 s_hfp_audio_connected = false;
@@ -482,9 +708,10 @@ void bt_app_hf_client_cb(esp_hf_client_cb_event_t event, esp_hf_client_cb_param_
 
         case ESP_HF_CLIENT_PKT_STAT_NUMS_GET_EVT:
         {
-            ESP_LOGI(BT_HF_TAG, "total packets: %d, received ok: %d, received err: %d, received none: %d, received lost: %d, sent: %d, sent lost: %d", 
+            ESP_LOGD(BT_HF_TAG, "total packets: %"PRIu32", received ok: %"PRIu32", received err: %"PRIu32", received none: %"PRIu32", received lost: %"PRIu32", sent: %"PRIu32", sent lost: %"PRIu32, 
                 param->pkt_nums.rx_total, param->pkt_nums.rx_correct, param->pkt_nums.rx_err, param->pkt_nums.rx_none, param->pkt_nums.rx_lost,
                 param->pkt_nums.tx_total, param->pkt_nums.tx_discarded);
+            link_quality_sample(param);
             break;
         }
         case ESP_HF_CLIENT_PROF_STATE_EVT:
@@ -504,6 +731,25 @@ void bt_app_hf_client_cb(esp_hf_client_cb_event_t event, esp_hf_client_cb_param_
     }
 }
 
+void bt_app_hf_register_link_quality_cb(hfp_link_quality_cb_t callback)
+{
+    s_link.cb = callback;
+}
+
+esp_err_t bt_app_hf_get_link_quality(hfp_link_quality_t *quality)
+{
+    if (quality == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&s_link_lock);
+    bool valid = s_link.valid;
+    if (valid) {
+        *quality = s_link.quality;
+    }
+    portEXIT_CRITICAL(&s_link_lock);
+    return valid ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
 esp_err_t bt_app_hf_connect_audio(void)
 {
     ESP_LOGI(BT_HF_TAG, "Connecting HFP audio to peer: %02x:%02x:%02x:%02x:%02x:%02x",
@@ -19,32 +19,135 @@
 #include "freertos/ringbuf.h"
 #include "sys/lock.h"
 #include "driver/i2s_std.h"
+#if CONFIG_A2DPSINK_HFPHF_MIC_PDM
+#include "driver/i2s_pdm.h"
+#endif
 #include "bt_i2s.h"
 #include "bt_app_hf.h"
 #include "codec.h"
+#include "audio_mixer.h"
+#include "hfp_aec.h"
+#include "hfp_ns.h"
+#include "hfp_agc.h"
+#include "hfp_mic.h"
 #include "esp_timer.h"
+#include "sdkconfig.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
 
 #define BT_I2S_TAG "BT_I2S"
 
 // Sample rates and bit widths
 #define HFP_SAMPLE_RATE 16000
+#define HFP_CVSD_SAMPLE_RATE 8000
 #define HFP_I2S_DATA_BIT_WIDTH I2S_DATA_BIT_WIDTH_16BIT
 #define A2DP_STANDARD_SAMPLE_RATE 44100
 #define A2DP_I2S_DATA_BIT_WIDTH I2S_DATA_BIT_WIDTH_16BIT
 
+// I2S ports. PDM reception is only available on I2S0, so with a PDM microphone
+// the speaker moves to I2S1
+#if CONFIG_A2DPSINK_HFPHF_MIC_PDM
+#define BT_I2S_TX_PORT I2S_NUM_1
+#define BT_I2S_RX_PORT I2S_NUM_0
+#else
+#define BT_I2S_TX_PORT I2S_NUM_0
+#define BT_I2S_RX_PORT I2S_NUM_1
+#endif
+
+// Duplex (audio codec): TX and RX share one controller and its BCK/WS, so both
+// directions use the same frame format; I2S (Philips) is what codecs default to
+#if CONFIG_A2DPSINK_HFPHF_I2S_DUPLEX
+#define BT_I2S_TX_SLOT_DEFAULT_CONFIG I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG
+#define BT_I2S_MCLK_GPIO CONFIG_A2DPSINK_HFPHF_I2S_MCLK
+#else
+#define BT_I2S_TX_SLOT_DEFAULT_CONFIG I2S_STD_MSB_SLOT_DEFAULT_CONFIG
+#define BT_I2S_MCLK_GPIO I2S_GPIO_UNUSED
+#endif
+
 // A2DP ringbuffer watermarks
 #define RINGBUF_HIGHEST_WATER_LEVEL (32 * 1024)
 #define RINGBUF_PREFETCH_WATER_LEVEL (20 * 1024)
 
 // HFP ringbuffer watermarks
 #define RINGBUF_HFP_TX_HIGHEST_WATER_LEVEL (32 * MSBC_FRAME_SAMPLES * 2)
-#define RINGBUF_HFP_TX_PREFETCH_WATER_LEVEL (20 * MSBC_FRAME_SAMPLES * 2)
-#define RINGBUF_HFP_RX_HIGHEST_WATER_LEVEL (32 * ESP_HF_MSBC_ENCODED_FRAME_SIZE)
-#define RINGBUF_HFP_RX_PREFETCH_WATER_LEVEL (20 * ESP_HF_MSBC_ENCODED_FRAME_SIZE)
+// The RX ringbuffer holds RINGBUF_HFP_RX_FRAMES microphone frames of the call's codec
+#define RINGBUF_HFP_RX_FRAMES 32
+#define RINGBUF_HFP_RX_PREFETCH_MAX_FRAMES (RINGBUF_HFP_RX_FRAMES * 3 / 4)
+
+// HFP prefetch per latency profile, in frames (speaker: 7.5 ms of PCM, microphone:
+// one RX task frame); every underrun during a call adds HFP_PREFETCH_GROW_FRAMES
+#define HFP_PREFETCH_NORMAL_SPK_FRAMES 8
+#define HFP_PREFETCH_NORMAL_MIC_FRAMES 10
+#define HFP_PREFETCH_LOW_SPK_FRAMES 3
+#define HFP_PREFETCH_LOW_MIC_FRAMES 2
+#define HFP_PREFETCH_GROW_FRAMES 2
+#define HFP_PREFETCH_SPK_MAX_FRAMES 16  // the mixer caps prefetch at half the source buffer
+
+// Received frames (mSBC, or CVSD-rate PCM) queued between the HFP audio data callback and
+// the decode task (no-split ring: each item is a status byte and one frame plus an 8 byte
+// header, rounded to 4 bytes; the largest HCI SCO payload is 240 bytes)
+#define HFP_FRAME_QUEUE_FRAMES 8
+#define HFP_FRAME_QUEUE_ITEM_MAX 244
+#define HFP_FRAME_QUEUE_SIZE (HFP_FRAME_QUEUE_FRAMES * (HFP_FRAME_QUEUE_ITEM_MAX + 8))
+#define HFP_FRAME_GOOD 0
+#define HFP_FRAME_BAD 1
+
+// Narrowband calls: the controller transcodes CVSD, HCI carries 8 kHz 16-bit PCM.
+// Used when the audio state event does not report a frame size.
+#define HFP_CVSD_DEFAULT_FRAME_BYTES 120
+
+// Packet loss concealment: one eSCO frame every 7.5 ms for mSBC. A frame counts as missing
+// once it is more than a frame late; at most HFP_PLC_MAX_GAP_FRAMES are synthesized per gap,
+// after that the link is considered stalled and the speaker source is left to run dry
+#define HFP_MSBC_FRAME_US 7500
+#define HFP_PLC_MAX_GAP_FRAMES 8
+
+// Keep the HFP decode task off the core running the Bluedroid host, whose BTC task
+// runs the audio data callback
+#if CONFIG_FREERTOS_UNICORE
+#define HFP_DECODE_TASK_CORE tskNO_AFFINITY
+#elif defined(CONFIG_BT_BLUEDROID_PINNED_TO_CORE)
+#define HFP_DECODE_TASK_CORE (CONFIG_BT_BLUEDROID_PINNED_TO_CORE ? 0 : 1)
+#else
+#define HFP_DECODE_TASK_CORE 1
+#endif
 
 // Mode switch timeout
 #define I2S_MODE_SWITCH_TIMEOUT_MS 2000
 
+// A2DP <-> HFP handover: the outgoing source fades out before its pipeline is torn
+// down, the incoming one fades in; a handover slower than the budget is logged
+#define HANDOVER_FADE_MS 30
+#define HANDOVER_BUDGET_MS 200
+
+// A2DP output channel mode (Kconfig default, can be changed between streams)
+#if CONFIG_A2DPSINK_HFPHF_OUTPUT_MONO_SUM
+#define BT_I2S_OUTPUT_CHANNELS_DEFAULT BT_I2S_OUTPUT_MONO_SUM
+#elif CONFIG_A2DPSINK_HFPHF_OUTPUT_LEFT
+#define BT_I2S_OUTPUT_CHANNELS_DEFAULT BT_I2S_OUTPUT_LEFT
+#elif CONFIG_A2DPSINK_HFPHF_OUTPUT_RIGHT
+#define BT_I2S_OUTPUT_CHANNELS_DEFAULT BT_I2S_OUTPUT_RIGHT
+#else
+#define BT_I2S_OUTPUT_CHANNELS_DEFAULT BT_I2S_OUTPUT_STEREO
+#endif
+
+// A2DP silence detection (idle the TX channel while the source sends digital silence)
+#ifndef CONFIG_A2DPSINK_HFPHF_SILENCE_HOLD_MS
+#define CONFIG_A2DPSINK_HFPHF_SILENCE_HOLD_MS 5000
+#endif
+#ifndef CONFIG_A2DPSINK_HFPHF_SILENCE_THRESHOLD
+#define CONFIG_A2DPSINK_HFPHF_SILENCE_THRESHOLD 4
+#endif
+#ifndef CONFIG_A2DPSINK_HFPHF_SILENCE_FADE_MS
+#define CONFIG_A2DPSINK_HFPHF_SILENCE_FADE_MS 20
+#endif
+
+// Call link loss (tenths of a percent) that deepens the speaker buffer; 0: never
+#ifndef CONFIG_A2DPSINK_HFPHF_LINK_LOSS_GROW_PERMILLE
+#define CONFIG_A2DPSINK_HFPHF_LINK_LOSS_GROW_PERMILLE 50
+#endif
+
 // Ringbuffer modes
 enum {
     RINGBUFFER_MODE_PROCESSING,  /* ringbuffer is buffering incoming audio data, I2S is working */
@@ -62,11 +165,11 @@ enum {
  * STATIC VARIABLE DEFINITIONS
  ******************************/
 
-// A2DP TX task and ringbuffer
-static TaskHandle_t s_bt_i2s_a2dp_tx_task_handle = NULL;
-static RingbufHandle_t s_i2s_a2dp_tx_ringbuf = NULL;
-static uint16_t s_i2s_a2dp_tx_ringbuffer_mode = RINGBUFFER_MODE_PREFETCHING;
-static volatile bool s_bt_i2s_a2dp_tx_task_running = false;
+// Mixer sources feeding the I2S TX channel
+static audio_mixer_source_t *s_a2dp_source = NULL;
+static audio_mixer_source_t *s_hfp_source = NULL;
+static int s_output_refs = 0;  // bt_i2s_output_acquire() users keeping TX enabled
+static bt_i2s_output_state_cb_t s_output_state_cb = NULL;
 
 // HFP RX task and ringbuffer (microphone)
 static TaskHandle_t s_bt_i2s_hfp_rx_task_handle = NULL;
@@ -75,16 +178,67 @@ static RingbufHandle_t s_i2s_hfp_rx_ringbuf = NULL;
 static SemaphoreHandle_t s_i2s_hfp_rx_ringbuf_delete = NULL;
 static uint16_t s_i2s_hfp_rx_ringbuffer_mode = RINGBUFFER_MODE_PREFETCHING;
 
-// HFP TX task and ringbuffer (speaker)
-static TaskHandle_t s_bt_i2s_hfp_tx_task_handle = NULL;
-static bool s_bt_i2s_hfp_tx_task_running = false;
-static RingbufHandle_t s_i2s_hfp_tx_ringbuf = NULL;
-static SemaphoreHandle_t s_i2s_hfp_tx_ringbuf_delete = NULL;
-static uint16_t s_i2s_hfp_tx_ringbuffer_mode = RINGBUFFER_MODE_PREFETCHING;
+// HFP speaker decode task, fed with encoded frames by the HFP audio data callback
+static TaskHandle_t s_bt_i2s_hfp_dec_task_handle = NULL;
+static volatile bool s_bt_i2s_hfp_dec_task_running = false;
+static SemaphoreHandle_t s_hfp_dec_task_exit_sem = NULL;
+static RingbufHandle_t s_hfp_frame_queue = NULL;      // created once, flushed on every HFP start
+static codec_ctx_t *s_hfp_msbc_dec = NULL;           // survives across calls, used by the decode task only
+static int16_t s_hfp_pcm_frame[MSBC_FRAME_SAMPLES];  // decode output of the decode task
+
+// HFP air codec of the next/current call (set from the audio state event)
+static bt_i2s_hfp_codec_t s_hfp_codec = BT_I2S_HFP_CODEC_MSBC;
+static int s_hfp_sample_rate = HFP_SAMPLE_RATE;
+static size_t s_hfp_cvsd_frame_bytes = HFP_CVSD_DEFAULT_FRAME_BYTES;
+static uint32_t s_hfp_frame_us = HFP_MSBC_FRAME_US;
+static int s_rx_sample_rate = HFP_SAMPLE_RATE;      // clock the RX channel is configured for
+
+// HFP buffering: the profile picks the prefetch each call starts from, underruns grow it
+static bt_i2s_hfp_latency_t s_hfp_latency =
+#if CONFIG_A2DPSINK_HFPHF_HFP_LATENCY_LOW
+    BT_I2S_HFP_LATENCY_LOW;
+#else
+    BT_I2S_HFP_LATENCY_NORMAL;
+#endif
+static uint32_t s_hfp_spk_prefetch_frames = HFP_PREFETCH_NORMAL_SPK_FRAMES;
+static uint32_t s_hfp_mic_prefetch_frames = HFP_PREFETCH_NORMAL_MIC_FRAMES;
+static size_t s_hfp_mic_prefetch_bytes = 0;
+static size_t s_hfp_rx_ringbuf_size = 0;
+static uint32_t s_hfp_spk_underruns_seen = 0;    // mixer source underruns already acted on
+static volatile bool s_hfp_spk_link_grow = false;  // set by bt_i2s_hfp_link_loss(), acted on by the decode task
+
+// Uplink fill frames, sent when the microphone has no frame ready: the last real frame
+// once, then comfort noise (one mSBC frame encoded by the RX task, or PCM on CVSD)
+static uint8_t s_hfp_uplink_last[HFP_FRAME_QUEUE_ITEM_MAX];
+static size_t s_hfp_uplink_last_len = 0;
+static uint32_t s_hfp_uplink_fills = 0;          // fill frames since the last real one
+static uint8_t s_hfp_uplink_cn[MSBC_FRAME_SAMPLES * 2];
+static volatile bool s_hfp_uplink_cn_ready = false;
+
+// DMA buffering in frames, for lining up the echo canceller reference with the microphone
+static size_t s_tx_dma_frames = 0;   // whole TX queue: the mixer runs this far ahead of the speaker
+static size_t s_rx_dma_frames = 0;   // one RX descriptor: the most a microphone read can lag
+
+// HFP data path accounting for the current call
+static uint32_t s_hfp_call_frames = 0;
+static uint32_t s_hfp_call_heap_ops = 0;
+static uint64_t s_hfp_call_cb_us = 0;
+static uint32_t s_hfp_call_cb_max_us = 0;
+static uint32_t s_hfp_call_queue_drops = 0;
+static uint32_t s_hfp_call_bad_frames = 0;
+static uint32_t s_hfp_call_concealed = 0;
+static uint32_t s_hfp_call_spk_underruns = 0;
+static uint32_t s_hfp_call_mic_underruns = 0;
+static uint32_t s_hfp_call_uplink_fill = 0;
+static uint32_t s_hfp_call_dec_wakeups = 0;
+static uint32_t s_hfp_call_dec_timeouts = 0;
+static uint32_t s_hfp_call_cb_hist[BT_I2S_HFP_CB_HIST_BUCKETS];
+static const uint32_t s_hfp_cb_hist_bounds_us[BT_I2S_HFP_CB_HIST_BUCKETS - 1] = { 50, 100, 200, 500, 1000, 2000, 5000 };
+static uint64_t s_hfp_cb_total_us = 0;  // since bt_i2s_init(), for hfp_cb_avg_us
 
 // I2S mode management
 static i2s_tx_mode_t s_i2s_tx_mode = I2S_TX_MODE_NONE;
-static SemaphoreHandle_t s_i2s_tx_semaphore = NULL;
+static bool s_a2dp_preempted = false;  // a call took over a running A2DP stream; resume it after
 static SemaphoreHandle_t s_i2s_rx_semaphore = NULL;
 static SemaphoreHandle_t s_i2s_mode_mutex = NULL;
 static SemaphoreHandle_t s_i2s_mode_idle_sem = NULL;
@@ -98,16 +252,66 @@ static volatile bool s_bt_i2s_a2dp_decode_task_running = false;
 // A2DP SBC packet configuration (set once after audio config)
 static uint16_t s_a2dp_sbc_packet_size = 0;
 static uint8_t s_a2dp_sbc_frames_per_packet = 0;
-static SemaphoreHandle_t s_a2dp_params_ready_sem = NULL;
+
+// In-place reconfiguration: requested on the BTC task, carried out by the decode task.
+// The requested stream and the replaced ringbuffer are guarded by the mode mutex.
+#define A2DP_RECONFIG_DRAIN_MS 500
+static volatile bool s_a2dp_reconfig_pending = false;
+static a2dp_codec_type_t s_a2dp_reconfig_codec;
+static int s_a2dp_reconfig_sample_rate;
+static int s_a2dp_reconfig_ch_count;
+static RingbufHandle_t s_a2dp_reconfig_old_ringbuf = NULL;  // still read by the decode task
+static int64_t s_a2dp_reconfig_t0 = 0;
 
 // Cleanup semaphores for tasks
 static SemaphoreHandle_t s_a2dp_decode_task_exit_sem = NULL;
-static SemaphoreHandle_t s_a2dp_tx_task_exit_sem = NULL;
 static bool s_a2dp_stopping = false;
 
+// A2DP decode cost accounting (per negotiated codec)
+#define A2DP_DECODE_STATS_INTERVAL_S 10
+static uint64_t s_a2dp_decode_time_us = 0;
+static uint64_t s_a2dp_decode_frames = 0;
+
+// A2DP decoder cache: one warm decoder per negotiated (codec, rate, channels), LRU evicted
+#define A2DP_DEC_CACHE_SIZE 2
+typedef struct {
+    codec_ctx_t *ctx;
+    a2dp_codec_type_t codec;
+    int sample_rate;
+    int channels;
+    uint32_t last_used;   // cache sequence number, 0 = slot empty
+    bool in_use;          // checked out by the decode task
+} a2dp_dec_cache_entry_t;
+
+static a2dp_dec_cache_entry_t s_a2dp_dec_cache[A2DP_DEC_CACHE_SIZE];
+static uint32_t s_a2dp_dec_cache_seq = 0;
+static SemaphoreHandle_t s_a2dp_dec_cache_mutex = NULL;
+
+// Statistics (start latency etc.)
+static bt_i2s_stats_t s_stats = {0};
+static int64_t s_a2dp_start_time_us = 0;
+static bool s_a2dp_first_packet_seen = false;
+static bool s_a2dp_first_audio_seen = false;
+
+// A2DP silence detection state (decode task)
+static bool s_a2dp_output_idle = false;     // TX disabled because the stream is silent
+static uint32_t s_a2dp_silent_frames = 0;   // consecutive silent PCM frames
+
+// Power management: CPU/APB frequency locks are held only while the TX output runs
+#ifdef CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t s_pm_cpu_lock = NULL;
+static esp_pm_lock_handle_t s_pm_apb_lock = NULL;
+#endif
+static bool s_pm_active = false;
+static int64_t s_pm_state_since_us = 0;
+
 // I2S configuration
+static a2dp_codec_type_t s_a2dp_codec = A2DP_CODEC_SBC;
 static int A2DP_SAMPLE_RATE = A2DP_STANDARD_SAMPLE_RATE;
 static int A2DP_CH_COUNT = I2S_SLOT_MODE_STEREO;
+static bt_i2s_output_channels_t s_output_channels = BT_I2S_OUTPUT_CHANNELS_DEFAULT;
+static bt_i2s_output_channels_t s_a2dp_output_channels = BT_I2S_OUTPUT_CHANNELS_DEFAULT;  // mode of the running stream
+static int s_a2dp_out_ch = 2;  // channels after downmix: PCM ring, mixer output and I2S slots
 static bool tx_chan_running = false;
 static bool rx_chan_running = false;
 
@@ -162,6 +366,10 @@ static void bt_i2s_tx_channel_enable(void);
 static void bt_i2s_tx_channel_disable(void);
 static void bt_i2s_rx_channel_enable(void);
 static void bt_i2s_rx_channel_disable(void);
+static void bt_i2s_tx_channel_idle(void);
+static void bt_i2s_pm_init(void);
+static void bt_i2s_pm_deinit(void);
+static void bt_i2s_pm_set_active(bool active);
 
 // I2S configuration helpers
 static i2s_std_clk_config_t bt_i2s_get_hfp_clk_cfg(void);
@@ -172,19 +380,37 @@ static void bt_i2s_channels_config_adp(void);
 static void bt_i2s_channels_config_hfp(void);
 
 // Task handlers
-static void bt_i2s_a2dp_tx_task_handler(void *arg);
 static void bt_i2s_a2dp_decode_task_handler(void *arg);
-static void bt_i2s_hfp_tx_task_handler(void *arg);
+static void bt_i2s_a2dp_request_reconfigure(a2dp_codec_type_t codec, int sample_rate, int ch_count);
+static bool bt_i2s_a2dp_apply_reconfigure(RingbufHandle_t *ringbuf);
+static int bt_i2s_a2dp_out_channels(int ch_count);
 static void bt_i2s_hfp_rx_task_handler(void *arg);
+static void bt_i2s_hfp_dec_task_handler(void *arg);
+static void bt_i2s_hfp_conceal_frame(const uint8_t *frame, size_t frame_len);
 
 // Internal data writes
-static void bt_i2s_a2dp_write_tx_ringbuf(const uint8_t *data, uint32_t size);
 static void bt_i2s_hfp_write_rx_ringbuf(unsigned char *data, uint32_t size);
+static void bt_i2s_hfp_fill_uplink_frame(uint8_t *mic_data, size_t len);
+static void bt_i2s_hfp_prepare_uplink_cn(codec_ctx_t *encoder, int16_t *pcm, uint8_t *encoded);
+#if CONFIG_A2DPSINK_HFPHF_SILENCE_IDLE
+static void bt_i2s_a2dp_check_silence(const uint8_t *data, size_t size);
+#endif
+
+// A2DP decoder cache
+static codec_ctx_t *bt_i2s_a2dp_dec_cache_get(a2dp_codec_type_t codec, int sample_rate, int channels, bool checkout);
+static void bt_i2s_a2dp_dec_cache_put(codec_ctx_t *ctx);
+
+// A2DP pipeline (mode mutex held)
+static void bt_i2s_a2dp_start_internal(void);
+static void bt_i2s_a2dp_stop_internal(bool keep_stream_params);
+static void bt_i2s_account_handover(const char *what, int64_t start_us);
 
 // HFP task management
 static void bt_i2s_hfp_task_init(void);
 static void bt_i2s_hfp_task_deinit(void);
 static void bt_i2s_hfp_start_internal(void);
+static size_t bt_i2s_hfp_spk_prefetch_bytes(void);
+static void bt_i2s_hfp_update_mic_prefetch(void);
 
 // volume control
 static inline void apply_volume_scaling(int16_t *samples, size_t num_samples, uint8_t volume);
@@ -240,38 +466,49 @@ void bt_i2s_init() {
         }
     }
     
-    if ((s_i2s_tx_semaphore = xSemaphoreCreateBinary()) == NULL) {
-        ESP_LOGE(BT_I2S_TAG, "%s, s_i2s_write_semaphore Semaphore create failed", __func__);
+    if ((s_i2s_rx_semaphore = xSemaphoreCreateBinary()) == NULL) {
+        ESP_LOGE(BT_I2S_TAG, "%s, s_i2s_read_semaphore Semaphore create failed", __func__);
         return;
     }
     
-    if ((s_i2s_rx_semaphore = xSemaphoreCreateBinary()) == NULL) {
-        ESP_LOGE(BT_I2S_TAG, "%s, s_i2s_read_semaphore Semaphore create failed", __func__);
+    if ((s_i2s_hfp_rx_ringbuf_delete = xSemaphoreCreateBinary()) == NULL) {
+        ESP_LOGE(BT_I2S_TAG, "%s, s_i2s_hfp_rx_ringbuf_delete Semaphore create failed", __func__);
         return;
     }
     
-    if ((s_i2s_hfp_tx_ringbuf_delete = xSemaphoreCreateBinary()) == NULL) {
-        ESP_LOGE(BT_I2S_TAG, "%s, s_i2s_hfp_tx_ringbuf_delete Semaphore create failed", __func__);
+    if (s_hfp_dec_task_exit_sem == NULL && (s_hfp_dec_task_exit_sem = xSemaphoreCreateBinary()) == NULL) {
+        ESP_LOGE(BT_I2S_TAG, "%s, s_hfp_dec_task_exit_sem create failed", __func__);
         return;
     }
     
-    if ((s_i2s_hfp_rx_ringbuf_delete = xSemaphoreCreateBinary()) == NULL) {
-        ESP_LOGE(BT_I2S_TAG, "%s, s_i2s_hfp_rx_ringbuf_delete Semaphore create failed", __func__);
+    if (s_hfp_frame_queue == NULL &&
+        (s_hfp_frame_queue = xRingbufferCreate(HFP_FRAME_QUEUE_SIZE, RINGBUF_TYPE_NOSPLIT)) == NULL) {
+        ESP_LOGE(BT_I2S_TAG, "%s, hfp msbc queue create failed", __func__);
+        return;
+    }
+    
+    if (s_a2dp_dec_cache_mutex == NULL && (s_a2dp_dec_cache_mutex = xSemaphoreCreateMutex()) == NULL) {
+        ESP_LOGE(BT_I2S_TAG, "%s, s_a2dp_dec_cache_mutex create failed", __func__);
         return;
     }
     
     // Create cleanup semaphores
     s_a2dp_decode_task_exit_sem = xSemaphoreCreateBinary();
-    s_a2dp_tx_task_exit_sem = xSemaphoreCreateBinary();
     
     // Initialize to "not given" (binary sems are 1-count initially)
     xSemaphoreTake(s_a2dp_decode_task_exit_sem, 0);
-    xSemaphoreTake(s_a2dp_tx_task_exit_sem, 0);
     
     s_i2s_tx_mode = I2S_TX_MODE_NONE;
     
+    bt_i2s_pm_init();
     bt_i2s_init_tx_chan();
     bt_i2s_init_rx_chan();
+    
+    // The mixer owns every write to the TX channel
+    if (audio_mixer_init(tx_chan) != ESP_OK) {
+        ESP_LOGE(BT_I2S_TAG, "%s, audio mixer init failed", __func__);
+    }
+    audio_mixer_set_output(A2DP_SAMPLE_RATE, 2);
 }
 
 /**
@@ -280,6 +517,8 @@ void bt_i2s_init() {
 void bt_i2s_driver_uninstall(void) {
     ESP_LOGI(BT_I2S_TAG, "%s", __func__);
     
+    audio_mixer_deinit();
+    
     if (tx_chan_running) {
         bt_i2s_tx_channel_disable();
         ESP_ERROR_CHECK(i2s_del_channel(tx_chan));
@@ -291,6 +530,107 @@ void bt_i2s_driver_uninstall(void) {
         ESP_ERROR_CHECK(i2s_del_channel(rx_chan));
         ESP_LOGI(BT_I2S_TAG, "rx_chan pointer: %p", rx_chan);
     }
+    
+    // HFP is stopped by now, so the decode task no longer uses the decoder or the queue
+    codec_destroy(s_hfp_msbc_dec);
+    s_hfp_msbc_dec = NULL;
+    if (s_hfp_frame_queue != NULL) {
+        vRingbufferDelete(s_hfp_frame_queue);
+        s_hfp_frame_queue = NULL;
+    }
+    
+    if (s_a2dp_dec_cache_mutex != NULL) {
+        xSemaphoreTake(s_a2dp_dec_cache_mutex, portMAX_DELAY);
+        for (int i = 0; i < A2DP_DEC_CACHE_SIZE; i++) {
+            codec_destroy(s_a2dp_dec_cache[i].ctx);
+            memset(&s_a2dp_dec_cache[i], 0, sizeof(s_a2dp_dec_cache[i]));
+        }
+        xSemaphoreGive(s_a2dp_dec_cache_mutex);
+    }
+    
+    bt_i2s_pm_deinit();
+}
+
+// ============================================================================
+// INTERNAL: POWER MANAGEMENT
+// ============================================================================
+
+/**
+ * @brief Create the PM locks; the audio pipeline starts out idle (locks released)
+ */
+static void bt_i2s_pm_init(void) {
+    s_pm_active = false;
+    s_pm_state_since_us = esp_timer_get_time();
+#ifdef CONFIG_PM_ENABLE
+    if (s_pm_cpu_lock == NULL &&
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "bt_i2s_cpu", &s_pm_cpu_lock) != ESP_OK) {
+        ESP_LOGE(BT_I2S_TAG, "%s, CPU frequency lock create failed", __func__);
+    }
+    if (s_pm_apb_lock == NULL &&
+        esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "bt_i2s_apb", &s_pm_apb_lock) != ESP_OK) {
+        ESP_LOGE(BT_I2S_TAG, "%s, APB frequency lock create failed", __func__);
+    }
+#endif
+}
+
+/**
+ * @brief Release and delete the PM locks
+ */
+static void bt_i2s_pm_deinit(void) {
+    bt_i2s_pm_set_active(false);
+#ifdef CONFIG_PM_ENABLE
+    if (s_pm_cpu_lock != NULL) {
+        esp_pm_lock_delete(s_pm_cpu_lock);
+        s_pm_cpu_lock = NULL;
+    }
+    if (s_pm_apb_lock != NULL) {
+        esp_pm_lock_delete(s_pm_apb_lock);
+        s_pm_apb_lock = NULL;
+    }
+#endif
+}
+
+/**
+ * @brief Hold (active) or release (idle) the PM locks and account time spent in each state
+ * 
+ * Called with the TX channel state; while released, DFS may lower the clocks and
+ * automatic light sleep may kick in.
+ */
+static void bt_i2s_pm_set_active(bool active) {
+    if (active == s_pm_active) {
+        return;
+    }
+    
+    int64_t now = esp_timer_get_time();
+    if (s_pm_active) {
+        s_stats.pm_active_us += (uint64_t)(now - s_pm_state_since_us);
+    } else {
+        s_stats.pm_idle_us += (uint64_t)(now - s_pm_state_since_us);
+    }
+    s_pm_state_since_us = now;
+    s_pm_active = active;
+    
+    if (active) {
+        s_stats.pm_lock_acquires++;
+#ifdef CONFIG_PM_ENABLE
+        if (s_pm_cpu_lock != NULL) {
+            esp_pm_lock_acquire(s_pm_cpu_lock);
+        }
+        if (s_pm_apb_lock != NULL) {
+            esp_pm_lock_acquire(s_pm_apb_lock);
+        }
+#endif
+    } else {
+#ifdef CONFIG_PM_ENABLE
+        if (s_pm_apb_lock != NULL) {
+            esp_pm_lock_release(s_pm_apb_lock);
+        }
+        if (s_pm_cpu_lock != NULL) {
+            esp_pm_lock_release(s_pm_cpu_lock);
+        }
+#endif
+    }
+    ESP_LOGD(BT_I2S_TAG, "PM locks %s", active ? "acquired" : "released");
 }
 
 // ============================================================================
@@ -301,8 +641,8 @@ void bt_i2s_driver_uninstall(void) {
  * @brief Get HFP clock configuration
  */
 static i2s_std_clk_config_t bt_i2s_get_hfp_clk_cfg(void) {
-    i2s_std_clk_config_t hfp_clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(HFP_SAMPLE_RATE);
-    ESP_LOGI(BT_I2S_TAG, "reconfiguring hfp clock to sample rate: %d", HFP_SAMPLE_RATE);
+    i2s_std_clk_config_t hfp_clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(s_hfp_sample_rate);
+    ESP_LOGI(BT_I2S_TAG, "reconfiguring hfp clock to sample rate: %d", s_hfp_sample_rate);
     return hfp_clk_cfg;
 }
 
@@ -310,7 +650,7 @@ static i2s_std_clk_config_t bt_i2s_get_hfp_clk_cfg(void) {
  * @brief Get HFP TX slot configuration
  */
 static i2s_std_slot_config_t bt_i2s_get_hfp_tx_slot_cfg(void) {
-    i2s_std_slot_config_t hfp_slot_cfg = I2S_STD_MSB_SLOT_DEFAULT_CONFIG(HFP_I2S_DATA_BIT_WIDTH, I2S_SLOT_MODE_MONO);
+    i2s_std_slot_config_t hfp_slot_cfg = BT_I2S_TX_SLOT_DEFAULT_CONFIG(HFP_I2S_DATA_BIT_WIDTH, I2S_SLOT_MODE_MONO);
     hfp_slot_cfg.slot_mask = I2S_STD_SLOT_BOTH;
     ESP_LOGI(BT_I2S_TAG, "reconfiguring hfp tx slot to data bit width: %d", HFP_I2S_DATA_BIT_WIDTH);
     return hfp_slot_cfg;
@@ -329,7 +669,12 @@ static i2s_std_clk_config_t bt_i2s_get_adp_clk_cfg(void) {
  * @brief Get A2DP slot configuration
  */
 static i2s_std_slot_config_t bt_i2s_get_adp_slot_cfg(void) {
-    i2s_std_slot_config_t adp_slot_cfg = I2S_STD_MSB_SLOT_DEFAULT_CONFIG(A2DP_I2S_DATA_BIT_WIDTH, I2S_SLOT_MODE_STEREO);
+    i2s_std_slot_config_t adp_slot_cfg = BT_I2S_TX_SLOT_DEFAULT_CONFIG(A2DP_I2S_DATA_BIT_WIDTH,
+        (s_a2dp_out_ch == 1) ? I2S_SLOT_MODE_MONO : I2S_SLOT_MODE_STEREO);
+    if (s_a2dp_out_ch == 1) {
+        /* Same sample on both slots, so either DAC channel (or a mono amp) gets it */
+        adp_slot_cfg.slot_mask = I2S_STD_SLOT_BOTH;
+    }
     ESP_LOGI(BT_I2S_TAG, "reconfiguring adp slot to data bit width: %d", A2DP_I2S_DATA_BIT_WIDTH);
     return adp_slot_cfg;
 }
@@ -338,14 +683,22 @@ static i2s_std_slot_config_t bt_i2s_get_adp_slot_cfg(void) {
  * @brief Initialize TX I2S channel (for A2DP and HFP output)
  */
 static void bt_i2s_init_tx_chan() {
-    i2s_chan_config_t tx_chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
+    i2s_chan_config_t tx_chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(BT_I2S_TX_PORT, I2S_ROLE_MASTER);
+    tx_chan_cfg.auto_clear = true;  // DMA plays silence whenever the mixer has nothing to write
+#if CONFIG_A2DPSINK_HFPHF_I2S_DUPLEX
+    // Both directions on one controller; bt_i2s_init_rx_chan() sets up the RX half
+    i2s_new_channel(&tx_chan_cfg, &tx_chan, &rx_chan);
+    s_rx_dma_frames = tx_chan_cfg.dma_frame_num;
+#else
     i2s_new_channel(&tx_chan_cfg, &tx_chan, NULL);
+#endif
+    s_tx_dma_frames = tx_chan_cfg.dma_desc_num * tx_chan_cfg.dma_frame_num;
     
     i2s_std_config_t std_tx_cfg = {
         .clk_cfg = bt_i2s_get_adp_clk_cfg(),
         .slot_cfg = bt_i2s_get_adp_slot_cfg(),
         .gpio_cfg = {
-            .mclk = I2S_GPIO_UNUSED,
+            .mclk = BT_I2S_MCLK_GPIO,
             .bclk = i2sTxPinConfig.bck,
             .ws = i2sTxPinConfig.ws,
             .dout = i2sTxPinConfig.dout,
@@ -365,14 +718,59 @@ static void bt_i2s_init_tx_chan() {
  * @brief Initialize RX I2S channel (for HFP microphone input)
  */
 static void bt_i2s_init_rx_chan() {
+    hfp_mic_init();
+    
+#if CONFIG_A2DPSINK_HFPHF_I2S_DUPLEX
+    // Created with the TX channel: same clock (the TX rate, A2DP to start with),
+    // same BCK/WS/MCLK pins, data in on the RX DIN pin
+    i2s_std_config_t duplex_rx_cfg = {
+        .clk_cfg = bt_i2s_get_adp_clk_cfg(),
+        .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(hfp_mic_dma_bit_width(), hfp_mic_slot_mode()),
+        .gpio_cfg = {
+            .mclk = BT_I2S_MCLK_GPIO,
+            .bclk = i2sTxPinConfig.bck,
+            .ws = i2sTxPinConfig.ws,
+            .dout = I2S_GPIO_UNUSED,
+            .din = i2sRxPinConfig.din,
+            .invert_flags = {
+                .mclk_inv = false,
+                .bclk_inv = false,
+                .ws_inv = false,
+            },
+        },
+    };
+    ESP_ERROR_CHECK(i2s_channel_init_std_mode(rx_chan, &duplex_rx_cfg));
+    s_rx_sample_rate = A2DP_SAMPLE_RATE;
+    ESP_LOGI(BT_I2S_TAG, "Duplex I2S: RX shares the TX clock (BCK %d, WS %d, MCLK %d), DIN %d",
+             i2sTxPinConfig.bck, i2sTxPinConfig.ws, BT_I2S_MCLK_GPIO, i2sRxPinConfig.din);
+    return;
+#endif
+    
     /* RX channel will be registered on our second I2S */
-    i2s_chan_config_t rx_chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_1, I2S_ROLE_MASTER);
+    i2s_chan_config_t rx_chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(BT_I2S_RX_PORT, I2S_ROLE_MASTER);
     i2s_new_channel(&rx_chan_cfg, NULL, &rx_chan);
+    s_rx_dma_frames = rx_chan_cfg.dma_frame_num;
+    
+#if CONFIG_A2DPSINK_HFPHF_MIC_PDM
+    // PDM clock on the BCK pin, data on DIN; the peripheral decimates to 16-bit PCM
+    i2s_pdm_rx_config_t pdm_rx_cfg = {
+        .clk_cfg = I2S_PDM_RX_CLK_DEFAULT_CONFIG(HFP_SAMPLE_RATE),
+        .slot_cfg = I2S_PDM_RX_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, hfp_mic_slot_mode()),
+        .gpio_cfg = {
+            .clk = i2sRxPinConfig.bck,
+            .din = i2sRxPinConfig.din,
+            .invert_flags = {
+                .clk_inv = false,
+            },
+        },
+    };
     
-    // PHILIPS mode with MONO and 32-bit
+    ESP_ERROR_CHECK(i2s_channel_init_pdm_rx_mode(rx_chan, &pdm_rx_cfg));
+#else
+    // PHILIPS mode, mono (stereo for a microphone pair); 16-bit, or 32-bit slots for 24 and 32-bit microphones
     i2s_std_config_t std_rx_cfg = {
         .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(HFP_SAMPLE_RATE),
-        .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_32BIT, I2S_SLOT_MODE_MONO),
+        .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(hfp_mic_dma_bit_width(), hfp_mic_slot_mode()),
         .gpio_cfg = {
             .mclk = I2S_GPIO_UNUSED,
             .bclk = i2sRxPinConfig.bck,
@@ -388,6 +786,7 @@ static void bt_i2s_init_rx_chan() {
     };
     
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(rx_chan, &std_rx_cfg));
+#endif
 }
 
 /**
@@ -397,9 +796,14 @@ static void bt_i2s_tx_channel_enable(void) {
     ESP_LOGI(BT_I2S_TAG, "%s", __func__);
     if (!tx_chan_running) {
         ESP_LOGI(BT_I2S_TAG, " -- not running; enabling now");
+        bt_i2s_pm_set_active(true);
         ESP_ERROR_CHECK(i2s_channel_enable(tx_chan));
+        tx_chan_running = true;
+        audio_mixer_resume();
+        if (s_output_state_cb) {
+            s_output_state_cb(true);
+        }
     }
-    tx_chan_running = true;
 }
 
 /**
@@ -409,11 +813,53 @@ static void bt_i2s_tx_channel_disable(void) {
     ESP_LOGI(BT_I2S_TAG, "%s", __func__);
     if (tx_chan_running) {
         ESP_LOGI(BT_I2S_TAG, " -- bt_i2s_tx_channel running; disabling now");
+        // Mute the amplifier while the clocks are still running
+        if (s_output_state_cb) {
+            s_output_state_cb(false);
+        }
+        audio_mixer_suspend();
         ESP_ERROR_CHECK(i2s_channel_disable(tx_chan));
+        bt_i2s_pm_set_active(false);
     }
     tx_chan_running = false;
 }
 
+/**
+ * @brief Disable TX I2S channel at the end of a stream, unless an output user still needs it
+ */
+static void bt_i2s_tx_channel_idle(void) {
+    if (s_output_refs > 0) {
+        ESP_LOGI(BT_I2S_TAG, "%s - TX kept running for %d output user(s)", __func__, s_output_refs);
+        return;
+    }
+    bt_i2s_tx_channel_disable();
+}
+
+/**
+ * @brief Stop the TX DMA for a clock or slot change; returns whether TX was running
+ *
+ * Unlike bt_i2s_tx_channel_disable() this is not an output stop: only the mixer
+ * is held, the amplifier stays unmuted and the PM locks stay held.
+ */
+static bool bt_i2s_tx_reclock_begin(void) {
+    if (!tx_chan_running) {
+        return false;
+    }
+    audio_mixer_suspend();
+    ESP_ERROR_CHECK(i2s_channel_disable(tx_chan));
+    return true;
+}
+
+/**
+ * @brief Restart the TX DMA after bt_i2s_tx_reclock_begin()
+ */
+static void bt_i2s_tx_reclock_end(bool was_running) {
+    if (was_running) {
+        ESP_ERROR_CHECK(i2s_channel_enable(tx_chan));
+        audio_mixer_resume();
+    }
+}
+
 /**
  * @brief Enable RX I2S channel
  */
@@ -442,34 +888,56 @@ static void bt_i2s_rx_channel_disable(void) {
  * @brief Reconfigure I2S channels for A2DP mode (44.1kHz stereo)
  */
 static void bt_i2s_channels_config_adp(void) {
-    bool _isrunning = tx_chan_running;
     i2s_std_clk_config_t clk_cfg = bt_i2s_get_adp_clk_cfg();
     i2s_std_slot_config_t slot_cfg = bt_i2s_get_adp_slot_cfg();
     
-    bt_i2s_tx_channel_disable();
+    bool tx_was_running = bt_i2s_tx_reclock_begin();
     ESP_ERROR_CHECK(i2s_channel_reconfig_std_clock(tx_chan, &clk_cfg));
     ESP_ERROR_CHECK(i2s_channel_reconfig_std_slot(tx_chan, &slot_cfg));
+    audio_mixer_set_output(A2DP_SAMPLE_RATE, s_a2dp_out_ch);
     
-    if (_isrunning) {
-        bt_i2s_tx_channel_enable();
-    }
+#if CONFIG_A2DPSINK_HFPHF_I2S_DUPLEX
+    // One controller, one clock: the RX half follows every rate change
+    bt_i2s_rx_channel_disable();
+    ESP_ERROR_CHECK(i2s_channel_reconfig_std_clock(rx_chan, &clk_cfg));
+    s_rx_sample_rate = A2DP_SAMPLE_RATE;
+#endif
+    
+    bt_i2s_tx_reclock_end(tx_was_running);
 }
 
 /**
- * @brief Reconfigure I2S channels for HFP mode (16kHz mono)
+ * @brief Reconfigure I2S channels for HFP mode (16kHz mSBC or 8kHz CVSD, mono)
  */
 static void bt_i2s_channels_config_hfp(void) {
-    bool _tx_is_running = tx_chan_running;
     i2s_std_clk_config_t clk_cfg = bt_i2s_get_hfp_clk_cfg();
     i2s_std_slot_config_t slot_cfg = bt_i2s_get_hfp_tx_slot_cfg();
     
-    bt_i2s_tx_channel_disable();
+    bool tx_was_running = bt_i2s_tx_reclock_begin();
     ESP_ERROR_CHECK(i2s_channel_reconfig_std_clock(tx_chan, &clk_cfg));
     ESP_ERROR_CHECK(i2s_channel_reconfig_std_slot(tx_chan, &slot_cfg));
+    audio_mixer_set_output(s_hfp_sample_rate, 1);
     
-    if (_tx_is_running) {
-        bt_i2s_tx_channel_enable();
+    // The microphone runs at the call rate too, so neither direction is resampled
+#if CONFIG_A2DPSINK_HFPHF_I2S_DUPLEX
+    // (with a shared clock it has to, and is reconfigured along with TX every time)
+    bt_i2s_rx_channel_disable();
+    ESP_ERROR_CHECK(i2s_channel_reconfig_std_clock(rx_chan, &clk_cfg));
+    s_rx_sample_rate = s_hfp_sample_rate;
+#else
+    if (s_rx_sample_rate != s_hfp_sample_rate) {
+        bt_i2s_rx_channel_disable();
+#if CONFIG_A2DPSINK_HFPHF_MIC_PDM
+        i2s_pdm_rx_clk_config_t pdm_clk_cfg = I2S_PDM_RX_CLK_DEFAULT_CONFIG(s_hfp_sample_rate);
+        ESP_ERROR_CHECK(i2s_channel_reconfig_pdm_rx_clock(rx_chan, &pdm_clk_cfg));
+#else
+        ESP_ERROR_CHECK(i2s_channel_reconfig_std_clock(rx_chan, &clk_cfg));
+#endif
+        s_rx_sample_rate = s_hfp_sample_rate;
     }
+#endif
+    
+    bt_i2s_tx_reclock_end(tx_was_running);
 }
 
 // ============================================================================
@@ -488,6 +956,14 @@ void bt_i2s_a2dp_start(void) {
         return;
     }
     
+    if (s_i2s_tx_mode == I2S_TX_MODE_HFP) {
+        // Music started during a call: play it once the call has ended
+        s_a2dp_preempted = true;
+        xSemaphoreGive(s_i2s_mode_mutex);
+        ESP_LOGI(BT_I2S_TAG, "Call active, A2DP deferred until it ends");
+        return;
+    }
+    
     // Wait until I2S is idle
     if (xSemaphoreTake(s_i2s_mode_idle_sem, pdMS_TO_TICKS(I2S_MODE_SWITCH_TIMEOUT_MS)) != pdTRUE) {
         ESP_LOGE(BT_I2S_TAG, "Failed to wait for idle state for A2DP");
@@ -495,35 +971,59 @@ void bt_i2s_a2dp_start(void) {
         return;
     }
     
-    /* Create params and packets ready semaphores */
-    if (s_a2dp_params_ready_sem == NULL) {
-        s_a2dp_params_ready_sem = xSemaphoreCreateBinary();
-    }
+    bt_i2s_a2dp_start_internal();
     
+    // Release mutex
+    xSemaphoreGive(s_i2s_mode_mutex);
+    ESP_LOGI(BT_I2S_TAG, "A2DP mode started");
+}
+
+/**
+ * @brief Build the A2DP pipeline: decode task, mixer source (fading in) and I2S
+ *
+ * Called with the mode mutex and the idle token held.
+ */
+static void bt_i2s_a2dp_start_internal(void) {
+    /* Create packet ready semaphore */
     if (s_a2dp_sbc_packet_ready_sem == NULL) {
         s_a2dp_sbc_packet_ready_sem = xSemaphoreCreateBinary();
     }
     
+    s_a2dp_start_time_us = esp_timer_get_time();
+    s_a2dp_first_packet_seen = false;
+    s_a2dp_first_audio_seen = false;
+    s_a2dp_output_idle = false;
+    s_a2dp_silent_frames = 0;
+    s_stats.a2dp_starts++;
+    
     /* CRITICAL: Reset exit semaphores to "not given" state */
     xSemaphoreTake(s_a2dp_decode_task_exit_sem, 0);
-    xSemaphoreTake(s_a2dp_tx_task_exit_sem, 0);
     
-    /* Start decode task handler */
-    s_a2dp_sbc_encoded_ringbuf = xRingbufferCreate(8192, RINGBUF_TYPE_BYTEBUF);
+    /* Start decode task handler: SBC is a byte stream, AAC keeps packet boundaries */
+    s_a2dp_sbc_encoded_ringbuf = xRingbufferCreate(8192, s_a2dp_codec == A2DP_CODEC_AAC ?
+                                                   RINGBUF_TYPE_NOSPLIT : RINGBUF_TYPE_BYTEBUF);
     s_bt_i2s_a2dp_decode_task_running = true;
     xTaskCreate(bt_i2s_a2dp_decode_task_handler, "BtI2SA2DPDec", 8192, NULL, configMAX_PRIORITIES - 3, &s_bt_i2s_a2dp_decode_task_hdl);
-    ESP_LOGI(BT_I2S_TAG, "✓ A2DP SBC decoder started");
-    
-    /* start tx task handler */
-    s_i2s_a2dp_tx_ringbuffer_mode = RINGBUFFER_MODE_PREFETCHING;
-    if ((s_i2s_a2dp_tx_ringbuf = xRingbufferCreate(RINGBUF_HIGHEST_WATER_LEVEL, RINGBUF_TYPE_BYTEBUF)) == NULL) {
-        ESP_LOGE(BT_I2S_TAG, "%s, ringbuffer create failed", __func__);
-        return;
+    ESP_LOGI(BT_I2S_TAG, "✓ A2DP %s decoder started", s_a2dp_codec == A2DP_CODEC_AAC ? "AAC" : "SBC");
+    
+    /* decoded PCM goes to the mixer; in a mono output mode it is downmixed first,
+       which halves the ring (same duration) and the DMA traffic */
+    s_a2dp_output_channels = s_output_channels;
+    s_a2dp_out_ch = bt_i2s_a2dp_out_channels(A2DP_CH_COUNT);
+    audio_mixer_source_cfg_t src_cfg = {
+        .name = "a2dp",
+        .sample_rate = A2DP_SAMPLE_RATE,
+        .channels = s_a2dp_out_ch,
+        .buffer_bytes = RINGBUF_HIGHEST_WATER_LEVEL * s_a2dp_out_ch / 2,
+        .prefetch_bytes = RINGBUF_PREFETCH_WATER_LEVEL * s_a2dp_out_ch / 2,
+        .duck_others = false,
+    };
+    if ((s_a2dp_source = audio_mixer_source_create(&src_cfg)) == NULL) {
+        ESP_LOGE(BT_I2S_TAG, "%s, mixer source create failed", __func__);
     }
-    
-    s_bt_i2s_a2dp_tx_task_running = true;
-    xTaskCreate(bt_i2s_a2dp_tx_task_handler, "BtI2Sa2dpTask", 6144, NULL, configMAX_PRIORITIES - 4, &s_bt_i2s_a2dp_tx_task_handle);
-    ESP_LOGI(BT_I2S_TAG, "✓ A2DP tx handler started");
+    audio_mixer_source_set_gain(s_a2dp_source, s_volume_table[s_a2dp_volume]);
+    audio_mixer_source_fade_in(s_a2dp_source, HANDOVER_FADE_MS);
+    ESP_LOGI(BT_I2S_TAG, "✓ A2DP mixer source created");
     
     // Configure I2S for A2DP
     bt_i2s_channels_config_adp();
@@ -532,9 +1032,6 @@ void bt_i2s_a2dp_start(void) {
     // Set mode FIRST
     s_i2s_tx_mode = I2S_TX_MODE_A2DP;
     
-    // Release mutex
-    xSemaphoreGive(s_i2s_mode_mutex);
-    ESP_LOGI(BT_I2S_TAG, "A2DP mode started");
 }
 
 /**
@@ -551,41 +1048,46 @@ void bt_i2s_a2dp_stop(void) {
     
     // ✅ Check if already stopped - prevents double-stop
     if (s_i2s_tx_mode != I2S_TX_MODE_A2DP) {
-        ESP_LOGW(BT_I2S_TAG, "A2DP mode not active, skipping stop");
+        if (s_a2dp_preempted) {
+            // The source suspended the stream a call had taken over: nothing to resume
+            s_a2dp_preempted = false;
+            ESP_LOGI(BT_I2S_TAG, "A2DP suspended during the call, not resuming it");
+        } else {
+            ESP_LOGW(BT_I2S_TAG, "A2DP mode not active, skipping stop");
+        }
         xSemaphoreGive(s_i2s_mode_mutex);
         return;
     }
     
-    // This tells TX task to stop and prevents new data
-    s_i2s_tx_mode = I2S_TX_MODE_NONE;
+    bt_i2s_a2dp_stop_internal(false);
     
-    // Give it the semaphore to unblock
-    if (s_i2s_tx_semaphore != NULL) {
-        xSemaphoreGive(s_i2s_tx_semaphore);
-    }
+    // Signal idle state
+    xSemaphoreGive(s_i2s_mode_idle_sem);
+    xSemaphoreGive(s_i2s_mode_mutex);
     
-    // Signal both tasks to exit
-    s_bt_i2s_a2dp_decode_task_running = false;
-    s_bt_i2s_a2dp_tx_task_running = false;
+    ESP_LOGI(BT_I2S_TAG, "A2DP mode stopped");
+}
+
+/**
+ * @brief Tear down the A2DP pipeline (mode mutex held); the idle token is left to the caller
+ */
+static void bt_i2s_a2dp_stop_internal(bool keep_stream_params) {
+    // This prevents new data
+    s_i2s_tx_mode = I2S_TX_MODE_NONE;
     
-    // Wake both tasks from any blocking calls
-    if (s_a2dp_params_ready_sem) {
-        xSemaphoreGive(s_a2dp_params_ready_sem);
-    }
+    // Signal the decode task to exit
+    s_bt_i2s_a2dp_decode_task_running = false;
     
+    // Wake it from any blocking calls
     if (s_a2dp_sbc_packet_ready_sem) {
         xSemaphoreGive(s_a2dp_sbc_packet_ready_sem);
     }
     
-    // Wait for both tasks to exit
+    // Wait for the decode task to exit
     if (xSemaphoreTake(s_a2dp_decode_task_exit_sem, pdMS_TO_TICKS(1000)) != pdTRUE) {
         ESP_LOGE(BT_I2S_TAG, "Failed to acquire a2dp decode task exit semaphore");
     }
     
-    if (xSemaphoreTake(s_a2dp_tx_task_exit_sem, pdMS_TO_TICKS(1000)) != pdTRUE) {
-        ESP_LOGE(BT_I2S_TAG, "Failed to acquire a2dp tx task exit semaphore");
-    }
-    
     /* stop our decoding task, and delete its buffer */
     if (s_bt_i2s_a2dp_decode_task_hdl) {
         s_bt_i2s_a2dp_decode_task_hdl = NULL;
@@ -595,48 +1097,167 @@ void bt_i2s_a2dp_stop(void) {
         vRingbufferDelete(s_a2dp_sbc_encoded_ringbuf);
         s_a2dp_sbc_encoded_ringbuf = NULL;
     }
-    
-    /* stop our tx task, and delete its buffer */
-    if (s_bt_i2s_a2dp_tx_task_handle) {
-        s_bt_i2s_a2dp_tx_task_handle = NULL;
+    if (s_a2dp_reconfig_old_ringbuf) {
+        vRingbufferDelete(s_a2dp_reconfig_old_ringbuf);
+        s_a2dp_reconfig_old_ringbuf = NULL;
     }
     
-    if (s_i2s_a2dp_tx_ringbuf) {
-        vRingbufferDelete(s_i2s_a2dp_tx_ringbuf);
-        s_i2s_a2dp_tx_ringbuf = NULL;
+    /* A reconfiguration the decode task did not get to applies to the next start */
+    if (s_a2dp_reconfig_pending) {
+        s_a2dp_codec = s_a2dp_reconfig_codec;
+        A2DP_SAMPLE_RATE = s_a2dp_reconfig_sample_rate;
+        A2DP_CH_COUNT = s_a2dp_reconfig_ch_count;
+        s_a2dp_reconfig_pending = false;
     }
     
-    bt_i2s_tx_channel_disable();
+    /* remove our mixer source, discarding whatever is still buffered */
+    audio_mixer_source_destroy(s_a2dp_source);
+    s_a2dp_source = NULL;
     
-    /* Delete semaphores */
-    if (s_a2dp_params_ready_sem != NULL) {
-        vSemaphoreDelete(s_a2dp_params_ready_sem);
-        s_a2dp_params_ready_sem = NULL;
-    }
+    bt_i2s_tx_channel_idle();
+    s_a2dp_output_idle = false;
     
+    /* Delete semaphores */
     if (s_a2dp_sbc_packet_ready_sem != NULL) {
         vSemaphoreDelete(s_a2dp_sbc_packet_ready_sem);
         s_a2dp_sbc_packet_ready_sem = NULL;
     }
     
-    /* Reset packet params for next A2DP session */
-    s_a2dp_sbc_packet_size = 0;
+    /* Reset packet params for next A2DP session; a stream taken over by a call
+       keeps them, the source doesn't send them again when it is resumed */
+    if (!keep_stream_params) {
+        s_a2dp_sbc_packet_size = 0;
+        s_a2dp_sbc_frames_per_packet = 0;
+    }
+    
+}
+
+/**
+ * @brief Ask the decode task to switch the running A2DP pipeline to a new stream configuration
+ * 
+ * Called with the mode mutex held, from the same (BTC) task that feeds the encoded
+ * ringbuffer, and returns at once: the waiting for the decoder to park and the old
+ * PCM to play out happens on the decode task (bt_i2s_a2dp_apply_reconfigure()).
+ * Encoded data of the old configuration is dropped; what arrives from now on is
+ * queued in a new ringbuffer for the new one. The old ringbuffer is left for the
+ * decode task to delete.
+ */
+static void bt_i2s_a2dp_request_reconfigure(a2dp_codec_type_t codec, int sample_rate, int ch_count) {
+    /* A fresh ringbuffer rather than a flush: the decode task may be receiving from
+     * the old one. SBC is a byte stream, AAC keeps packet boundaries. */
+    RingbufHandle_t ringbuf = xRingbufferCreate(8192, codec == A2DP_CODEC_AAC ?
+                                                RINGBUF_TYPE_NOSPLIT : RINGBUF_TYPE_BYTEBUF);
+    if (ringbuf == NULL) {
+        ESP_LOGE(BT_I2S_TAG, "%s, ringbuffer create failed, keeping the old configuration", __func__);
+        return;
+    }
+    if (s_a2dp_reconfig_old_ringbuf == NULL) {
+        s_a2dp_reconfig_old_ringbuf = s_a2dp_sbc_encoded_ringbuf;
+    } else {
+        /* Replaced again before the decode task switched: it never saw this one */
+        vRingbufferDelete(s_a2dp_sbc_encoded_ringbuf);
+    }
+    s_a2dp_sbc_encoded_ringbuf = ringbuf;
+    
+    s_a2dp_reconfig_codec = codec;
+    s_a2dp_reconfig_sample_rate = sample_rate;
+    s_a2dp_reconfig_ch_count = ch_count;
+    s_a2dp_sbc_packet_size = 0;  /* re-detected from the next media packet */
     s_a2dp_sbc_frames_per_packet = 0;
+    if (!s_a2dp_reconfig_pending) {
+        s_a2dp_reconfig_t0 = esp_timer_get_time();
+        s_a2dp_reconfig_pending = true;
+    }
+    xSemaphoreGive(s_a2dp_sbc_packet_ready_sem);
+}
+
+/**
+ * @brief Carry out a requested reconfiguration (decode task, decoder already handed back)
+ * 
+ * The PCM already decoded plays out at the old rate, then the ringbuffer, I2S clock
+ * and mixer source are switched under the mode mutex and the source re-prefetches.
+ * The mixer, the TX channel and the decode task itself stay up.
+ * 
+ * @param ringbuf The decode task's encoded ringbuffer, updated to the new one
+ * @return false if the pipeline is being torn down instead
+ */
+static bool bt_i2s_a2dp_apply_reconfigure(RingbufHandle_t *ringbuf) {
+    /* Drain: let the PCM already queued play out at the old rate */
+    if (tx_chan_running && !s_a2dp_output_idle) {
+        audio_mixer_source_drain(s_a2dp_source, pdMS_TO_TICKS(A2DP_RECONFIG_DRAIN_MS));
+    }
     
-    // Signal idle state
-    xSemaphoreGive(s_i2s_mode_idle_sem);
+    /* A stop holds the mode mutex while it waits for this task to exit */
+    while (xSemaphoreTake(s_i2s_mode_mutex, pdMS_TO_TICKS(10)) != pdTRUE) {
+        if (!s_bt_i2s_a2dp_decode_task_running) {
+            return false;
+        }
+    }
+    if (!s_bt_i2s_a2dp_decode_task_running) {
+        xSemaphoreGive(s_i2s_mode_mutex);
+        return false;
+    }
+    
+    if (s_a2dp_reconfig_old_ringbuf != NULL) {
+        vRingbufferDelete(s_a2dp_reconfig_old_ringbuf);
+        s_a2dp_reconfig_old_ringbuf = NULL;
+    }
+    *ringbuf = s_a2dp_sbc_encoded_ringbuf;
+    
+    s_a2dp_codec = s_a2dp_reconfig_codec;
+    A2DP_SAMPLE_RATE = s_a2dp_reconfig_sample_rate;
+    A2DP_CH_COUNT = s_a2dp_reconfig_ch_count;
+    s_a2dp_silent_frames = 0;
+    
+    /* New source format (flushes, so the source prefetches again) and I2S clock */
+    s_a2dp_out_ch = bt_i2s_a2dp_out_channels(A2DP_CH_COUNT);
+    audio_mixer_source_set_format(s_a2dp_source, A2DP_SAMPLE_RATE, s_a2dp_out_ch);
+    bt_i2s_channels_config_adp();
+    
+    s_stats.a2dp_reconfigs++;
+    s_stats.a2dp_reconfig_us = (uint32_t)(esp_timer_get_time() - s_a2dp_reconfig_t0);
+    s_a2dp_reconfig_pending = false;
     xSemaphoreGive(s_i2s_mode_mutex);
     
-    ESP_LOGI(BT_I2S_TAG, "A2DP mode stopped");
+    ESP_LOGI(BT_I2S_TAG, "A2DP reconfigured in place (%s, %d Hz, %d ch) in %" PRIu32 " us",
+             s_a2dp_codec == A2DP_CODEC_AAC ? "AAC" : "SBC", A2DP_SAMPLE_RATE, A2DP_CH_COUNT,
+             s_stats.a2dp_reconfig_us);
+    return true;
 }
 
 /**
  * @brief Set A2DP audio configuration (sample rate and channel count)
  */
-void bt_i2s_a2dp_set_audio_config(int sample_rate, int ch_count) {
-    A2DP_SAMPLE_RATE = sample_rate;
-    A2DP_CH_COUNT = ch_count;
-    ESP_LOGI(BT_I2S_TAG, "A2DP audio config set: sample_rate=%d, ch_count=%d", sample_rate, ch_count);
+void bt_i2s_a2dp_set_audio_config(a2dp_codec_type_t codec, int sample_rate, int ch_count) {
+    ESP_LOGI(BT_I2S_TAG, "A2DP audio config set: codec=%s, sample_rate=%d, ch_count=%d",
+             codec == A2DP_CODEC_AAC ? "AAC" : "SBC", sample_rate, ch_count);
+    
+    if (xSemaphoreTake(s_i2s_mode_mutex, pdMS_TO_TICKS(I2S_MODE_SWITCH_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(BT_I2S_TAG, "Failed to acquire mode mutex for A2DP config");
+        return;
+    }
+    
+    if (s_i2s_tx_mode == I2S_TX_MODE_A2DP) {
+        /* Renegotiated while streaming: have the decode task switch the pipeline over */
+        bool queued = s_a2dp_reconfig_pending;
+        if (codec != (queued ? s_a2dp_reconfig_codec : s_a2dp_codec) ||
+            sample_rate != (queued ? s_a2dp_reconfig_sample_rate : A2DP_SAMPLE_RATE) ||
+            ch_count != (queued ? s_a2dp_reconfig_ch_count : A2DP_CH_COUNT)) {
+            bt_i2s_a2dp_request_reconfigure(codec, sample_rate, ch_count);
+        }
+    } else {
+        s_a2dp_codec = codec;
+        A2DP_SAMPLE_RATE = sample_rate;
+        A2DP_CH_COUNT = ch_count;
+    }
+    
+    xSemaphoreGive(s_i2s_mode_mutex);
+    
+    /* Open the decoder now, so the first media packet doesn't pay for it */
+    int64_t t0 = esp_timer_get_time();
+    if (bt_i2s_a2dp_dec_cache_get(codec, sample_rate, (ch_count == 1) ? 1 : 2, false) != NULL) {
+        ESP_LOGI(BT_I2S_TAG, "A2DP decoder pre-opened in %" PRId64 " us", esp_timer_get_time() - t0);
+    }
 }
 
 /**
@@ -646,25 +1267,28 @@ void bt_i2s_a2dp_set_packet_params(uint16_t packet_size, uint8_t frames_per_pack
     s_a2dp_sbc_packet_size = packet_size;
     s_a2dp_sbc_frames_per_packet = frames_per_packet;
     ESP_LOGI(BT_I2S_TAG, "A2DP packet params set: size=%d, frames=%d", packet_size, frames_per_packet);
-    
-    /* Signal that params are ready - decoder can now allocate buffer */
-    if (s_a2dp_params_ready_sem != NULL) {
-        xSemaphoreGive(s_a2dp_params_ready_sem);
-    }
 }
 
 /**
- * @brief Write raw SBC encoded data to A2DP decode ringbuffer
+ * @brief Write encoded A2DP media data to the decode ringbuffer
  */
-void bt_i2s_a2dp_write_sbc_encoded_ringbuf(const uint8_t *data, uint32_t len) {
+void bt_i2s_a2dp_write_encoded_ringbuf(const uint8_t *data, uint32_t len) {
     if (data == NULL || len == 0 || s_a2dp_sbc_encoded_ringbuf == NULL) {
         return;
     }
     
-    /* FAST: Just copy raw SBC frame - BTC callback exits immediately */
+    if (!s_a2dp_first_packet_seen) {
+        s_a2dp_first_packet_seen = true;
+        s_stats.a2dp_first_packet_us = (uint32_t)(esp_timer_get_time() - s_a2dp_start_time_us);
+    }
+    
+    /* FAST: Just copy raw packet - BTC callback exits immediately */
     xRingbufferSend(s_a2dp_sbc_encoded_ringbuf, (void *)data, len, 0);
     
-    if (s_a2dp_sbc_packet_size > 0 && len == s_a2dp_sbc_packet_size) {
+    /* AAC packets vary in size (VBR), every packet is a complete LATM element */
+    a2dp_codec_type_t codec = s_a2dp_reconfig_pending ? s_a2dp_reconfig_codec : s_a2dp_codec;
+    if (codec == A2DP_CODEC_AAC ||
+        (s_a2dp_sbc_packet_size > 0 && len == s_a2dp_sbc_packet_size)) {
         xSemaphoreGive(s_a2dp_sbc_packet_ready_sem);
     }
 }
@@ -674,49 +1298,332 @@ void bt_i2s_a2dp_write_sbc_encoded_ringbuf(const uint8_t *data, uint32_t len) {
 // ============================================================================
 
 /**
- * @brief A2DP SBC decoding task - decodes SBC frames and feeds decoded PCM to tx_ringbuffer
+ * @brief Account decode time and periodically log the decoder's CPU cost
  */
-static void bt_i2s_a2dp_decode_task_handler(void *arg) {
-    ESP_LOGI(BT_I2S_TAG, "A2DP SBC decode task started - waiting for params...");
+static void bt_i2s_a2dp_account_decode(int64_t elapsed_us, size_t decoded_len) {
+    int channels = (A2DP_CH_COUNT == 1) ? 1 : 2;
+    s_a2dp_decode_time_us += elapsed_us;
+    s_a2dp_decode_frames += decoded_len / (2 * channels);
+    
+    if (s_a2dp_decode_frames >= (uint64_t)A2DP_SAMPLE_RATE * A2DP_DECODE_STATS_INTERVAL_S) {
+        uint64_t audio_us = s_a2dp_decode_frames * 1000000ULL / A2DP_SAMPLE_RATE;
+        uint32_t permille = (uint32_t)(s_a2dp_decode_time_us * 1000ULL / audio_us);
+        ESP_LOGI(BT_I2S_TAG, "A2DP %s decode cost: %" PRIu32 " us per second of audio (%" PRIu32 ".%" PRIu32 "%% CPU)",
+                 s_a2dp_codec == A2DP_CODEC_AAC ? "AAC" : "SBC",
+                 (uint32_t)(s_a2dp_decode_time_us * 1000000ULL / audio_us),
+                 permille / 10, permille % 10);
+        s_a2dp_decode_time_us = 0;
+        s_a2dp_decode_frames = 0;
+    }
+}
+
+/**
+ * @brief Look up (or create) the cached decoder for a negotiated configuration
+ * 
+ * A miss evicts the least recently used entry that is not checked out.
+ * 
+ * @param checkout true to hand the decoder to the decode task (marks it in use)
+ * @return Decoder context, or NULL if it could not be created
+ */
+static codec_ctx_t *bt_i2s_a2dp_dec_cache_get(a2dp_codec_type_t codec, int sample_rate, int channels, bool checkout) {
+    if (s_a2dp_dec_cache_mutex == NULL) {
+        return NULL;
+    }
     
-    /* Wait for packet params to be set by first audio callback */
-    if (s_a2dp_params_ready_sem == NULL) {
-        ESP_LOGE(BT_I2S_TAG, "Params semaphore not created!");
-        vTaskDelete(NULL);
-        return;
+    xSemaphoreTake(s_a2dp_dec_cache_mutex, portMAX_DELAY);
+    
+    a2dp_dec_cache_entry_t *entry = NULL;
+    a2dp_dec_cache_entry_t *victim = NULL;
+    for (int i = 0; i < A2DP_DEC_CACHE_SIZE; i++) {
+        a2dp_dec_cache_entry_t *e = &s_a2dp_dec_cache[i];
+        if (e->ctx != NULL && e->codec == codec && e->sample_rate == sample_rate && e->channels == channels) {
+            entry = e;
+            break;
+        }
+        if (!e->in_use && (victim == NULL || e->last_used < victim->last_used)) {
+            victim = e;
+        }
     }
     
-    if (xSemaphoreTake(s_a2dp_params_ready_sem, portMAX_DELAY) != pdTRUE) {
-        ESP_LOGE(BT_I2S_TAG, "Failed to wait for params");
-        vTaskDelete(NULL);
-        return;
+    if (entry != NULL) {
+        if (checkout) {
+            s_stats.a2dp_decoder_cache_hits++;
+        }
+    } else if (victim != NULL) {
+        codec_destroy(victim->ctx);
+        memset(victim, 0, sizeof(*victim));
+        
+        codec_cfg_t cfg = {
+            .sample_rate = sample_rate,
+            .channels = channels,
+        };
+        victim->ctx = (codec == A2DP_CODEC_AAC) ? aac_dec_create(&cfg) : sbc_dec_create(&cfg);
+        if (victim->ctx != NULL) {
+            victim->codec = codec;
+            victim->sample_rate = sample_rate;
+            victim->channels = channels;
+            entry = victim;
+            if (checkout) {
+                s_stats.a2dp_decoder_cache_misses++;
+            }
+        }
     }
     
-    uint8_t *sbc_buffer = (uint8_t *)malloc(s_a2dp_sbc_packet_size);
-    if (sbc_buffer == NULL) {
-        ESP_LOGE(BT_I2S_TAG, "Failed to allocate SBC buffer");
-        vTaskDelete(NULL);
-        return;
+    codec_ctx_t *ctx = NULL;
+    if (entry != NULL && !(checkout && entry->in_use)) {
+        entry->last_used = ++s_a2dp_dec_cache_seq;
+        entry->in_use |= checkout;
+        ctx = entry->ctx;
     }
     
-    size_t sbc_buffer_fill = 0;
-    uint8_t *sbc_data = NULL;
-    size_t sbc_data_len = 0;
-    bool decoder_opened = false;
+    xSemaphoreGive(s_a2dp_dec_cache_mutex);
+    return ctx;
+}
+
+/**
+ * @brief Return a checked-out decoder to the cache, reset for the next session
+ */
+static void bt_i2s_a2dp_dec_cache_put(codec_ctx_t *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
     
-    ESP_LOGI(BT_I2S_TAG, "A2DP SBC decode task ready (packet_size=%d)", s_a2dp_sbc_packet_size);
+    xSemaphoreTake(s_a2dp_dec_cache_mutex, portMAX_DELAY);
+    for (int i = 0; i < A2DP_DEC_CACHE_SIZE; i++) {
+        a2dp_dec_cache_entry_t *e = &s_a2dp_dec_cache[i];
+        if (e->ctx == ctx) {
+            /* Reset now, on the stop path, rather than on the next start */
+            if (codec_reset(ctx) != 0) {
+                codec_destroy(ctx);
+                memset(e, 0, sizeof(*e));
+            } else {
+                e->in_use = false;
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(s_a2dp_dec_cache_mutex);
+}
+
+#if CONFIG_A2DPSINK_HFPHF_SILENCE_IDLE
+/**
+ * @brief Track digital silence; idle the TX channel after the hold time, wake it on audio
+ * 
+ * Runs in the decode task. The mode mutex is only tried briefly, so a concurrent
+ * a2dp_stop (which holds it while waiting for this task) is never blocked.
+ */
+static void bt_i2s_a2dp_check_silence(const uint8_t *data, size_t size) {
+    const int16_t *samples = (const int16_t *)data;
+    const size_t count = size / sizeof(int16_t);
+    bool silent = true;
+    
+    for (size_t i = 0; i < count; i++) {
+        if (samples[i] > CONFIG_A2DPSINK_HFPHF_SILENCE_THRESHOLD ||
+            samples[i] < -CONFIG_A2DPSINK_HFPHF_SILENCE_THRESHOLD) {
+            silent = false;
+            break;
+        }
+    }
     
-    while (s_bt_i2s_a2dp_decode_task_running) {
-        if (xSemaphoreTake(s_a2dp_sbc_packet_ready_sem, portMAX_DELAY) != pdTRUE) {
-            continue;
+    if (silent) {
+        if (s_a2dp_output_idle) {
+            return;
         }
-        
-        sbc_buffer_fill = 0;
-        while (sbc_buffer_fill < s_a2dp_sbc_packet_size) {
-            /* Try to get remaining bytes - xRingbufferReceiveUpTo handles wrapping */
-            sbc_data = xRingbufferReceiveUpTo(s_a2dp_sbc_encoded_ringbuf, &sbc_data_len,
-                                               pdMS_TO_TICKS(10), /* SHORT timeout for fragments */
-                                               s_a2dp_sbc_packet_size - sbc_buffer_fill);
+        s_a2dp_silent_frames += count / s_a2dp_out_ch;
+        if (s_a2dp_silent_frames < (uint64_t)A2DP_SAMPLE_RATE * CONFIG_A2DPSINK_HFPHF_SILENCE_HOLD_MS / 1000) {
+            return;
+        }
+        if (xSemaphoreTake(s_i2s_mode_mutex, pdMS_TO_TICKS(10)) != pdTRUE) {
+            return;
+        }
+        if (s_i2s_tx_mode == I2S_TX_MODE_A2DP) {
+            /* Everything still queued is silence as well */
+            audio_mixer_source_flush(s_a2dp_source);
+            s_a2dp_output_idle = true;
+            s_stats.a2dp_silence_idles++;
+            ESP_LOGI(BT_I2S_TAG, "A2DP silent for %d ms, idling output", CONFIG_A2DPSINK_HFPHF_SILENCE_HOLD_MS);
+            bt_i2s_tx_channel_idle();
+        }
+        xSemaphoreGive(s_i2s_mode_mutex);
+        return;
+    }
+    
+    s_a2dp_silent_frames = 0;
+    if (!s_a2dp_output_idle) {
+        return;
+    }
+    if (xSemaphoreTake(s_i2s_mode_mutex, pdMS_TO_TICKS(10)) != pdTRUE) {
+        return;
+    }
+    if (s_i2s_tx_mode == I2S_TX_MODE_A2DP) {
+        s_a2dp_output_idle = false;
+        audio_mixer_source_fade_in(s_a2dp_source, CONFIG_A2DPSINK_HFPHF_SILENCE_FADE_MS);
+        bt_i2s_tx_channel_enable();
+        ESP_LOGI(BT_I2S_TAG, "A2DP audio resumed, output woken");
+    }
+    xSemaphoreGive(s_i2s_mode_mutex);
+}
+#endif
+
+/**
+ * @brief Number of channels the A2DP path outputs for a given stream channel count
+ */
+static int bt_i2s_a2dp_out_channels(int ch_count) {
+    return (ch_count == 1 || s_a2dp_output_channels != BT_I2S_OUTPUT_STEREO) ? 1 : 2;
+}
+
+/**
+ * @brief Reduce interleaved stereo PCM to mono in place, per the output channel mode
+ * 
+ * @return Size of the mono PCM in bytes
+ */
+static size_t bt_i2s_a2dp_downmix(int16_t *pcm, size_t size) {
+    const size_t frames = size / (2 * sizeof(int16_t));
+    
+    switch (s_a2dp_output_channels) {
+    case BT_I2S_OUTPUT_LEFT:
+        for (size_t i = 0; i < frames; i++) {
+            pcm[i] = pcm[i * 2];
+        }
+        break;
+    case BT_I2S_OUTPUT_RIGHT:
+        for (size_t i = 0; i < frames; i++) {
+            pcm[i] = pcm[i * 2 + 1];
+        }
+        break;
+    default:
+        for (size_t i = 0; i < frames; i++) {
+            pcm[i] = (int16_t)(((int32_t)pcm[i * 2] + pcm[i * 2 + 1]) >> 1);
+        }
+        break;
+    }
+    return frames * sizeof(int16_t);
+}
+
+/**
+ * @brief Queue decoded A2DP PCM on the mixer source (downmixed in place if needed)
+ */
+static void bt_i2s_a2dp_write_pcm(uint8_t *data, size_t size) {
+    if (s_a2dp_out_ch == 1 && A2DP_CH_COUNT != 1) {
+        size = bt_i2s_a2dp_downmix((int16_t *)data, size);
+    }
+    
+#if CONFIG_A2DPSINK_HFPHF_SILENCE_IDLE
+    bt_i2s_a2dp_check_silence(data, size);
+    if (s_a2dp_output_idle) {
+        return;
+    }
+#endif
+    audio_mixer_source_write(s_a2dp_source, data, size, 0);
+    
+    if (!s_a2dp_first_audio_seen && audio_mixer_source_is_playing(s_a2dp_source)) {
+        s_a2dp_first_audio_seen = true;
+        s_stats.a2dp_first_audio_us = (uint32_t)(esp_timer_get_time() - s_a2dp_start_time_us);
+        ESP_LOGI(BT_I2S_TAG, "A2DP start latency: first packet %" PRIu32 " us, decoder %" PRIu32 " us, first audio %" PRIu32 " us",
+                 s_stats.a2dp_first_packet_us, s_stats.a2dp_decoder_open_us, s_stats.a2dp_first_audio_us);
+    }
+}
+
+/**
+ * @brief A2DP decoding task - decodes SBC/AAC packets and feeds decoded PCM to the mixer
+ */
+static void bt_i2s_a2dp_decode_task_handler(void *arg) {
+    ESP_LOGI(BT_I2S_TAG, "A2DP decode task started");
+    
+    a2dp_codec_type_t codec = s_a2dp_codec;
+    /* Only switched by bt_i2s_a2dp_apply_reconfigure(), while this task is parked */
+    RingbufHandle_t ringbuf = s_a2dp_sbc_encoded_ringbuf;
+    
+    /* Check the decoder out while the first packet is still in flight */
+    int64_t t0 = esp_timer_get_time();
+    codec_ctx_t *decoder = bt_i2s_a2dp_dec_cache_get(codec, A2DP_SAMPLE_RATE, (A2DP_CH_COUNT == 1) ? 1 : 2, true);
+    s_stats.a2dp_decoder_open_us = (uint32_t)(esp_timer_get_time() - t0);
+    
+    /* Sized for either codec, so an in-place reconfiguration can keep it */
+    const size_t decoded_pcm_size = A2DP_AAC_MAX_PCM_BYTES;
+    uint8_t *decoded_pcm = (uint8_t *)malloc(decoded_pcm_size);
+    if (decoded_pcm == NULL) {
+        ESP_LOGE(BT_I2S_TAG, "Failed to allocate decode buffer");
+        bt_i2s_a2dp_dec_cache_put(decoder);
+        xSemaphoreGive(s_a2dp_decode_task_exit_sem);
+        vTaskDelete(NULL);
+        return;
+    }
+    
+    /* SBC packet buffer, allocated once the packet size is known (first packet) */
+    uint8_t *sbc_buffer = NULL;
+    size_t sbc_packet_size = 0;
+    size_t sbc_buffer_fill = 0;
+    uint8_t *sbc_data = NULL;
+    size_t sbc_data_len = 0;
+    
+    s_a2dp_decode_time_us = 0;
+    s_a2dp_decode_frames = 0;
+    
+    while (s_bt_i2s_a2dp_decode_task_running) {
+        if (xSemaphoreTake(s_a2dp_sbc_packet_ready_sem, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        
+        if (s_a2dp_reconfig_pending) {
+            /* Renegotiated: hand the decoder back and switch the stream format over */
+            bt_i2s_a2dp_dec_cache_put(decoder);
+            decoder = NULL;
+            free(sbc_buffer);
+            sbc_buffer = NULL;
+            if (!bt_i2s_a2dp_apply_reconfigure(&ringbuf)) {
+                continue;  /* stopping */
+            }
+            codec = s_a2dp_codec;
+            s_a2dp_decode_time_us = 0;
+            s_a2dp_decode_frames = 0;
+            continue;
+        }
+        
+        if (decoder == NULL) {
+            t0 = esp_timer_get_time();
+            decoder = bt_i2s_a2dp_dec_cache_get(codec, A2DP_SAMPLE_RATE, (A2DP_CH_COUNT == 1) ? 1 : 2, true);
+            s_stats.a2dp_decoder_open_us = (uint32_t)(esp_timer_get_time() - t0);
+            if (decoder == NULL) {
+                continue;
+            }
+            ESP_LOGI(BT_I2S_TAG, "✓ A2DP decoder opened");
+        }
+        
+        if (codec == A2DP_CODEC_SBC && sbc_buffer == NULL) {
+            sbc_packet_size = s_a2dp_sbc_packet_size;
+            if (sbc_packet_size == 0 || (sbc_buffer = (uint8_t *)malloc(sbc_packet_size)) == NULL) {
+                continue;
+            }
+            ESP_LOGI(BT_I2S_TAG, "A2DP SBC decode ready (packet_size=%d)", (int)sbc_packet_size);
+        }
+        
+        if (codec == A2DP_CODEC_AAC) {
+            /* Each ringbuffer item is one LATM packet holding one access unit */
+            uint8_t *packet;
+            size_t packet_len = 0;
+            while (s_bt_i2s_a2dp_decode_task_running && !s_a2dp_reconfig_pending &&
+                   (packet = xRingbufferReceive(ringbuf, &packet_len, 0)) != NULL) {
+                size_t decoded_len = 0;
+                int64_t t0 = esp_timer_get_time();
+                int ret = codec_process(decoder, packet, packet_len,
+                                        decoded_pcm, decoded_pcm_size, &decoded_len, NULL);
+                bt_i2s_a2dp_account_decode(esp_timer_get_time() - t0, decoded_len);
+                vRingbufferReturnItem(ringbuf, packet);
+                
+                if (ret == 0 && decoded_len > 0) {
+                    bt_i2s_a2dp_write_pcm(decoded_pcm, decoded_len);
+                }
+            }
+            continue;
+        }
+        
+        sbc_buffer_fill = 0;
+        while (sbc_buffer_fill < sbc_packet_size && !s_a2dp_reconfig_pending) {
+            /* Try to get remaining bytes - xRingbufferReceiveUpTo handles wrapping */
+            sbc_data = xRingbufferReceiveUpTo(ringbuf, &sbc_data_len,
+                                               pdMS_TO_TICKS(10), /* SHORT timeout for fragments */
+                                               sbc_packet_size - sbc_buffer_fill);
             
             if (sbc_data == NULL || sbc_data_len == 0) {
                 if (sbc_buffer_fill > 0) {
@@ -729,35 +1636,28 @@ static void bt_i2s_a2dp_decode_task_handler(void *arg) {
             /* Copy what we got */
             memcpy(&sbc_buffer[sbc_buffer_fill], sbc_data, sbc_data_len);
             sbc_buffer_fill += sbc_data_len;
-            vRingbufferReturnItem(s_a2dp_sbc_encoded_ringbuf, sbc_data);
+            vRingbufferReturnItem(ringbuf, sbc_data);
         }
         
-        if (!decoder_opened) {
-            if (a2dp_sbc_dec_open(A2DP_SAMPLE_RATE, A2DP_CH_COUNT) == 0) {
-                decoder_opened = true;
-                ESP_LOGI(BT_I2S_TAG, "✓ A2DP SBC decoder opened");
-            } else {
-                continue;
-            }
+        if (s_a2dp_reconfig_pending) {
+            continue;  /* partial packet of the old configuration */
         }
         
         /* Decode packet */
         size_t offset = 0;
-        while (offset < s_a2dp_sbc_packet_size) {
-            uint8_t decoded_pcm[2048];
+        while (offset < sbc_packet_size) {
             size_t decoded_len = 0;
             size_t consumed = 0;
             
-            int ret = a2dp_sbc_dec_data(&sbc_buffer[offset],
-                                         s_a2dp_sbc_packet_size - offset,
-                                         decoded_pcm, &decoded_len, &consumed);
+            int64_t t0 = esp_timer_get_time();
+            int ret = codec_process(decoder, &sbc_buffer[offset],
+                                    sbc_packet_size - offset,
+                                    decoded_pcm, decoded_pcm_size, &decoded_len, &consumed);
+            bt_i2s_a2dp_account_decode(esp_timer_get_time() - t0, decoded_len);
             
             if (ret == 0 && decoded_len > 0) {
-                // Apply volume scaling AFTER decoding, BEFORE sending to ringbuffer
-                apply_volume_scaling((int16_t *)decoded_pcm, 
-                                    decoded_len / 2,  // Convert bytes to samples
-                                    s_a2dp_volume);
-                bt_i2s_a2dp_write_tx_ringbuf(decoded_pcm, decoded_len);
+                // Volume is the mixer source gain
+                bt_i2s_a2dp_write_pcm(decoded_pcm, decoded_len);
             }
             
             if (consumed == 0) break;
@@ -765,84 +1665,15 @@ static void bt_i2s_a2dp_decode_task_handler(void *arg) {
         }
     }
     
-    if (decoder_opened) {
-        a2dp_sbc_dec_close();
-    }
+    bt_i2s_a2dp_dec_cache_put(decoder);
     
     free(sbc_buffer);
+    free(decoded_pcm);
     xSemaphoreGive(s_a2dp_decode_task_exit_sem);
     ESP_LOGI(BT_I2S_TAG, "%s - exiting gracefully", __func__);
     vTaskDelete(NULL);
 }
 
-/**
- * @brief A2DP TX task - fetches decoded PCM from ringbuffer and writes to I2S
- */
-static void bt_i2s_a2dp_tx_task_handler(void *arg) {
-    uint8_t *data = NULL;
-    size_t item_size = 0;
-    const size_t item_size_upto = 240 * 6;
-    size_t bytes_written = 0;
-    
-    while (s_bt_i2s_a2dp_tx_task_running) {
-        if (pdTRUE == xSemaphoreTake(s_i2s_tx_semaphore, portMAX_DELAY)) {
-            for (;;) {
-                item_size = 0;
-                data = (uint8_t *)xRingbufferReceiveUpTo(s_i2s_a2dp_tx_ringbuf, &item_size, 0, item_size_upto);
-                
-                if (item_size == 0) {
-                    ESP_LOGI(BT_I2S_TAG, "%s - tx ringbuffer underflowed! mode changed: RINGBUFFER_MODE_PREFETCHING", __func__);
-                    s_i2s_a2dp_tx_ringbuffer_mode = RINGBUFFER_MODE_PREFETCHING;
-                    break;
-                }
-                
-                if (s_i2s_tx_mode == I2S_TX_MODE_A2DP) {
-                    i2s_channel_write(tx_chan, data, item_size, &bytes_written, portMAX_DELAY);
-                }
-                
-                vRingbufferReturnItem(s_i2s_a2dp_tx_ringbuf, (void *)data);
-            }
-        }
-    }
-    
-    xSemaphoreGive(s_a2dp_tx_task_exit_sem);
-    ESP_LOGI(BT_I2S_TAG, "%s - exiting gracefully", __func__);
-    vTaskDelete(NULL);
-}
-
-/**
- * @brief Write decoded A2DP PCM data to TX ringbuffer
- */
-static void bt_i2s_a2dp_write_tx_ringbuf(const uint8_t *data, uint32_t size) {
-    if (data == NULL || size == 0) {
-        return;
-    }
-    
-    size_t item_size = 0;
-    if (s_i2s_a2dp_tx_ringbuffer_mode == RINGBUFFER_MODE_DROPPING) {
-        ESP_LOGW(BT_I2S_TAG, "%s - ringbuffer is full, drop this packet!", __func__);
-        vRingbufferGetInfo(s_i2s_a2dp_tx_ringbuf, NULL, NULL, NULL, NULL, &item_size);
-        if (item_size <= RINGBUF_PREFETCH_WATER_LEVEL) {
-            ESP_LOGI(BT_I2S_TAG, "%s - ringbuffer data decreased! mode changed: RINGBUFFER_MODE_PROCESSING", __func__);
-            s_i2s_a2dp_tx_ringbuffer_mode = RINGBUFFER_MODE_PROCESSING;
-        }
-        return;
-    }
-    
-    xRingbufferSend(s_i2s_a2dp_tx_ringbuf, (void *)data, size, (TickType_t)0);
-    
-    if (s_i2s_a2dp_tx_ringbuffer_mode == RINGBUFFER_MODE_PREFETCHING) {
-        vRingbufferGetInfo(s_i2s_a2dp_tx_ringbuf, NULL, NULL, NULL, NULL, &item_size);
-        if (item_size >= RINGBUF_PREFETCH_WATER_LEVEL) {
-            ESP_LOGI(BT_I2S_TAG, "%s - ringbuffer data increased! mode changed: RINGBUFFER_MODE_PROCESSING", __func__);
-            s_i2s_a2dp_tx_ringbuffer_mode = RINGBUFFER_MODE_PROCESSING;
-            if (pdFALSE == xSemaphoreGive(s_i2s_tx_semaphore)) {
-                ESP_LOGE(BT_I2S_TAG, "%s - semphore give failed", __func__);
-            }
-        }
-    }
-}
-
 // ============================================================================
 // PUBLIC API: HFP MODE CONTROL
 // ============================================================================
@@ -857,29 +1688,48 @@ void bt_i2s_hfp_start(void) {
         return;
     }
     
+    int64_t t0 = esp_timer_get_time();
     xSemaphoreTake(s_i2s_mode_mutex, portMAX_DELAY);
     
-    // Wait for A2DP to stop if active
+    if (s_i2s_tx_mode == I2S_TX_MODE_HFP) {
+        ESP_LOGW(BT_I2S_TAG, "HFP already active");
+        xSemaphoreGive(s_i2s_mode_mutex);
+        return;
+    }
+    
     if (s_i2s_tx_mode == I2S_TX_MODE_A2DP) {
-        ESP_LOGI(BT_I2S_TAG, "HFP start: waiting for A2DP to stop...");
+        // Take the output over from music now instead of waiting for the phone to
+        // suspend the stream: fade it out, park its pipeline, keep the idle token.
+        // The fade is waited for without the mode mutex, so the A2DP decode task
+        // and other callers are not held up by it; the mode is checked again after.
+        ESP_LOGI(BT_I2S_TAG, "HFP start: handing the output over from A2DP");
+        audio_mixer_source_t *a2dp_source = s_a2dp_source;
         xSemaphoreGive(s_i2s_mode_mutex);
-        
-        if (xSemaphoreTake(s_i2s_mode_idle_sem, pdMS_TO_TICKS(I2S_MODE_SWITCH_TIMEOUT_MS)) != pdTRUE) {
-            ESP_LOGE(BT_I2S_TAG, "Timeout waiting for A2DP to stop");
-            return;
+        if (!audio_mixer_source_fade_out(a2dp_source, HANDOVER_FADE_MS, pdMS_TO_TICKS(4 * HANDOVER_FADE_MS))) {
+            ESP_LOGW(BT_I2S_TAG, "A2DP fade-out timed out");
         }
-        
         xSemaphoreTake(s_i2s_mode_mutex, portMAX_DELAY);
+        if (s_i2s_tx_mode == I2S_TX_MODE_HFP) {
+            ESP_LOGW(BT_I2S_TAG, "HFP already active");
+            xSemaphoreGive(s_i2s_mode_mutex);
+            return;
+        }
     }
     
-    if (s_i2s_tx_mode == I2S_TX_MODE_HFP) {
-        ESP_LOGW(BT_I2S_TAG, "HFP already active");
-        xSemaphoreGive(s_i2s_mode_mutex);
-        return;
+    if (s_i2s_tx_mode == I2S_TX_MODE_A2DP) {
+        // Hold the output across the handover: the amplifier, the PM locks and
+        // the TX channel stay up, only the clock changes
+        s_output_refs++;
+        bt_i2s_a2dp_stop_internal(true);
+        s_a2dp_preempted = true;
     }
     
     ESP_LOGI(BT_I2S_TAG, "Starting HFP mode");
     bt_i2s_hfp_start_internal();
+    if (s_a2dp_preempted) {
+        s_output_refs--;
+        bt_i2s_account_handover("A2DP -> HFP", t0);
+    }
     xSemaphoreGive(s_i2s_mode_mutex);
 }
 
@@ -892,6 +1742,7 @@ void bt_i2s_hfp_stop(void) {
         return;
     }
     
+    int64_t t0 = esp_timer_get_time();
     xSemaphoreTake(s_i2s_mode_mutex, portMAX_DELAY);
     
     if (s_i2s_tx_mode != I2S_TX_MODE_HFP) {
@@ -901,82 +1752,357 @@ void bt_i2s_hfp_stop(void) {
     }
     
     ESP_LOGI(BT_I2S_TAG, "Stopping HFP mode");
+    // Wait for the fade without the mode mutex (see bt_i2s_hfp_start())
+    audio_mixer_source_t *hfp_source = s_hfp_source;
+    xSemaphoreGive(s_i2s_mode_mutex);
+    if (!audio_mixer_source_fade_out(hfp_source, HANDOVER_FADE_MS, pdMS_TO_TICKS(4 * HANDOVER_FADE_MS))) {
+        ESP_LOGW(BT_I2S_TAG, "HFP fade-out timed out");
+    }
+    xSemaphoreTake(s_i2s_mode_mutex, portMAX_DELAY);
+    if (s_i2s_tx_mode != I2S_TX_MODE_HFP) {
+        ESP_LOGW(BT_I2S_TAG, "HFP stopped meanwhile");
+        xSemaphoreGive(s_i2s_mode_mutex);
+        return;
+    }
+    // Music comes back: keep the output up through the handover (see bt_i2s_hfp_start())
+    bool resume_a2dp = s_a2dp_preempted;
+    if (resume_a2dp) {
+        s_output_refs++;
+    }
     bt_i2s_hfp_task_deinit();
     
-    // Signal idle
-    xSemaphoreGive(s_i2s_mode_idle_sem);
+    if (resume_a2dp) {
+        // The stream the call took over is still running on the phone: bring the
+        // music back (fading in) without waiting for a new stream start
+        s_a2dp_preempted = false;
+        ESP_LOGI(BT_I2S_TAG, "Resuming A2DP after the call");
+        xSemaphoreTake(s_i2s_mode_idle_sem, 0);  // A2DP owns the idle token again
+        bt_i2s_a2dp_start_internal();
+        s_output_refs--;
+        bt_i2s_account_handover("HFP -> A2DP", t0);
+    } else {
+        // Signal idle
+        xSemaphoreGive(s_i2s_mode_idle_sem);
+    }
     xSemaphoreGive(s_i2s_mode_mutex);
 }
 
+/**
+ * @brief Record and log the duration of an A2DP <-> HFP handover
+ */
+static void bt_i2s_account_handover(const char *what, int64_t start_us) {
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start_us);
+    s_stats.handovers++;
+    s_stats.handover_us = us;
+    if (us > s_stats.handover_max_us) {
+        s_stats.handover_max_us = us;
+    }
+    if (us > HANDOVER_BUDGET_MS * 1000) {
+        ESP_LOGW(BT_I2S_TAG, "%s handover took %" PRIu32 " ms (budget %d ms)", what, us / 1000, HANDOVER_BUDGET_MS);
+    } else {
+        ESP_LOGI(BT_I2S_TAG, "%s handover in %" PRIu32 " ms", what, us / 1000);
+    }
+}
+
 /**
  * @brief Write decoded HFP audio data to TX ringbuffer (speaker output)
  */
 void bt_i2s_hfp_write_tx_ringbuf(const uint8_t *data, uint32_t size) {
-    if (s_i2s_hfp_tx_ringbuf == NULL) {
+    if (s_hfp_source == NULL) {
         return;
     }
     
-    size_t item_size = 0;
-    BaseType_t done = pdFALSE;
+    // The speaker ran dry since the last frame, or the link is losing packets:
+    // buffer more before the speaker restarts
+    uint32_t underruns = audio_mixer_source_get_underruns(s_hfp_source);
+    bool underrun = (underruns != s_hfp_spk_underruns_seen);
+    if (underrun || s_hfp_spk_link_grow) {
+        if (underrun) {
+            s_hfp_spk_underruns_seen = underruns;
+            s_hfp_call_spk_underruns++;
+            s_stats.hfp_spk_underruns++;
+        }
+        s_hfp_spk_link_grow = false;
+        s_hfp_spk_prefetch_frames += HFP_PREFETCH_GROW_FRAMES;
+        if (s_hfp_spk_prefetch_frames > HFP_PREFETCH_SPK_MAX_FRAMES) {
+            s_hfp_spk_prefetch_frames = HFP_PREFETCH_SPK_MAX_FRAMES;
+        }
+        audio_mixer_source_set_prefetch(s_hfp_source, bt_i2s_hfp_spk_prefetch_bytes());
+        s_stats.hfp_spk_prefetch_ms = s_hfp_spk_prefetch_frames * HFP_MSBC_FRAME_US / 1000;
+        ESP_LOGI(BT_I2S_TAG, "HFP speaker %s, prefetch now %" PRIu32 " frames",
+                 underrun ? "underrun" : "link loss", s_hfp_spk_prefetch_frames);
+    }
     
-    if (s_i2s_hfp_tx_ringbuffer_mode == RINGBUFFER_MODE_DROPPING) {
-        ESP_LOGW(BT_I2S_TAG, "%s - hfp tx ringbuffer is full, drop this packet!", __func__);
-        vRingbufferGetInfo(s_i2s_hfp_tx_ringbuf, NULL, NULL, NULL, NULL, &item_size);
-        if (item_size <= RINGBUF_HFP_TX_PREFETCH_WATER_LEVEL) {
-            ESP_LOGI(BT_I2S_TAG, "%s - hfp tx ringbuffer data decreased! (%d) mode changed: RINGBUFFER_MODE_PROCESSING", __func__, item_size);
-            s_i2s_hfp_tx_ringbuffer_mode = RINGBUFFER_MODE_PROCESSING;
+    audio_mixer_source_write(s_hfp_source, data, size, 0);
+}
+
+/**
+ * @brief Select the air codec for the next HFP start
+ */
+void bt_i2s_hfp_set_codec(bt_i2s_hfp_codec_t codec, uint16_t frame_bytes) {
+    s_hfp_codec = codec;
+    if (codec == BT_I2S_HFP_CODEC_CVSD) {
+        s_hfp_sample_rate = HFP_CVSD_SAMPLE_RATE;
+        if (frame_bytes == 0) {
+            frame_bytes = HFP_CVSD_DEFAULT_FRAME_BYTES;
+        } else if (frame_bytes > sizeof(s_hfp_pcm_frame)) {
+            ESP_LOGW(BT_I2S_TAG, "CVSD frame size %u too large, using %u",
+                     (unsigned)frame_bytes, (unsigned)sizeof(s_hfp_pcm_frame));
+            frame_bytes = sizeof(s_hfp_pcm_frame);
         }
+        s_hfp_cvsd_frame_bytes = frame_bytes & ~1u;
+        // 16-bit mono samples at 8 kHz: 125 us each
+        s_hfp_frame_us = (uint32_t)(s_hfp_cvsd_frame_bytes / 2) * 1000000 / HFP_CVSD_SAMPLE_RATE;
+    } else {
+        s_hfp_sample_rate = HFP_SAMPLE_RATE;
+        s_hfp_frame_us = HFP_MSBC_FRAME_US;
+    }
+    ESP_LOGI(BT_I2S_TAG, "HFP codec: %s, %d Hz", codec == BT_I2S_HFP_CODEC_CVSD ? "CVSD" : "mSBC", s_hfp_sample_rate);
+}
+
+/**
+ * @brief HCI frame size of the selected air codec
+ */
+uint16_t bt_i2s_hfp_frame_bytes(void) {
+    return (s_hfp_codec == BT_I2S_HFP_CODEC_CVSD) ? (uint16_t)s_hfp_cvsd_frame_bytes :
+                                                    ESP_HF_MSBC_ENCODED_FRAME_SIZE;
+}
+
+/**
+ * @brief Microphone frame size in the RX ringbuffer: an mSBC frame, or one RX task
+ * frame of PCM on narrowband calls
+ */
+static size_t bt_i2s_hfp_mic_frame_bytes(void) {
+    return (s_hfp_codec == BT_I2S_HFP_CODEC_MSBC) ? ESP_HF_MSBC_ENCODED_FRAME_SIZE : MSBC_FRAME_SAMPLES * 2;
+}
+
+/**
+ * @brief Deepen the speaker buffer when the call link loses too many packets
+ */
+bool bt_i2s_hfp_link_loss(uint16_t loss_permille) {
+    if (CONFIG_A2DPSINK_HFPHF_LINK_LOSS_GROW_PERMILLE == 0 ||
+        loss_permille < CONFIG_A2DPSINK_HFPHF_LINK_LOSS_GROW_PERMILLE ||
+        s_hfp_source == NULL || s_hfp_spk_prefetch_frames >= HFP_PREFETCH_SPK_MAX_FRAMES) {
+        return false;
+    }
+    // The decode task owns the prefetch level; it grows it with its next frame
+    s_hfp_spk_link_grow = true;
+    return true;
+}
+
+/**
+ * @brief Select the buffering profile for the next HFP start
+ */
+void bt_i2s_hfp_set_latency(bt_i2s_hfp_latency_t profile) {
+    s_hfp_latency = profile;
+    ESP_LOGI(BT_I2S_TAG, "HFP latency profile: %s", profile == BT_I2S_HFP_LATENCY_LOW ? "low" : "normal");
+}
+
+/**
+ * @brief Queue one received frame for the HFP decode task
+ */
+void bt_i2s_hfp_write_tx_frame(const uint8_t *data, size_t len, bool is_bad_frame) {
+    if (s_hfp_frame_queue == NULL || !s_bt_i2s_hfp_dec_task_running) {
         return;
     }
+    if (is_bad_frame) {
+        s_hfp_call_bad_frames++;
+        s_stats.hfp_bad_frames++;
+    }
+    if (data == NULL || len > HFP_FRAME_QUEUE_ITEM_MAX - 1) {
+        len = 0;  // a bad frame is still queued, so it is concealed in sequence
+    }
     
-    done = xRingbufferSend(s_i2s_hfp_tx_ringbuf, (void *)data, size, (TickType_t)0);
-    
-    if (!done) {
-        ESP_LOGW(BT_I2S_TAG, "%s - hfp tx ringbuffer overflowed, ready to decrease data! mode changed: RINGBUFFER_MODE_DROPPING", __func__);
-        s_i2s_hfp_tx_ringbuffer_mode = RINGBUFFER_MODE_DROPPING;
+    // Never block the BT stack: if the decode task fell behind, drop the frame
+    uint8_t *item = NULL;
+    if (xRingbufferSendAcquire(s_hfp_frame_queue, (void **)&item, len + 1, 0) != pdTRUE) {
+        s_hfp_call_queue_drops++;
+        s_stats.hfp_queue_drops++;
+        return;
+    }
+    item[0] = is_bad_frame ? HFP_FRAME_BAD : HFP_FRAME_GOOD;
+    if (len > 0) {
+        memcpy(&item[1], data, len);
     }
+    xRingbufferSendComplete(s_hfp_frame_queue, item);
     
-    if (s_i2s_hfp_tx_ringbuffer_mode == RINGBUFFER_MODE_PREFETCHING) {
-        vRingbufferGetInfo(s_i2s_hfp_tx_ringbuf, NULL, NULL, NULL, NULL, &item_size);
-        if (item_size >= RINGBUF_HFP_TX_PREFETCH_WATER_LEVEL) {
-            ESP_LOGI(BT_I2S_TAG, "%s - hfp tx ringbuffer data increased! (%d) mode changed: RINGBUFFER_MODE_PROCESSING", __func__, item_size);
-            s_i2s_hfp_tx_ringbuffer_mode = RINGBUFFER_MODE_PROCESSING;
-        }
+    TaskHandle_t dec_task = s_bt_i2s_hfp_dec_task_handle;
+    if (dec_task != NULL) {
+        xTaskNotifyGive(dec_task);
     }
 }
 
 /**
- * @brief Read encoded HFP audio data from RX ringbuffer (microphone input)
+ * @brief Account one HFP audio data callback
  */
-size_t bt_i2s_hfp_read_rx_ringbuf(uint8_t *mic_data) {
+void bt_i2s_hfp_account_frame(uint32_t heap_ops, uint32_t cb_us) {
+    s_hfp_call_frames++;
+    s_hfp_call_heap_ops += heap_ops;
+    s_hfp_call_cb_us += cb_us;
+    if (cb_us > s_hfp_call_cb_max_us) {
+        s_hfp_call_cb_max_us = cb_us;
+    }
+    s_stats.hfp_frames++;
+    s_stats.hfp_heap_ops += heap_ops;
+    s_hfp_cb_total_us += cb_us;
+    if (cb_us > s_stats.hfp_cb_max_us) {
+        s_stats.hfp_cb_max_us = cb_us;
+    }
+    int bucket = 0;
+    while (bucket < BT_I2S_HFP_CB_HIST_BUCKETS - 1 && cb_us >= s_hfp_cb_hist_bounds_us[bucket]) {
+        bucket++;
+    }
+    s_hfp_call_cb_hist[bucket]++;
+    s_stats.hfp_cb_hist[bucket]++;
+}
+
+/**
+ * @brief Read HFP microphone data from RX ringbuffer (one mSBC frame or a run of CVSD-rate PCM)
+ */
+size_t bt_i2s_hfp_read_rx_ringbuf(uint8_t *mic_data, size_t len) {
     if (!s_i2s_hfp_rx_ringbuf) {
         return 0;
     }
     
-    size_t item_size = 0;
+    // Runs in the BT stack's audio data callback: never wait, and only take a
+    // frame once all of it is buffered, so the byte stream stays frame aligned
+    size_t total = 0;
     if (s_i2s_hfp_rx_ringbuffer_mode != RINGBUFFER_MODE_PREFETCHING) {
-        uint8_t *ringbuf_data = xRingbufferReceiveUpTo(s_i2s_hfp_rx_ringbuf, &item_size, 10000, ESP_HF_MSBC_ENCODED_FRAME_SIZE);
-        memcpy(mic_data, ringbuf_data, item_size);
-        vRingbufferReturnItem(s_i2s_hfp_rx_ringbuf, (void *)ringbuf_data);
+        size_t waiting = 0;
+        vRingbufferGetInfo(s_i2s_hfp_rx_ringbuf, NULL, NULL, NULL, NULL, &waiting);
+        if (waiting >= len) {
+            // A byte buffer hands out contiguous runs only, so a read across the wrap takes two
+            for (int i = 0; i < 2 && total < len; i++) {
+                size_t item_size = 0;
+                uint8_t *ringbuf_data = xRingbufferReceiveUpTo(s_i2s_hfp_rx_ringbuf, &item_size, 0, len - total);
+                if (ringbuf_data == NULL) {
+                    break;
+                }
+                memcpy(&mic_data[total], ringbuf_data, item_size);
+                vRingbufferReturnItem(s_i2s_hfp_rx_ringbuf, (void *)ringbuf_data);
+                total += item_size;
+            }
+        } else {
+            // The microphone fell behind the link: buffer more before sending again
+            s_hfp_call_mic_underruns++;
+            s_stats.hfp_mic_underruns++;
+            s_hfp_mic_prefetch_frames += HFP_PREFETCH_GROW_FRAMES;
+            bt_i2s_hfp_update_mic_prefetch();
+            s_i2s_hfp_rx_ringbuffer_mode = RINGBUFFER_MODE_PREFETCHING;
+        }
     }
     
-    return item_size;
+    if (total == len) {
+        if (len <= sizeof(s_hfp_uplink_last)) {
+            memcpy(s_hfp_uplink_last, mic_data, len);
+            s_hfp_uplink_last_len = len;
+        }
+        s_hfp_uplink_fills = 0;
+    } else {
+        bt_i2s_hfp_fill_uplink_frame(mic_data, len);
+    }
+    return len;
+}
+
+/**
+ * @brief Fill an uplink frame the microphone could not deliver in time
+ *
+ * The first missing frame repeats the last real one (bridging a single late
+ * frame without a gap); after that comfort noise is sent, so the far end hears
+ * a quiet line instead of dropouts or decoder errors.
+ */
+static void bt_i2s_hfp_fill_uplink_frame(uint8_t *mic_data, size_t len) {
+    if (s_hfp_uplink_fills == 0 && s_hfp_uplink_last_len == len) {
+        memcpy(mic_data, s_hfp_uplink_last, len);
+    } else if (s_hfp_uplink_cn_ready && len <= sizeof(s_hfp_uplink_cn)) {
+        memcpy(mic_data, s_hfp_uplink_cn, len);
+    } else {
+        memset(mic_data, 0, len);
+    }
+    s_hfp_uplink_fills++;
+    s_hfp_call_uplink_fill++;
+    s_stats.hfp_uplink_fill_frames++;
 }
 
 // ============================================================================
 // INTERNAL: HFP TASK MANAGEMENT
 // ============================================================================
 
+/**
+ * @brief Speaker prefetch in bytes of call-rate PCM (7.5 ms per frame at either rate)
+ */
+static size_t bt_i2s_hfp_spk_prefetch_bytes(void) {
+    return (size_t)s_hfp_spk_prefetch_frames * MSBC_FRAME_SAMPLES * 2 * s_hfp_sample_rate / HFP_SAMPLE_RATE;
+}
+
+/**
+ * @brief Recompute the microphone prefetch level from its frame count
+ *
+ * The RX ringbuffer is sized in frames of the call's codec (see
+ * bt_i2s_hfp_mic_frame_bytes()). The level stays below the ringbuffer size, so
+ * prefetching always ends.
+ */
+static void bt_i2s_hfp_update_mic_prefetch(void) {
+    size_t frame_bytes = bt_i2s_hfp_mic_frame_bytes();
+    if (s_hfp_mic_prefetch_frames > RINGBUF_HFP_RX_PREFETCH_MAX_FRAMES) {
+        ESP_LOGW(BT_I2S_TAG, "HFP microphone prefetch capped at %d frames", RINGBUF_HFP_RX_PREFETCH_MAX_FRAMES);
+        s_hfp_mic_prefetch_frames = RINGBUF_HFP_RX_PREFETCH_MAX_FRAMES;
+    }
+    size_t bytes = s_hfp_mic_prefetch_frames * frame_bytes;
+    s_hfp_mic_prefetch_bytes = bytes;
+    s_stats.hfp_mic_prefetch_ms = (uint32_t)((uint64_t)bytes / frame_bytes * MSBC_FRAME_SAMPLES * 1000 / s_hfp_sample_rate);
+}
+
 /**
  * @brief Start HFP mode internal - opens codec and starts tasks
  */
 static void bt_i2s_hfp_start_internal(void) {
-    msbc_dec_open();
-    if (msbc_enc_open() != 0) {
-        ESP_LOGE(BT_I2S_TAG, "Failed to initialize encoder");
+    // The decode task is not running here, so the decoder can be touched without locking.
+    // Narrowband calls carry PCM and need no decoder.
+    if (s_hfp_codec == BT_I2S_HFP_CODEC_MSBC) {
+        if (s_hfp_msbc_dec == NULL) {
+            s_hfp_msbc_dec = msbc_dec_create();
+        } else {
+            codec_reset(s_hfp_msbc_dec);
+        }
+        if (s_hfp_msbc_dec == NULL) {
+            ESP_LOGE(BT_I2S_TAG, "Failed to initialize decoder");
+        }
     }
+    memset(s_hfp_pcm_frame, 0, sizeof(s_hfp_pcm_frame));
+    
+    s_hfp_call_frames = 0;
+    s_hfp_call_heap_ops = 0;
+    s_hfp_call_cb_us = 0;
+    s_hfp_call_cb_max_us = 0;
+    s_hfp_call_queue_drops = 0;
+    s_hfp_call_bad_frames = 0;
+    s_hfp_call_concealed = 0;
+    s_hfp_call_spk_underruns = 0;
+    s_hfp_call_mic_underruns = 0;
+    s_hfp_call_uplink_fill = 0;
+    s_hfp_call_dec_wakeups = 0;
+    s_hfp_call_dec_timeouts = 0;
+    memset(s_hfp_call_cb_hist, 0, sizeof(s_hfp_call_cb_hist));
+    s_hfp_uplink_last_len = 0;
+    s_hfp_uplink_fills = 0;
+    s_hfp_uplink_cn_ready = false;
     
     bt_i2s_channels_config_hfp();
+#if CONFIG_A2DPSINK_HFPHF_AEC
+    // Speaker output reaches the microphone a full TX DMA queue plus, on average,
+    // half an RX descriptor after the mixer wrote it
+    if (hfp_aec_start(s_hfp_sample_rate, s_tx_dma_frames + s_rx_dma_frames / 2) == ESP_OK) {
+        audio_mixer_set_tap(hfp_aec_push_reference);
+    }
+#endif
+#if CONFIG_A2DPSINK_HFPHF_NS
+    hfp_ns_start();
+#endif
+#if CONFIG_A2DPSINK_HFPHF_AGC
+    hfp_agc_start(s_hfp_sample_rate);
+#endif
+    hfp_mic_start(s_hfp_sample_rate);
     bt_i2s_tx_channel_enable();
     bt_i2s_rx_channel_enable();
     bt_i2s_hfp_task_init();
@@ -986,20 +2112,57 @@ static void bt_i2s_hfp_start_internal(void) {
  * @brief Initialize HFP tasks and ringbuffers
  */
 static void bt_i2s_hfp_task_init(void) {
-    s_i2s_hfp_tx_ringbuffer_mode = RINGBUFFER_MODE_PREFETCHING;
     s_i2s_tx_mode = I2S_TX_MODE_HFP;
     
-    if ((s_i2s_hfp_tx_ringbuf = xRingbufferCreate(RINGBUF_HFP_TX_HIGHEST_WATER_LEVEL, RINGBUF_TYPE_BYTEBUF)) == NULL) {
-        ESP_LOGE(BT_I2S_TAG, "%s, hfp tx ringbuffer create failed", __func__);
+    if (s_hfp_latency == BT_I2S_HFP_LATENCY_LOW) {
+        s_hfp_spk_prefetch_frames = HFP_PREFETCH_LOW_SPK_FRAMES;
+        s_hfp_mic_prefetch_frames = HFP_PREFETCH_LOW_MIC_FRAMES;
+    } else {
+        s_hfp_spk_prefetch_frames = HFP_PREFETCH_NORMAL_SPK_FRAMES;
+        s_hfp_mic_prefetch_frames = HFP_PREFETCH_NORMAL_MIC_FRAMES;
+    }
+    s_hfp_spk_underruns_seen = 0;
+    s_hfp_spk_link_grow = false;
+    s_stats.hfp_spk_prefetch_ms = s_hfp_spk_prefetch_frames * HFP_MSBC_FRAME_US / 1000;
+    bt_i2s_hfp_update_mic_prefetch();
+    
+    audio_mixer_source_cfg_t src_cfg = {
+        .name = "hfp",
+        .sample_rate = s_hfp_sample_rate,
+        .channels = 1,
+        // Same buffering time at either rate
+        .buffer_bytes = RINGBUF_HFP_TX_HIGHEST_WATER_LEVEL * s_hfp_sample_rate / HFP_SAMPLE_RATE,
+        .prefetch_bytes = bt_i2s_hfp_spk_prefetch_bytes(),
+        .duck_others = false,
+    };
+    if ((s_hfp_source = audio_mixer_source_create(&src_cfg)) == NULL) {
+        ESP_LOGE(BT_I2S_TAG, "%s, hfp mixer source create failed", __func__);
         return;
     }
+    audio_mixer_source_set_gain(s_hfp_source, s_volume_table[s_hfp_speaker_volume]);
     
-    s_bt_i2s_hfp_tx_task_running = true;
-    xTaskCreate(bt_i2s_hfp_tx_task_handler, "BtI2ShfpTxTask", 8192, NULL, configMAX_PRIORITIES - 4, &s_bt_i2s_hfp_tx_task_handle);
+    // Drop frames left over from the previous call before the decode task sees them
+    if (s_hfp_frame_queue != NULL) {
+        size_t item_size;
+        void *item;
+        while ((item = xRingbufferReceive(s_hfp_frame_queue, &item_size, 0)) != NULL) {
+            vRingbufferReturnItem(s_hfp_frame_queue, item);
+        }
+    }
+    xSemaphoreTake(s_hfp_dec_task_exit_sem, 0);
+    s_bt_i2s_hfp_dec_task_running = true;
+    if (xTaskCreatePinnedToCore(bt_i2s_hfp_dec_task_handler, "BtI2ShfpDec", 4096, NULL,
+                                configMAX_PRIORITIES - 3, &s_bt_i2s_hfp_dec_task_handle,
+                                HFP_DECODE_TASK_CORE) != pdPASS) {
+        ESP_LOGE(BT_I2S_TAG, "%s, hfp decode task create failed", __func__);
+        s_bt_i2s_hfp_dec_task_running = false;
+        s_bt_i2s_hfp_dec_task_handle = NULL;
+    }
     
     s_i2s_hfp_rx_ringbuffer_mode = RINGBUFFER_MODE_PREFETCHING;
     
-    if ((s_i2s_hfp_rx_ringbuf = xRingbufferCreate(RINGBUF_HFP_RX_HIGHEST_WATER_LEVEL, RINGBUF_TYPE_BYTEBUF)) == NULL) {
+    s_hfp_rx_ringbuf_size = RINGBUF_HFP_RX_FRAMES * bt_i2s_hfp_mic_frame_bytes();
+    if ((s_i2s_hfp_rx_ringbuf = xRingbufferCreate(s_hfp_rx_ringbuf_size, RINGBUF_TYPE_BYTEBUF)) == NULL) {
         ESP_LOGE(BT_I2S_TAG, "%s, hfp rx ringbuffer create failed", __func__);
         return;
     }
@@ -1017,39 +2180,54 @@ static void bt_i2s_hfp_task_deinit(void) {
     // STEP 1: Unregister audio callback FIRST (prevents new data from arriving)
     esp_hf_client_register_audio_data_callback(NULL);
     
+    if (s_hfp_call_frames > 0) {
+        /* One callback per 7.5 ms eSCO interval */
+        uint32_t call_ms = s_hfp_call_frames * 15 / 2;
+        ESP_LOGI(BT_I2S_TAG, "HFP data path: %" PRIu32 " frames, %" PRIu32 " heap ops (%" PRIu32 " per call-second)",
+                 s_hfp_call_frames, s_hfp_call_heap_ops,
+                 (uint32_t)((uint64_t)s_hfp_call_heap_ops * 1000 / (call_ms > 0 ? call_ms : 1)));
+        ESP_LOGI(BT_I2S_TAG, "HFP audio data callback: avg %" PRIu32 " us, max %" PRIu32 " us, %" PRIu32 " frames dropped",
+                 (uint32_t)(s_hfp_call_cb_us / s_hfp_call_frames), s_hfp_call_cb_max_us, s_hfp_call_queue_drops);
+        /* Rates in tenths of a percent of the frames received */
+        ESP_LOGI(BT_I2S_TAG, "HFP frame loss: %" PRIu32 " bad (%" PRIu32 ".%" PRIu32 "%%), %" PRIu32 " concealed (%" PRIu32 ".%" PRIu32 "%%)",
+                 s_hfp_call_bad_frames,
+                 s_hfp_call_bad_frames * 1000 / s_hfp_call_frames / 10, s_hfp_call_bad_frames * 1000 / s_hfp_call_frames % 10,
+                 s_hfp_call_concealed,
+                 s_hfp_call_concealed * 1000 / s_hfp_call_frames / 10, s_hfp_call_concealed * 1000 / s_hfp_call_frames % 10);
+        ESP_LOGI(BT_I2S_TAG, "HFP buffering: speaker %" PRIu32 " ms (%" PRIu32 " underruns), mic %" PRIu32 " ms (%" PRIu32 " underruns)",
+                 s_stats.hfp_spk_prefetch_ms, s_hfp_call_spk_underruns,
+                 s_stats.hfp_mic_prefetch_ms, s_hfp_call_mic_underruns);
+        ESP_LOGI(BT_I2S_TAG, "HFP callback latency (us) <50:%" PRIu32 " <100:%" PRIu32 " <200:%" PRIu32 " <500:%" PRIu32
+                 " <1000:%" PRIu32 " <2000:%" PRIu32 " <5000:%" PRIu32 " more:%" PRIu32 ", %" PRIu32 " uplink fill frames",
+                 s_hfp_call_cb_hist[0], s_hfp_call_cb_hist[1], s_hfp_call_cb_hist[2], s_hfp_call_cb_hist[3],
+                 s_hfp_call_cb_hist[4], s_hfp_call_cb_hist[5], s_hfp_call_cb_hist[6], s_hfp_call_cb_hist[7],
+                 s_hfp_call_uplink_fill);
+        ESP_LOGI(BT_I2S_TAG, "HFP decode task: %" PRIu32 " wakeups (%" PRIu32 " per second), %" PRIu32 " on timeout (%" PRIu32 " per second)",
+                 s_hfp_call_dec_wakeups, (uint32_t)((uint64_t)s_hfp_call_dec_wakeups * 1000 / (call_ms > 0 ? call_ms : 1)),
+                 s_hfp_call_dec_timeouts, (uint32_t)((uint64_t)s_hfp_call_dec_timeouts * 1000 / (call_ms > 0 ? call_ms : 1)));
+    }
+    
     // STEP 2: Set mode to NONE and stop flags IMMEDIATELY (signals tasks to exit)
     s_i2s_tx_mode = I2S_TX_MODE_NONE;
-    s_bt_i2s_hfp_tx_task_running = false;
     s_bt_i2s_hfp_rx_task_running = false;
-    
-    // STEP 3: Wait briefly for tasks to see the stop flag and exit loops
-    vTaskDelay(pdMS_TO_TICKS(50));
-    
-    // STEP 4: Close codecs (NOW safe - tasks have stopped)
-    msbc_dec_close();
-    msbc_enc_close();
-    
-    // STEP 5: Clean up TX task
-    if (s_bt_i2s_hfp_tx_task_handle) {
-        // Wake up task by sending dummy data to ringbuffer (in case it's blocked)
-        if (s_i2s_hfp_tx_ringbuf) {
-            uint8_t dummy[1] = {0};
-            xRingbufferSend(s_i2s_hfp_tx_ringbuf, dummy, 1, 0);
-        }
-        
-        // Wait for task to exit
-        if (pdTRUE == xSemaphoreTake(s_i2s_hfp_tx_ringbuf_delete, pdMS_TO_TICKS(500))) {
-            if (s_i2s_hfp_tx_ringbuf) {
-                vRingbufferDelete(s_i2s_hfp_tx_ringbuf);
-                s_i2s_hfp_tx_ringbuf = NULL;
-            }
-            s_bt_i2s_hfp_tx_task_handle = NULL;
-        } else {
-            ESP_LOGW(BT_I2S_TAG, "TX task did not stop in time");
+    s_bt_i2s_hfp_dec_task_running = false;
+    
+    // STEP 3: Stop the decode task before the mixer source it writes to goes away
+    // (the decoder stays open and is reset on the next start)
+    if (s_bt_i2s_hfp_dec_task_handle) {
+        xTaskNotifyGive(s_bt_i2s_hfp_dec_task_handle);
+        if (xSemaphoreTake(s_hfp_dec_task_exit_sem, pdMS_TO_TICKS(500)) != pdTRUE) {
+            ESP_LOGW(BT_I2S_TAG, "HFP decode task did not stop in time");
         }
+        s_bt_i2s_hfp_dec_task_handle = NULL;
     }
+    audio_mixer_source_destroy(s_hfp_source);
+    s_hfp_source = NULL;
     
-    // STEP 6: Clean up RX task
+    // STEP 4: Clean up RX task (it destroys its own encoder on the way out)
+#if CONFIG_A2DPSINK_HFPHF_AEC
+    audio_mixer_set_tap(NULL);
+#endif
     if (s_bt_i2s_hfp_rx_task_handle) {
         // Wait for task to exit
         if (pdTRUE == xSemaphoreTake(s_i2s_hfp_rx_ringbuf_delete, pdMS_TO_TICKS(500))) {
@@ -1058,13 +2236,22 @@ static void bt_i2s_hfp_task_deinit(void) {
                 s_i2s_hfp_rx_ringbuf = NULL;
             }
             s_bt_i2s_hfp_rx_task_handle = NULL;
+#if CONFIG_A2DPSINK_HFPHF_AEC
+            hfp_aec_stop();
+#endif
+#if CONFIG_A2DPSINK_HFPHF_NS
+            hfp_ns_stop();
+#endif
+#if CONFIG_A2DPSINK_HFPHF_AGC
+            hfp_agc_stop();
+#endif
         } else {
             ESP_LOGW(BT_I2S_TAG, "RX task did not stop in time");
         }
     }
     
-    // STEP 7: Disable I2S channels
-    bt_i2s_tx_channel_disable();
+    // STEP 5: Disable I2S channels
+    bt_i2s_tx_channel_idle();
     bt_i2s_rx_channel_disable();
     
     ESP_LOGI(BT_I2S_TAG, "HFP task deinitialized");
@@ -1074,107 +2261,37 @@ static void bt_i2s_hfp_task_deinit(void) {
 // INTERNAL: HFP TASKS
 // ============================================================================
 
-/**
- * @brief HFP TX task - fetches decoded audio from ringbuffer and writes to I2S
- */
-static void bt_i2s_hfp_tx_task_handler(void *arg) {
-    uint8_t *data = NULL;
-    size_t item_size = 0;
-    const size_t item_size_upto = MSBC_FRAME_SAMPLES * 2;
-    size_t bytes_written = 0;
-    
-    ESP_LOGI(BT_I2S_TAG, "%s starting", __func__);
-    
-    while (s_bt_i2s_hfp_tx_task_running && s_i2s_tx_mode == I2S_TX_MODE_HFP) {
-        if (s_i2s_hfp_tx_ringbuffer_mode != RINGBUFFER_MODE_PREFETCHING) {
-            item_size = 0;
-            data = (uint8_t *)xRingbufferReceiveUpTo(s_i2s_hfp_tx_ringbuf, &item_size,
-                                                       pdMS_TO_TICKS(100), item_size_upto);
-            
-            if (item_size == 0 || data == NULL) {
-                if (!s_bt_i2s_hfp_tx_task_running || s_i2s_tx_mode != I2S_TX_MODE_HFP) {
-                    ESP_LOGI(BT_I2S_TAG, "%s - exiting (no data, task stopping)", __func__);
-                    break;
-                }
-                
-                ESP_LOGI(BT_I2S_TAG, "%s - tx ringbuffer underflowed! mode changed: RINGBUFFER_MODE_PREFETCHING", __func__);
-                s_i2s_hfp_tx_ringbuffer_mode = RINGBUFFER_MODE_PREFETCHING;
-                vTaskDelay(pdMS_TO_TICKS(40));
-                continue;
-            }
-            
-            if (!s_bt_i2s_hfp_tx_task_running || s_i2s_tx_mode != I2S_TX_MODE_HFP) {
-                vRingbufferReturnItem(s_i2s_hfp_tx_ringbuf, (void *)data);
-                ESP_LOGI(BT_I2S_TAG, "%s - exiting (task stopped while processing)", __func__);
-                break;
-            }
-            
-            // Apply speaker volume AFTER decode, BEFORE sending to I2S
-            apply_volume_scaling((int16_t *)data,
-                            item_size / 2,
-                            bt_i2s_get_hfp_speaker_volume());
-
-            /*             
-            https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/peripherals/i2s.html#std-tx-mode
-            ...
-            Besides, for 8-bit and 16-bit mono modes, the real data on the line is swapped. To get the correct data sequence,
-            the writing buffer needs to swap the data every two bytes.
-             */
-            // Byte-swap inline (no temp buffer needed)
-            int16_t *send_data = (int16_t *)data;
-            for (int i = 0; i < (int)(item_size / 2); i += 2) {
-                int16_t temp = send_data[i];
-                send_data[i] = send_data[i + 1];
-                send_data[i + 1] = temp;
-            }
-            
-            esp_err_t write_ret = i2s_channel_write(tx_chan, send_data, item_size,
-                                                      &bytes_written, portMAX_DELAY);
-            if (write_ret != ESP_OK) {
-                ESP_LOGW(BT_I2S_TAG, "%s - I2S write failed: %d", __func__, write_ret);
-            }
-            
-            vRingbufferReturnItem(s_i2s_hfp_tx_ringbuf, (void *)data);
-        } else {
-            for (int i = 0; i < 4; i++) {
-                if (!s_bt_i2s_hfp_tx_task_running || s_i2s_tx_mode != I2S_TX_MODE_HFP) {
-                    ESP_LOGI(BT_I2S_TAG, "%s - exiting (prefetch interrupted)", __func__);
-                    goto exit_task;
-                }
-                vTaskDelay(pdMS_TO_TICKS(10));
-            }
-        }
-    }
-    
-exit_task:
-    ESP_LOGI(BT_I2S_TAG, "%s - task exiting, giving delete semaphore", __func__);
-    xSemaphoreGive(s_i2s_hfp_tx_ringbuf_delete);
-    vTaskDelete(NULL);
-}
-
 /**
  * @brief HFP RX task - reads microphone data from I2S and encodes to ringbuffer
  */
 static void bt_i2s_hfp_rx_task_handler(void *arg) {
-    int32_t *i2s_buffer = malloc(MSBC_FRAME_SAMPLES * sizeof(int32_t));
+    // Two microphones deliver interleaved pairs; the front end leaves one word per frame
+    int32_t *i2s_buffer = malloc(MSBC_FRAME_SAMPLES * sizeof(int32_t) * hfp_mic_channels());
     uint8_t *pcm_buffer = malloc(MSBC_FRAME_SAMPLES * 2);
-    uint8_t *encoded_buffer = malloc(ESP_HF_MSBC_ENCODED_FRAME_SIZE);
+    uint8_t *encoded_buffer = malloc(MSBC_ENCODED_SIZE);
+    // Narrowband calls send the PCM as is
+    bool encode = (s_hfp_codec == BT_I2S_HFP_CODEC_MSBC);
+    codec_ctx_t *encoder = encode ? msbc_enc_create() : NULL;
     
-    if (!i2s_buffer || !pcm_buffer || !encoded_buffer) {
+    if (!i2s_buffer || !pcm_buffer || !encoded_buffer || (encode && !encoder)) {
         ESP_LOGE(BT_I2S_TAG, "Failed to allocate buffers");
         if (i2s_buffer) free(i2s_buffer);
         if (pcm_buffer) free(pcm_buffer);
         if (encoded_buffer) free(encoded_buffer);
+        codec_destroy(encoder);
         xSemaphoreGive(s_i2s_hfp_rx_ringbuf_delete);
         vTaskDelete(NULL);
         return;
     }
     
+    bt_i2s_hfp_prepare_uplink_cn(encoder, (int16_t *)pcm_buffer, encoded_buffer);
+    
     size_t bytes_read;
+    const size_t mic_frame_bytes = hfp_mic_sample_bytes() * hfp_mic_channels();
     
     while (s_bt_i2s_hfp_rx_task_running) {
         esp_err_t ret = i2s_channel_read(rx_chan, i2s_buffer,
-                                           MSBC_FRAME_SAMPLES * sizeof(int32_t),
+                                           MSBC_FRAME_SAMPLES * mic_frame_bytes,
                                            &bytes_read, portMAX_DELAY);
         
         if (ret != ESP_OK || bytes_read == 0) {
@@ -1184,22 +2301,55 @@ static void bt_i2s_hfp_rx_task_handler(void *arg) {
             continue;
         }
         
+        // Whatever the microphone format (or pair), continue with left-justified 32-bit words
+        hfp_mic_convert(i2s_buffer, MSBC_FRAME_SAMPLES);
+        
+#if CONFIG_A2DPSINK_HFPHF_AGC
+        // Convert with the AGC's headroom shift, so a quiet talker keeps its low-order bits
+        hfp_agc_convert(i2s_buffer, (int16_t *)pcm_buffer, MSBC_FRAME_SAMPLES);
+        const int input_shift = hfp_agc_input_shift();
+#else
         // Convert I2S 32-bit to 16-bit PCM
         i2s_32bit_to_16bit_pcm(i2s_buffer, pcm_buffer, MSBC_FRAME_SAMPLES);
+        const int input_shift = 0;
+#endif
+        (void)input_shift;
+        
+#if CONFIG_A2DPSINK_HFPHF_AEC
+        // Remove the speaker echo while the signal is still linear (before the AGC's
+        // varying gain); a step of the shift rescales the filter with it
+        hfp_aec_set_input_shift(input_shift);
+        hfp_aec_process((int16_t *)pcm_buffer, MSBC_FRAME_SAMPLES);
+#endif
+#if CONFIG_A2DPSINK_HFPHF_NS
+        // After echo removal, so the residual echo does not count as noise
+        hfp_ns_set_input_shift(input_shift);
+        hfp_ns_process((int16_t *)pcm_buffer, MSBC_FRAME_SAMPLES);
+#endif
+#if CONFIG_A2DPSINK_HFPHF_AGC
+        // Level the talker last, so its gain changes never reach the echo path
+        hfp_agc_process((int16_t *)pcm_buffer, MSBC_FRAME_SAMPLES);
+#endif
         
         // Apply microphone volume AFTER conversion, BEFORE encoding
         apply_volume_scaling((int16_t *)pcm_buffer, 
                             MSBC_FRAME_SAMPLES,
                             s_hfp_mic_volume);
         
+        if (!encode) {
+            bt_i2s_hfp_write_rx_ringbuf(pcm_buffer, MSBC_FRAME_SAMPLES * 2);
+            continue;
+        }
+        
         // Encode the PCM data
         size_t encoded_len;
-        if (msbc_enc_data(pcm_buffer, MSBC_FRAME_SAMPLES * 2,
-                          encoded_buffer, &encoded_len) == 0) {
+        if (codec_process(encoder, pcm_buffer, MSBC_FRAME_SAMPLES * 2,
+                          encoded_buffer, MSBC_ENCODED_SIZE, &encoded_len, NULL) == 0) {
             bt_i2s_hfp_write_rx_ringbuf(encoded_buffer, ESP_HF_MSBC_ENCODED_FRAME_SIZE);
         }
     }
     
+    codec_destroy(encoder);
     free(i2s_buffer);
     free(pcm_buffer);
     free(encoded_buffer);
@@ -1209,6 +2359,128 @@ static void bt_i2s_hfp_rx_task_handler(void *arg) {
     vTaskDelete(NULL);
 }
 
+/**
+ * @brief Build the uplink comfort noise frame (about -65 dBFS white noise)
+ *
+ * Encoded once per call with the RX task's encoder; narrowband calls send it as
+ * PCM. Until it is ready, fill frames are silence.
+ */
+static void bt_i2s_hfp_prepare_uplink_cn(codec_ctx_t *encoder, int16_t *pcm, uint8_t *encoded) {
+    uint32_t seed = 0x2545F491;
+    for (int i = 0; i < MSBC_FRAME_SAMPLES; i++) {
+        seed = seed * 1664525 + 1013904223;
+        pcm[i] = (int16_t)(((int32_t)(seed >> 25) - 64) / 2);
+    }
+    
+    if (encoder == NULL) {
+        memcpy(s_hfp_uplink_cn, pcm, sizeof(s_hfp_uplink_cn));
+        s_hfp_uplink_cn_ready = true;
+        return;
+    }
+    size_t encoded_len = 0;
+    if (codec_process(encoder, (const uint8_t *)pcm, MSBC_FRAME_SAMPLES * 2,
+                      encoded, MSBC_ENCODED_SIZE, &encoded_len, NULL) == 0 &&
+        encoded_len >= ESP_HF_MSBC_ENCODED_FRAME_SIZE) {
+        memcpy(s_hfp_uplink_cn, encoded, ESP_HF_MSBC_ENCODED_FRAME_SIZE);
+        s_hfp_uplink_cn_ready = true;
+    }
+}
+
+/**
+ * @brief Queue one frame of concealment audio in place of a bad or missing frame
+ *
+ * mSBC uses the decoder's PLC. Narrowband PCM has no decoder, so the last frame
+ * is repeated at half the level each time, fading out over a longer gap. Falls
+ * back to a frame of silence if the decoder can't conceal (e.g. no frame
+ * decoded yet), so the speaker source is fed on schedule either way.
+ */
+static void bt_i2s_hfp_conceal_frame(const uint8_t *frame, size_t frame_len) {
+    size_t pcm_len = 0;
+    if (s_hfp_codec == BT_I2S_HFP_CODEC_CVSD) {
+        for (size_t i = 0; i < s_hfp_cvsd_frame_bytes / 2; i++) {
+            s_hfp_pcm_frame[i] /= 2;
+        }
+        pcm_len = s_hfp_cvsd_frame_bytes;
+    } else if (s_hfp_msbc_dec == NULL ||
+        codec_conceal(s_hfp_msbc_dec, frame, frame_len, (uint8_t *)s_hfp_pcm_frame,
+                      sizeof(s_hfp_pcm_frame), &pcm_len) != 0 ||
+        pcm_len == 0) {
+        memset(s_hfp_pcm_frame, 0, sizeof(s_hfp_pcm_frame));
+        pcm_len = sizeof(s_hfp_pcm_frame);
+    }
+    bt_i2s_hfp_write_tx_ringbuf((const uint8_t *)s_hfp_pcm_frame, pcm_len);
+    s_hfp_call_concealed++;
+    s_stats.hfp_concealed_frames++;
+}
+
+/**
+ * @brief HFP decode task - decodes received mSBC frames and feeds the speaker mixer source
+ */
+static void bt_i2s_hfp_dec_task_handler(void *arg) {
+    int64_t last_frame_us = 0;  // 0 until the first frame, nothing to conceal before that
+    uint32_t gap_frames = 0;    // frames synthesized since the last one received
+    
+    while (s_bt_i2s_hfp_dec_task_running) {
+        // Woken by bt_i2s_hfp_write_tx_frame() for every queued frame, and for stop.
+        // While a gap may still need concealing, wait only about two frame times, so
+        // a missing frame is noticed while it is still due; otherwise sleep until woken
+        TickType_t wait = (last_frame_us == 0 || gap_frames >= HFP_PLC_MAX_GAP_FRAMES) ?
+                          portMAX_DELAY : pdMS_TO_TICKS(2 * s_hfp_frame_us / 1000);
+        if (ulTaskNotifyTake(pdTRUE, wait) == 0) {
+            s_hfp_call_dec_timeouts++;
+            s_stats.hfp_dec_timeout_wakeups++;
+        }
+        s_hfp_call_dec_wakeups++;
+        s_stats.hfp_dec_wakeups++;
+        
+        size_t item_len = 0;
+        uint8_t *item;
+        bool received = false;
+        while (s_bt_i2s_hfp_dec_task_running &&
+               (item = xRingbufferReceive(s_hfp_frame_queue, &item_len, 0)) != NULL) {
+            received = true;
+            last_frame_us = esp_timer_get_time();
+            gap_frames = 0;
+            
+            const uint8_t *frame = &item[1];
+            size_t frame_len = item_len - 1;
+            size_t pcm_len = 0;
+            if (item[0] == HFP_FRAME_BAD) {
+                bt_i2s_hfp_conceal_frame(frame, frame_len);
+            } else if (s_hfp_codec == BT_I2S_HFP_CODEC_CVSD) {
+                // Already linear PCM; keep a copy as the concealment history
+                if (frame_len > sizeof(s_hfp_pcm_frame)) {
+                    frame_len = sizeof(s_hfp_pcm_frame);
+                }
+                memcpy(s_hfp_pcm_frame, frame, frame_len);
+                bt_i2s_hfp_write_tx_ringbuf(frame, frame_len);
+            } else if (s_hfp_msbc_dec != NULL &&
+                       codec_process(s_hfp_msbc_dec, frame, frame_len, (uint8_t *)s_hfp_pcm_frame,
+                                     sizeof(s_hfp_pcm_frame), &pcm_len, NULL) == 0 &&
+                       pcm_len > 0) {
+                bt_i2s_hfp_write_tx_ringbuf((const uint8_t *)s_hfp_pcm_frame, pcm_len);
+            } else {
+                // Reported good but undecodable (CRC or sync error)
+                bt_i2s_hfp_conceal_frame(frame, frame_len);
+            }
+            vRingbufferReturnItem(s_hfp_frame_queue, item);
+        }
+        
+        if (!received && last_frame_us != 0) {
+            // Conceal every frame that is more than a frame late, up to the gap limit
+            uint32_t due = (uint32_t)((esp_timer_get_time() - last_frame_us) / s_hfp_frame_us);
+            while (due > gap_frames + 1 && gap_frames < HFP_PLC_MAX_GAP_FRAMES) {
+                bt_i2s_hfp_conceal_frame(NULL, 0);
+                gap_frames++;
+            }
+        }
+    }
+    
+    xSemaphoreGive(s_hfp_dec_task_exit_sem);
+    ESP_LOGI(BT_I2S_TAG, "%s, deleting myself", __func__);
+    vTaskDelete(NULL);
+}
+
 /**
  * @brief Write encoded HFP audio data to RX ringbuffer (internal)
  */
@@ -1224,7 +2496,7 @@ static void bt_i2s_hfp_write_rx_ringbuf(unsigned char *data, uint32_t size) {
     
     if (s_i2s_hfp_rx_ringbuffer_mode == RINGBUFFER_MODE_DROPPING) {
         vRingbufferGetInfo(s_i2s_hfp_rx_ringbuf, NULL, NULL, NULL, NULL, &item_size);
-        if (item_size <= RINGBUF_HFP_RX_HIGHEST_WATER_LEVEL) {
+        if (item_size <= s_hfp_rx_ringbuf_size) {
             s_i2s_hfp_rx_ringbuffer_mode = RINGBUFFER_MODE_PROCESSING;
         }
         i2s_hfp_rx_ringbuffer_dropped += 1;
@@ -1242,7 +2514,7 @@ static void bt_i2s_hfp_write_rx_ringbuf(unsigned char *data, uint32_t size) {
     
     if (s_i2s_hfp_rx_ringbuffer_mode == RINGBUFFER_MODE_PREFETCHING) {
         vRingbufferGetInfo(s_i2s_hfp_rx_ringbuf, NULL, NULL, NULL, NULL, &item_size);
-        if (item_size >= RINGBUF_HFP_RX_PREFETCH_WATER_LEVEL) {
+        if (item_size >= s_hfp_mic_prefetch_bytes) {
             s_i2s_hfp_rx_ringbuffer_mode = RINGBUFFER_MODE_PROCESSING;
         }
     }
@@ -1279,6 +2551,67 @@ bool bt_i2s_is_a2dp_mode(void) {
     return (s_i2s_tx_mode == I2S_TX_MODE_A2DP);
 }
 
+/**
+ * @brief Get audio pipeline statistics
+ */
+void bt_i2s_get_stats(bt_i2s_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    *stats = s_stats;
+    if (s_stats.hfp_frames > 0) {
+        stats->hfp_cb_avg_us = (uint32_t)(s_hfp_cb_total_us / s_stats.hfp_frames);
+    }
+    
+    /* Include the time spent in the current PM state so far */
+    uint64_t current_us = (uint64_t)(esp_timer_get_time() - s_pm_state_since_us);
+    if (s_pm_active) {
+        stats->pm_active_us += current_us;
+    } else {
+        stats->pm_idle_us += current_us;
+    }
+}
+
+/**
+ * @brief Keep the TX channel running for a local source (ringtone, prompts)
+ */
+void bt_i2s_output_acquire(void) {
+    xSemaphoreTake(s_i2s_mode_mutex, portMAX_DELAY);
+    s_output_refs++;
+    bt_i2s_tx_channel_enable();
+    xSemaphoreGive(s_i2s_mode_mutex);
+}
+
+/**
+ * @brief Drop a bt_i2s_output_acquire() reference
+ */
+void bt_i2s_output_release(void) {
+    xSemaphoreTake(s_i2s_mode_mutex, portMAX_DELAY);
+    if (s_output_refs > 0) {
+        s_output_refs--;
+    }
+    if (s_output_refs == 0 &&
+        (s_i2s_tx_mode == I2S_TX_MODE_NONE || (s_i2s_tx_mode == I2S_TX_MODE_A2DP && s_a2dp_output_idle))) {
+        bt_i2s_tx_channel_disable();
+    }
+    xSemaphoreGive(s_i2s_mode_mutex);
+}
+
+/**
+ * @brief Set the A2DP output channel mode, applied from the next stream start
+ */
+void bt_i2s_set_output_channels(bt_i2s_output_channels_t mode) {
+    s_output_channels = mode;
+    ESP_LOGI(BT_I2S_TAG, "Output channel mode %d set (applies from the next A2DP start)", mode);
+}
+
+/**
+ * @brief Register a callback for TX output enable/disable
+ */
+void bt_i2s_register_output_state_cb(bt_i2s_output_state_cb_t callback) {
+    s_output_state_cb = callback;
+}
+
 /**
  * @brief Get TX I2S channel handle
  */
@@ -1347,6 +2680,7 @@ void bt_i2s_set_a2dp_volume(uint8_t volume)
         volume = 15;
     }
     s_a2dp_volume = volume;
+    audio_mixer_source_set_gain(s_a2dp_source, s_volume_table[volume]);
     ESP_LOGI(BT_I2S_TAG, "A2DP volume set to %d", volume);
 }
 
@@ -1359,6 +2693,7 @@ void bt_i2s_set_hfp_speaker_volume(uint8_t volume)
         volume = 15;
     }
     s_hfp_speaker_volume = volume;
+    audio_mixer_source_set_gain(s_hfp_source, s_volume_table[volume]);
     ESP_LOGI(BT_I2S_TAG, "HFP speaker volume set to %d", volume);
 }
 
@@ -1,9 +1,12 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
 #include "codec.h"
 #include "esp_log.h"
 #include "esp_sbc_enc.h"
 #include "esp_sbc_dec.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
+#include "esp_aac_dec.h"
 
 static const char *TAG = "CODEC";
 
@@ -13,114 +16,213 @@ static const char *TAG = "CODEC";
 #define MSBC_BITS_PER_SAMPLE 16
 #define MSBC_FRAME_SIZE_BYTES (MSBC_FRAME_SAMPLES * 2)  // 240 bytes
 
-// Static handles for encoder and decoder
-static void *encoder_handle = NULL;
-static void *decoder_handle = NULL;
-static void *a2dp_decoder_handle = NULL;
-
-// Encoder serialization mutex (thread-safe access)
-static SemaphoreHandle_t s_encoder_mutex = NULL;
-
-int msbc_enc_open(void)
+// Stand-in input for concealing a frame that never arrived; with PLC requested
+// the SBC decoder synthesizes the frame from its history and ignores the content
+#define PLC_PLACEHOLDER_BYTES 57
+static const uint8_t s_plc_placeholder[PLC_PLACEHOLDER_BYTES];
+
+typedef enum {
+    CODEC_KIND_MSBC_ENC,
+    CODEC_KIND_MSBC_DEC,
+    CODEC_KIND_SBC_DEC,
+    CODEC_KIND_AAC_DEC,
+} codec_kind_t;
+
+// LATM demux state (A2DP AAC is carried as LATM AudioMuxElements, muxConfigPresent = 1)
+typedef struct {
+    const uint8_t *buf;
+    size_t len_bits;
+    size_t pos;
+} latm_bits_t;
+
+typedef struct {
+    bool config_valid;           // a StreamMuxConfig has been parsed
+    uint8_t audio_mux_version;
+    uint8_t frame_length_type;
+    uint32_t other_data_len_bits;
+} latm_state_t;
+
+struct codec_ctx {
+    codec_kind_t kind;
+    codec_cfg_t cfg;
+    void *handle;                // esp_audio_codec encoder/decoder handle
+    latm_state_t latm;           // AAC only
+};
+
+static const char *codec_kind_name(codec_kind_t kind)
 {
-    if (encoder_handle != NULL) {
-        ESP_LOGW(TAG, "Encoder already open");
-        return 0;
+    switch (kind) {
+    case CODEC_KIND_MSBC_ENC: return "mSBC encoder";
+    case CODEC_KIND_MSBC_DEC: return "mSBC decoder";
+    case CODEC_KIND_SBC_DEC:  return "A2DP SBC decoder";
+    case CODEC_KIND_AAC_DEC:  return "A2DP AAC decoder";
     }
+    return "codec";
+}
 
-    // Create mutex once for thread-safe encoder access
-    if (s_encoder_mutex == NULL) {
-        s_encoder_mutex = xSemaphoreCreateMutex();
-        if (s_encoder_mutex == NULL) {
-            ESP_LOGE(TAG, "Failed to create encoder mutex");
-            return -1;
-        }
-    }
+/**
+ * @brief Open the underlying esp_audio_codec instance for ctx->kind / ctx->cfg
+ */
+static int codec_open_handle(codec_ctx_t *ctx)
+{
+    int ret = -1;
+    ctx->handle = NULL;
 
+    switch (ctx->kind) {
+    case CODEC_KIND_MSBC_ENC: {
 #ifdef ESP_SBC_MSBC_ENC_CONFIG_DEFAULT
-    esp_sbc_enc_config_t enc_cfg = ESP_SBC_MSBC_ENC_CONFIG_DEFAULT();
+        esp_sbc_enc_config_t enc_cfg = ESP_SBC_MSBC_ENC_CONFIG_DEFAULT();
 #else
-    esp_sbc_enc_config_t enc_cfg = {
-        .sbc_mode = ESP_SBC_MODE_MSBC,
-        .allocation_method = ESP_SBC_AM_LOUDNESS,
-        .ch_mode = ESP_SBC_CH_MODE_MONO,
-        .sample_rate = MSBC_SAMPLE_RATE,
-        .bits_per_sample = MSBC_BITS_PER_SAMPLE,
-        .bitpool = 26,
-        .block_length = 15,
-        .sub_bands_num = 8,
-    };
+        esp_sbc_enc_config_t enc_cfg = {
+            .sbc_mode = ESP_SBC_MODE_MSBC,
+            .allocation_method = ESP_SBC_AM_LOUDNESS,
+            .ch_mode = ESP_SBC_CH_MODE_MONO,
+            .sample_rate = MSBC_SAMPLE_RATE,
+            .bits_per_sample = MSBC_BITS_PER_SAMPLE,
+            .bitpool = 26,
+            .block_length = 15,
+            .sub_bands_num = 8,
+        };
 #endif
+        ret = esp_sbc_enc_open(&enc_cfg, sizeof(esp_sbc_enc_config_t), &ctx->handle);
+        break;
+    }
+    case CODEC_KIND_MSBC_DEC:
+    case CODEC_KIND_SBC_DEC: {
+        /* A2DP uses standard SBC, HFP wideband speech uses mSBC */
+        esp_sbc_dec_cfg_t dec_cfg = {
+            .sbc_mode = (ctx->kind == CODEC_KIND_MSBC_DEC) ? ESP_SBC_MODE_MSBC : ESP_SBC_MODE_STD,
+            .ch_num = ctx->cfg.channels,
+            .enable_plc = 1,
+        };
+        ret = esp_sbc_dec_open(&dec_cfg, sizeof(esp_sbc_dec_cfg_t), &ctx->handle);
+        break;
+    }
+    case CODEC_KIND_AAC_DEC: {
+        esp_aac_dec_cfg_t dec_cfg = {
+            .sample_rate = ctx->cfg.sample_rate,
+            .channel = ctx->cfg.channels,
+            .bits_per_sample = 16,
+            .no_adts_header = true,    // LATM is stripped here, decoder gets raw access units
+            .aac_plus_enable = false,  // A2DP sources send AAC-LC
+        };
+        ret = esp_aac_dec_open(&dec_cfg, sizeof(esp_aac_dec_cfg_t), &ctx->handle);
+        memset(&ctx->latm, 0, sizeof(ctx->latm));
+        break;
+    }
+    }
 
-    int ret = esp_sbc_enc_open(&enc_cfg, sizeof(esp_sbc_enc_config_t), &encoder_handle);
-    if (ret != 0 || encoder_handle == NULL) {
-        ESP_LOGE(TAG, "Failed to open mSBC encoder, error: %d", ret);
-        encoder_handle = NULL;
+    if (ret != 0 || ctx->handle == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s, error: %d", codec_kind_name(ctx->kind), ret);
+        ctx->handle = NULL;
         return -1;
     }
-
-    ESP_LOGI(TAG, "mSBC encoder opened successfully");
     return 0;
 }
 
-void msbc_enc_close(void)
+static void codec_close_handle(codec_ctx_t *ctx)
 {
-    if (encoder_handle != NULL) {
-        esp_sbc_enc_close(encoder_handle);
-        encoder_handle = NULL;
-        ESP_LOGI(TAG, "mSBC encoder closed");
+    if (ctx->handle == NULL) {
+        return;
+    }
+
+    switch (ctx->kind) {
+    case CODEC_KIND_MSBC_ENC:
+        esp_sbc_enc_close(ctx->handle);
+        break;
+    case CODEC_KIND_MSBC_DEC:
+    case CODEC_KIND_SBC_DEC:
+        esp_sbc_dec_close(ctx->handle);
+        break;
+    case CODEC_KIND_AAC_DEC:
+        esp_aac_dec_close(ctx->handle);
+        break;
     }
+    ctx->handle = NULL;
 }
 
-int msbc_dec_open(void)
+static codec_ctx_t *codec_create(codec_kind_t kind, int sample_rate, int channels)
 {
-    if (decoder_handle != NULL) {
-        ESP_LOGW(TAG, "Decoder already open");
-        return 0;
+    codec_ctx_t *ctx = calloc(1, sizeof(codec_ctx_t));
+    if (ctx == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %s context", codec_kind_name(kind));
+        return NULL;
     }
 
-    esp_sbc_dec_cfg_t dec_cfg = {
-        .sbc_mode = ESP_SBC_MODE_MSBC,
-        .ch_num = MSBC_CHANNELS,
-        .enable_plc = 1,
-    };
-
-    ESP_LOGI(TAG, "Opening decoder with: mode=%d, ch_num=%d, plc=%d",
-            dec_cfg.sbc_mode, dec_cfg.ch_num, dec_cfg.enable_plc);
+    ctx->kind = kind;
+    ctx->cfg.sample_rate = sample_rate;
+    ctx->cfg.channels = channels;
 
-    int ret = esp_sbc_dec_open(&dec_cfg, sizeof(esp_sbc_dec_cfg_t), &decoder_handle);
-    if (ret != 0 || decoder_handle == NULL) {
-        ESP_LOGE(TAG, "Failed to open mSBC decoder, error: %d", ret);
-        decoder_handle = NULL;
-        return -1;
+    if (codec_open_handle(ctx) != 0) {
+        free(ctx);
+        return NULL;
     }
 
-    ESP_LOGI(TAG, "mSBC decoder opened successfully");
-    return 0;
+    ESP_LOGI(TAG, "%s created (sr=%d, ch=%d)", codec_kind_name(kind), sample_rate, channels);
+    return ctx;
+}
+
+codec_ctx_t *msbc_enc_create(void)
+{
+    return codec_create(CODEC_KIND_MSBC_ENC, MSBC_SAMPLE_RATE, MSBC_CHANNELS);
+}
+
+codec_ctx_t *msbc_dec_create(void)
+{
+    return codec_create(CODEC_KIND_MSBC_DEC, MSBC_SAMPLE_RATE, MSBC_CHANNELS);
 }
 
-void msbc_dec_close(void)
+codec_ctx_t *sbc_dec_create(const codec_cfg_t *cfg)
 {
-    if (decoder_handle != NULL) {
-        esp_sbc_dec_close(decoder_handle);
-        decoder_handle = NULL;
-        ESP_LOGI(TAG, "mSBC decoder closed");
+    if (cfg == NULL) {
+        return NULL;
     }
+    return codec_create(CODEC_KIND_SBC_DEC, cfg->sample_rate, cfg->channels);
 }
 
-int msbc_enc_data(const uint8_t *in_data, size_t in_data_len, 
-                  uint8_t *out_data, size_t *out_data_len)
+codec_ctx_t *aac_dec_create(const codec_cfg_t *cfg)
 {
-    if (in_data == NULL || out_data == NULL || out_data_len == NULL) {
-        ESP_LOGE(TAG, "Invalid parameters for encoding");
+    if (cfg == NULL) {
+        return NULL;
+    }
+    return codec_create(CODEC_KIND_AAC_DEC, cfg->sample_rate, cfg->channels);
+}
+
+int codec_reset(codec_ctx_t *ctx)
+{
+    if (ctx == NULL) {
         return -1;
     }
 
-    if (encoder_handle == NULL) {
-        ESP_LOGW(TAG, "Encoder not initialized. Call msbc_enc_open() first. This is expected behaviour during shutdown though.");
+    /* esp_audio_codec has no per-codec reset entry point; reopening the handle
+       inside the same context is equivalent and keeps the caller's pointer valid */
+    codec_close_handle(ctx);
+    if (codec_open_handle(ctx) != 0) {
         return -1;
     }
 
+    ESP_LOGD(TAG, "%s reset", codec_kind_name(ctx->kind));
+    return 0;
+}
+
+void codec_destroy(codec_ctx_t *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    codec_close_handle(ctx);
+    ESP_LOGI(TAG, "%s destroyed", codec_kind_name(ctx->kind));
+    free(ctx);
+}
+
+// ============================================================================
+// SBC / mSBC
+// ============================================================================
+
+static int msbc_encode(codec_ctx_t *ctx, const uint8_t *in_data, size_t in_data_len,
+                       uint8_t *out_data, size_t out_size, size_t *out_data_len)
+{
     if (in_data_len != MSBC_FRAME_SIZE_BYTES) {
         ESP_LOGW(TAG, "Input data length %zu is not optimal for mSBC (expected %d)", 
                  in_data_len, MSBC_FRAME_SIZE_BYTES);
@@ -135,149 +237,335 @@ int msbc_enc_data(const uint8_t *in_data, size_t in_data_len,
     // Prepare output frame with sufficient buffer size
     esp_audio_enc_out_frame_t out_frame = {
         .buffer = out_data,
-        .len = MSBC_ENCODED_SIZE,  // Maximum buffer size (input to encoder)
+        .len = out_size,            // Maximum buffer size (input to encoder)
         .encoded_bytes = 0,         // Will be filled by encoder (output from encoder)
     };
 
     // Encode the data
-    int ret = esp_sbc_enc_process(encoder_handle, &in_frame, &out_frame);
+    int ret = esp_sbc_enc_process(ctx->handle, &in_frame, &out_frame);
     
     if (ret != 0) {
         ESP_LOGE(TAG, "Encoding failed, error: %d", ret);
         return -1;
     }
 
-    // *** THE FIX: Use encoded_bytes, not len ***
-    *out_data_len = out_frame.encoded_bytes;  // Changed from out_frame.len
+    *out_data_len = out_frame.encoded_bytes;
     ESP_LOGD(TAG, "Encoded %zu bytes to %d bytes", in_data_len, out_frame.encoded_bytes);
     return 0;
 }
 
-int msbc_dec_data(const uint8_t *in_data, size_t in_data_len,
-                  uint8_t *out_data, size_t *out_data_len)
+/**
+ * @brief Decode one SBC/mSBC frame and return bytes consumed + output length
+ * Call this function repeatedly until all data is consumed
+ */
+static int sbc_decode(codec_ctx_t *ctx, const uint8_t *in_data, size_t in_data_len,
+                      uint8_t *out_data, size_t out_size, size_t *out_data_len,
+                      size_t *in_bytes_consumed, esp_audio_dec_recovery_t recover)
 {
-    if (in_data == NULL || out_data == NULL || out_data_len == NULL) {
-        ESP_LOGE(TAG, "Invalid parameters for decoding");
-        return -1;
-    }
-
-    if (decoder_handle == NULL) {
-        ESP_LOGW(TAG, "Decoder not initialized. Call msbc_dec_open() first.");
-        return -1;
-    }
-
-    // Prepare input frame
     esp_audio_dec_in_raw_t in_frame = {
         .buffer = (uint8_t *)in_data,
         .len = in_data_len,
+        .consumed = 0,
+        .frame_recover = recover,
     };
 
-    // Prepare output frame
     esp_audio_dec_out_frame_t out_frame = {
         .buffer = out_data,
-        .len = MSBC_FRAME_SIZE_BYTES * 2,
+        .len = out_size,
         .decoded_size = 0,
     };
 
-    // Prepare info structure
     esp_audio_dec_info_t dec_info = {0};
 
-    // Decode the data
-    int ret = esp_sbc_dec_decode(decoder_handle, &in_frame, &out_frame, &dec_info);
+    int ret = esp_sbc_dec_decode(ctx->handle, &in_frame, &out_frame, &dec_info);
+    
+    *out_data_len = out_frame.decoded_size;
+    *in_bytes_consumed = in_frame.consumed;
+    
+    /* -3 = data lack, -1 = sync fail: both normal on A2DP streams, caller decides */
+    return ret;
+}
+
+// ============================================================================
+// A2DP AAC (LATM)
+// ============================================================================
 
-    if (ret != 0) {
-        ESP_LOGE(TAG, "Decoding failed, error: %d", ret);
-        return -1;
+static uint32_t latm_read(latm_bits_t *bs, int n)
+{
+    uint32_t v = 0;
+    while (n-- > 0) {
+        if (bs->pos >= bs->len_bits) {
+            bs->pos++;  // keep counting so callers can detect overrun
+            v <<= 1;
+            continue;
+        }
+        v = (v << 1) | ((bs->buf[bs->pos >> 3] >> (7 - (bs->pos & 7))) & 1);
+        bs->pos++;
     }
-
-    *out_data_len = out_frame.decoded_size;
-    ESP_LOGD(TAG, "Decoded %zu bytes to %d bytes", in_data_len, out_frame.decoded_size);
-    return 0;
+    return v;
 }
 
-int a2dp_sbc_dec_open(int sample_rate, int channels)
+static uint32_t latm_get_value(latm_bits_t *bs)
 {
-    if (a2dp_decoder_handle != NULL) {
-        ESP_LOGW(TAG, "A2DP decoder already open");
-        return 0;
+    int bytes_for_value = latm_read(bs, 2);
+    uint32_t value = 0;
+    for (int i = 0; i <= bytes_for_value; i++) {
+        value = (value << 8) | latm_read(bs, 8);
     }
+    return value;
+}
 
-    /* A2DP uses standard SBC, not mSBC */
-    esp_sbc_dec_cfg_t dec_cfg = {
-        .sbc_mode = ESP_SBC_MODE_STD,
-        .ch_num = channels,
-        .enable_plc = 1,
-    };
+/**
+ * @brief Skip an AudioSpecificConfig (ISO/IEC 14496-3 1.6.2.1)
+ *
+ * Only the GA-specific part used by AAC-LC/SBR streams is understood; the decoder
+ * itself is configured from the A2DP capability exchange, not from the ASC.
+ */
+static int latm_skip_audio_specific_config(latm_bits_t *bs)
+{
+    uint32_t aot = latm_read(bs, 5);
+    if (aot == 31) {
+        aot = 32 + latm_read(bs, 6);
+    }
+    if (latm_read(bs, 4) == 0x0f) {
+        latm_read(bs, 24);
+    }
+    uint32_t ch_cfg = latm_read(bs, 4);
+    if (aot == 5 || aot == 29) {
+        if (latm_read(bs, 4) == 0x0f) {
+            latm_read(bs, 24);
+        }
+        aot = latm_read(bs, 5);
+    }
 
-    int ret = esp_sbc_dec_open(&dec_cfg, sizeof(esp_sbc_dec_cfg_t), &a2dp_decoder_handle);
-    if (ret != 0 || a2dp_decoder_handle == NULL) {
-        ESP_LOGE(TAG, "Failed to open A2DP SBC decoder, error: %d", ret);
-        a2dp_decoder_handle = NULL;
+    if (aot != 1 && aot != 2 && aot != 3 && aot != 4 && aot != 6 && aot != 7) {
+        ESP_LOGW(TAG, "Unsupported AAC object type %" PRIu32 " in LATM config", aot);
+        return -1;
+    }
+    if (ch_cfg == 0) {
+        ESP_LOGW(TAG, "AAC program config element not supported");
         return -1;
     }
 
-    ESP_LOGI(TAG, "A2DP SBC decoder opened (sr=%d, ch=%d)", sample_rate, channels);
+    // GASpecificConfig
+    latm_read(bs, 1);                 // frameLengthFlag
+    if (latm_read(bs, 1)) {           // dependsOnCoreCoder
+        latm_read(bs, 14);            // coreCoderDelay
+    }
+    uint32_t extension_flag = latm_read(bs, 1);
+    if (aot == 6) {
+        latm_read(bs, 3);             // layerNr
+    }
+    if (extension_flag) {
+        latm_read(bs, 1);             // extensionFlag3
+    }
     return 0;
 }
 
-void a2dp_sbc_dec_close(void)
+static int latm_parse_stream_mux_config(latm_state_t *latm, latm_bits_t *bs)
 {
-    if (a2dp_decoder_handle != NULL) {
-        esp_sbc_dec_close(a2dp_decoder_handle);
-        a2dp_decoder_handle = NULL;
-        ESP_LOGI(TAG, "A2DP SBC decoder closed");
+    latm->audio_mux_version = latm_read(bs, 1);
+    if (latm->audio_mux_version == 1 && latm_read(bs, 1) != 0) {
+        ESP_LOGW(TAG, "LATM audioMuxVersionA != 0 not supported");
+        return -1;
+    }
+    if (latm->audio_mux_version == 1) {
+        latm_get_value(bs);           // taraBufferFullness
+    }
+
+    latm_read(bs, 1);                 // allStreamsSameTimeFraming
+    if (latm_read(bs, 6) != 0 ||      // numSubFrames
+        latm_read(bs, 4) != 0 ||      // numProgram
+        latm_read(bs, 3) != 0) {      // numLayer
+        ESP_LOGW(TAG, "Multi-program/multi-frame LATM not supported");
+        return -1;
+    }
+
+    if (latm->audio_mux_version == 0) {
+        if (latm_skip_audio_specific_config(bs) != 0) {
+            return -1;
+        }
+    } else {
+        uint32_t asc_len = latm_get_value(bs);
+        size_t asc_start = bs->pos;
+        if (latm_skip_audio_specific_config(bs) != 0) {
+            return -1;
+        }
+        bs->pos = asc_start + asc_len;  // skip fill bits / sync extension
     }
+
+    latm->frame_length_type = latm_read(bs, 3);
+    if (latm->frame_length_type != 0) {
+        ESP_LOGW(TAG, "LATM frameLengthType %d not supported", latm->frame_length_type);
+        return -1;
+    }
+    latm_read(bs, 8);                 // latmBufferFullness
+
+    latm->other_data_len_bits = 0;
+    if (latm_read(bs, 1)) {           // otherDataPresent
+        if (latm->audio_mux_version == 1) {
+            latm->other_data_len_bits = latm_get_value(bs);
+        } else {
+            uint32_t esc;
+            do {
+                latm->other_data_len_bits <<= 8;
+                esc = latm_read(bs, 1);
+                latm->other_data_len_bits += latm_read(bs, 8);
+            } while (esc);
+        }
+    }
+    if (latm_read(bs, 1)) {           // crcCheckPresent
+        latm_read(bs, 8);
+    }
+
+    latm->config_valid = true;
+    return 0;
 }
 
 /**
- * @brief Decode SBC and return bytes consumed + output length
- * Call this function repeatedly until all data is consumed
+ * @brief Extract the raw AAC access unit from one LATM AudioMuxElement
+ *
+ * The payload is usually not byte aligned, so it is copied bitwise into au_buf.
+ *
+ * @return Access unit length in bytes, or -1 on parse error
  */
-int a2dp_sbc_dec_data(const uint8_t *in_data, size_t in_data_len,
-                      uint8_t *out_data, size_t *out_data_len,
-                      size_t *in_bytes_consumed)
+static int latm_extract_access_unit(latm_state_t *latm, const uint8_t *in, size_t in_len, uint8_t *au_buf, size_t au_buf_size)
 {
-    if (in_data == NULL || out_data == NULL || out_data_len == NULL || in_bytes_consumed == NULL) {
-        ESP_LOGE(TAG, "Invalid parameters");
+    latm_bits_t bs = {
+        .buf = in,
+        .len_bits = in_len * 8,
+        .pos = 0,
+    };
+
+    if (!latm_read(&bs, 1)) {         // useSameStreamMux
+        if (latm_parse_stream_mux_config(latm, &bs) != 0) {
+            latm->config_valid = false;
+            return -1;
+        }
+    } else if (!latm->config_valid) {
+        return -1;                    // wait for the first in-band config
+    }
+
+    // PayloadLengthInfo
+    size_t au_len = 0;
+    uint32_t tmp;
+    do {
+        tmp = latm_read(&bs, 8);
+        au_len += tmp;
+    } while (tmp == 255);
+
+    if (au_len > au_buf_size || bs.pos + au_len * 8 > bs.len_bits) {
+        ESP_LOGW(TAG, "LATM payload length %zu invalid (packet %zu bytes)", au_len, in_len);
         return -1;
     }
 
-    if (a2dp_decoder_handle == NULL) {
-        ESP_LOGW(TAG, "A2DP decoder not initialized");
+    // PayloadMux
+    if ((bs.pos & 7) == 0) {
+        memcpy(au_buf, &in[bs.pos >> 3], au_len);
+    } else {
+        for (size_t i = 0; i < au_len; i++) {
+            au_buf[i] = (uint8_t)latm_read(&bs, 8);
+        }
+    }
+    return (int)au_len;
+}
+
+static int aac_decode(codec_ctx_t *ctx, const uint8_t *in_data, size_t in_data_len,
+                      uint8_t *out_data, size_t out_size, size_t *out_data_len)
+{
+    // An AAC-LC access unit never exceeds 6144 bits per channel
+    uint8_t au[1536];
+    int au_len = latm_extract_access_unit(&ctx->latm, in_data, in_data_len, au, sizeof(au));
+    if (au_len <= 0) {
         return -1;
     }
 
     esp_audio_dec_in_raw_t in_frame = {
-        .buffer = (uint8_t *)in_data,
-        .len = in_data_len,
+        .buffer = au,
+        .len = au_len,
         .consumed = 0,
         .frame_recover = ESP_AUDIO_DEC_RECOVERY_NONE,
     };
 
     esp_audio_dec_out_frame_t out_frame = {
         .buffer = out_data,
-        .len = 2048,
+        .len = out_size,
         .decoded_size = 0,
     };
 
-    /* ALLOCATE INFO STRUCTURE */
     esp_audio_dec_info_t dec_info = {0};
 
-    /* Pass valid pointer, not NULL */
-    int ret = esp_sbc_dec_decode(a2dp_decoder_handle, &in_frame, &out_frame, &dec_info);
-    
+    int ret = esp_aac_dec_decode(ctx->handle, &in_frame, &out_frame, &dec_info);
     *out_data_len = out_frame.decoded_size;
-    *in_bytes_consumed = in_frame.consumed;
-    
-    if (ret != 0) {
-        /* Only log real issues, not sync errors */
-        // if (ret != -3 && ret != -1) {  /* -3 = data lack, -1 = sync fail, both normal */
-        //     ESP_LOGE(TAG, "A2DP decoding failed: %d", ret);
-        // }
-        return ret;
+    return ret;
+}
+
+// ============================================================================
+// Dispatch
+// ============================================================================
+
+int codec_process(codec_ctx_t *ctx, const uint8_t *in, size_t in_len,
+                  uint8_t *out, size_t out_size, size_t *out_len, size_t *consumed)
+{
+    if (ctx == NULL || in == NULL || out == NULL || out_len == NULL) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return -1;
     }
 
-    return 0;
+    if (ctx->handle == NULL) {
+        ESP_LOGW(TAG, "%s not open", codec_kind_name(ctx->kind));
+        return -1;
+    }
+
+    size_t used = 0;
+    int ret;
+    *out_len = 0;
+
+    switch (ctx->kind) {
+    case CODEC_KIND_MSBC_ENC:
+        ret = msbc_encode(ctx, in, in_len, out, out_size, out_len);
+        used = (ret == 0) ? in_len : 0;
+        break;
+    case CODEC_KIND_MSBC_DEC:
+    case CODEC_KIND_SBC_DEC:
+        ret = sbc_decode(ctx, in, in_len, out, out_size, out_len, &used, ESP_AUDIO_DEC_RECOVERY_NONE);
+        break;
+    case CODEC_KIND_AAC_DEC:
+        ret = aac_decode(ctx, in, in_len, out, out_size, out_len);
+        used = in_len;
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+
+    if (consumed != NULL) {
+        *consumed = used;
+    }
+    return ret;
+}
+
+int codec_conceal(codec_ctx_t *ctx, const uint8_t *in, size_t in_len,
+                  uint8_t *out, size_t out_size, size_t *out_len)
+{
+    if (ctx == NULL || out == NULL || out_len == NULL) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return -1;
+    }
+    *out_len = 0;
+
+    if (ctx->handle == NULL ||
+        (ctx->kind != CODEC_KIND_MSBC_DEC && ctx->kind != CODEC_KIND_SBC_DEC)) {
+        return -1;
+    }
+
+    if (in == NULL || in_len == 0) {
+        in = s_plc_placeholder;
+        in_len = sizeof(s_plc_placeholder);
+    }
+
+    size_t used = 0;
+    return sbc_decode(ctx, in, in_len, out, out_size, out_len, &used, ESP_AUDIO_DEC_RECOVERY_PLC);
 }
 
 void i2s_32bit_to_16bit_pcm(const int32_t *i2s_data, uint8_t *pcm_data, size_t num_samples)
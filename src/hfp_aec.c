@@ -0,0 +1,268 @@
+/*
+ * hfp_aec.c - Acoustic echo canceller for the HFP microphone path
+ *
+ * Normalised LMS in fixed point. Weights are Q31 (filtered with their top 16
+ * bits), the reference history is kept twice in a row so the newest AEC_TAPS
+ * samples are always contiguous, and the normalisation energy is updated one
+ * sample at a time. Adaptation freezes while the near end talks (Geigel
+ * detector), so the filter does not diverge during double talk.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "hfp_aec.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#define AEC_TAG "HFP_AEC"
+
+#ifndef CONFIG_A2DPSINK_HFPHF_AEC_TAPS
+#define CONFIG_A2DPSINK_HFPHF_AEC_TAPS 256
+#endif
+
+#define AEC_TAPS            CONFIG_A2DPSINK_HFPHF_AEC_TAPS
+#define AEC_REF_RING_FRAMES 4096                    // power of two, well above the bulk delay
+#define AEC_REF_RING_MASK   (AEC_REF_RING_FRAMES - 1)
+#define AEC_MU_Q15          8192                    // NLMS step size 0.25
+#define AEC_EPS             ((int64_t)AEC_TAPS * 64 * 64)  // regularisation for a near-silent reference
+#define AEC_STEP_MAX        65535                   // keeps step * sample within 32 bits
+#define AEC_DT_HOLD_MS      100                     // adaptation stays frozen this long after near-end speech
+#define AEC_FAR_ACTIVE_PEAK 256                     // reference peak above which the far end counts as talking
+
+typedef struct {
+    bool active;
+    int sample_rate;
+    uint32_t bulk_delay;
+    int16_t *ref_ring;              // mixer output, indexed by ref_written
+    volatile uint32_t ref_written;  // frames pushed since start (mixer task)
+    uint32_t ref_read;              // next reference frame for the microphone (RX task)
+    bool aligned;
+    int16_t *hist;                  // 2 * AEC_TAPS, newest at hist[pos], mirrored at hist[pos + AEC_TAPS]
+    int32_t *w;                     // Q31 weights
+    size_t pos;
+    int64_t energy;                 // sum of squares of the history window
+    int32_t ref_peak;               // decaying peak of |reference|
+    uint32_t dt_hold;               // samples left with adaptation frozen
+    int input_shift;                // headroom shift the microphone was converted with
+    uint64_t far_in_energy;         // microphone energy while the far end talks
+    uint64_t far_out_energy;        // residual energy while the far end talks
+    hfp_aec_stats_t stats;
+} hfp_aec_t;
+
+static hfp_aec_t s_aec;
+
+// ============================================================================
+// INTERNAL
+// ============================================================================
+
+/**
+ * @brief 10 * log10(num / den) rounded down to whole dB, without libm
+ */
+static int32_t aec_ratio_db(uint64_t num, uint64_t den)
+{
+    if (den == 0 || num <= den) {
+        return 0;
+    }
+    // Keep den * 12589 within 64 bits
+    while (num > (1ULL << 40)) {
+        num >>= 1;
+        den >>= 1;
+    }
+    if (den == 0) {
+        return 90;
+    }
+    int32_t db = 0;
+    // 10^(1/10) ~= 1.2589
+    while (db < 90 && den * 12589 / 10000 <= num) {
+        den = den * 12589 / 10000;
+        db++;
+    }
+    return db;
+}
+
+/**
+ * @brief Filter one sample and adapt; returns the echo-free sample
+ */
+static inline int16_t aec_process_sample(int16_t ref, int16_t mic)
+{
+    hfp_aec_t *a = &s_aec;
+
+    // Shift the new reference sample into the history
+    a->pos = (a->pos == 0) ? AEC_TAPS - 1 : a->pos - 1;
+    int16_t oldest = a->hist[a->pos];
+    a->energy += (int32_t)ref * ref - (int32_t)oldest * oldest;
+    a->hist[a->pos] = ref;
+    a->hist[a->pos + AEC_TAPS] = ref;
+
+    const int16_t *x = &a->hist[a->pos];
+    int32_t *w = a->w;
+
+    int64_t acc = 0;
+    for (int k = 0; k < AEC_TAPS; k++) {
+        acc += (int64_t)(w[k] >> 16) * x[k];
+    }
+    int32_t e = (int32_t)mic - (int32_t)(acc >> 15);
+    e = (e > 32767) ? 32767 : (e < -32768) ? -32768 : e;
+
+    // Geigel double-talk detector: mic louder than half the recent reference peak
+    // (compared without the AGC's headroom shift, which is not part of the echo)
+    int32_t abs_ref = (ref < 0) ? -ref : ref;
+    int32_t abs_mic = (mic < 0) ? -mic : mic;
+    a->ref_peak -= a->ref_peak >> 8;
+    if (abs_ref > a->ref_peak) {
+        a->ref_peak = abs_ref;
+    }
+    if ((abs_mic >> a->input_shift) > a->ref_peak / 2) {
+        a->dt_hold = (uint32_t)a->sample_rate * AEC_DT_HOLD_MS / 1000;
+    }
+
+    if (a->dt_hold > 0) {
+        a->dt_hold--;
+    } else if (a->ref_peak > AEC_FAR_ACTIVE_PEAK) {
+        int64_t g = ((int64_t)AEC_MU_Q15 * e * 65536) / (a->energy + AEC_EPS);
+        g = (g > AEC_STEP_MAX) ? AEC_STEP_MAX : (g < -AEC_STEP_MAX) ? -AEC_STEP_MAX : g;
+        const int32_t step = (int32_t)g;
+        for (int k = 0; k < AEC_TAPS; k++) {
+            // Saturate: a tap pinned at full scale must not wrap to the other sign
+            int64_t v = (int64_t)w[k] + step * x[k];
+            w[k] = (v > INT32_MAX) ? INT32_MAX : (v < INT32_MIN) ? INT32_MIN : (int32_t)v;
+        }
+        a->far_in_energy += (uint32_t)((int32_t)mic * mic);
+        a->far_out_energy += (uint32_t)(e * e);
+    }
+
+    return (int16_t)e;
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+esp_err_t hfp_aec_start(int sample_rate, size_t bulk_delay_frames)
+{
+    hfp_aec_stop();
+
+    memset(&s_aec, 0, sizeof(s_aec));
+    s_aec.ref_ring = calloc(AEC_REF_RING_FRAMES, sizeof(int16_t));
+    s_aec.hist = calloc(2 * AEC_TAPS, sizeof(int16_t));
+    s_aec.w = calloc(AEC_TAPS, sizeof(int32_t));
+    if (s_aec.ref_ring == NULL || s_aec.hist == NULL || s_aec.w == NULL) {
+        ESP_LOGE(AEC_TAG, "Failed to allocate echo canceller buffers");
+        free(s_aec.ref_ring);
+        free(s_aec.hist);
+        free(s_aec.w);
+        memset(&s_aec, 0, sizeof(s_aec));
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Start the filter a quarter of its length early, so the echo peak lands
+    // inside it even when the delay estimate is a little long
+    bulk_delay_frames = (bulk_delay_frames > AEC_TAPS / 4) ? bulk_delay_frames - AEC_TAPS / 4 : 0;
+    if (bulk_delay_frames > AEC_REF_RING_FRAMES / 2) {
+        bulk_delay_frames = AEC_REF_RING_FRAMES / 2;
+    }
+    s_aec.sample_rate = sample_rate;
+    s_aec.bulk_delay = (uint32_t)bulk_delay_frames;
+    s_aec.active = true;
+
+    ESP_LOGI(AEC_TAG, "Echo canceller started: %d Hz, %d taps (%d ms), bulk delay %" PRIu32 " frames",
+             sample_rate, AEC_TAPS, AEC_TAPS * 1000 / sample_rate, s_aec.bulk_delay);
+    return ESP_OK;
+}
+
+void hfp_aec_stop(void)
+{
+    if (!s_aec.active) {
+        return;
+    }
+    s_aec.active = false;
+
+    hfp_aec_stats_t stats;
+    hfp_aec_get_stats(&stats);
+    ESP_LOGI(AEC_TAG, "Echo canceller stopped: ERLE %" PRId32 " dB, worst frame %" PRIu32 " us, %" PRIu32 " realigns",
+             stats.erle_db, stats.frame_us_max, stats.realigns);
+
+    free(s_aec.ref_ring);
+    free(s_aec.hist);
+    free(s_aec.w);
+    s_aec.ref_ring = NULL;
+    s_aec.hist = NULL;
+    s_aec.w = NULL;
+}
+
+void hfp_aec_push_reference(const int16_t *samples, size_t frames, int channels)
+{
+    if (!s_aec.active || channels != 1) {
+        return;
+    }
+    uint32_t wr = s_aec.ref_written;
+    for (size_t i = 0; i < frames; i++) {
+        s_aec.ref_ring[(wr + i) & AEC_REF_RING_MASK] = samples[i];
+    }
+    s_aec.ref_written = wr + (uint32_t)frames;
+}
+
+void hfp_aec_set_input_shift(int shift)
+{
+    int d = shift - s_aec.input_shift;
+    s_aec.input_shift = shift;
+    if (!s_aec.active || d == 0) {
+        return;
+    }
+    // The echo path now ends in a louder (or quieter) microphone: scale the
+    // filter with it instead of letting it converge again
+    for (int k = 0; k < AEC_TAPS; k++) {
+        int64_t v = (d > 0) ? (int64_t)s_aec.w[k] << d : (int64_t)s_aec.w[k] >> -d;
+        s_aec.w[k] = (v > INT32_MAX) ? INT32_MAX : (v < INT32_MIN) ? INT32_MIN : (int32_t)v;
+    }
+}
+
+void hfp_aec_process(int16_t *mic, size_t frames)
+{
+    if (!s_aec.active) {
+        return;
+    }
+    int64_t t0 = esp_timer_get_time();
+
+    // Line the reference up with this frame: the mixer is always a full TX DMA
+    // queue ahead of the speaker, and both run off the same clock, so once
+    // aligned the reference advances exactly one frame per microphone frame
+    uint32_t written = s_aec.ref_written;
+    uint32_t avail = written - s_aec.ref_read;
+    if (s_aec.aligned && (avail < frames || avail > AEC_REF_RING_FRAMES - frames)) {
+        // The speaker ran dry (or we fell behind): line up again once it plays
+        s_aec.aligned = false;
+        s_aec.stats.realigns++;
+    }
+    if (!s_aec.aligned) {
+        if (written < s_aec.bulk_delay + frames) {
+            return;  // nothing played yet, so nothing to cancel
+        }
+        s_aec.ref_read = written - s_aec.bulk_delay - (uint32_t)frames;
+        s_aec.aligned = true;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        int16_t ref = s_aec.ref_ring[(s_aec.ref_read + i) & AEC_REF_RING_MASK];
+        mic[i] = aec_process_sample(ref, mic[i]);
+    }
+    s_aec.ref_read += (uint32_t)frames;
+
+    uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+    if (us > s_aec.stats.frame_us_max) {
+        s_aec.stats.frame_us_max = us;
+    }
+}
+
+void hfp_aec_get_stats(hfp_aec_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    *stats = s_aec.stats;
+    stats->erle_db = aec_ratio_db(s_aec.far_in_energy, s_aec.far_out_energy);
+}
@@ -0,0 +1,259 @@
+/*
+ * hfp_agc.c - Automatic gain control for the HFP microphone path
+ *
+ * The gain is applied in two parts. While the 24 significant bits of each I2S
+ * word are converted to 16 bits, a headroom shift (whole 6 dB steps, picked
+ * from the previous frame's gain and input peak) lifts a quiet talker using the
+ * microphone's low-order bits. The rest is applied in place on the 16-bit frame
+ * at the end of the microphone chain.
+ *
+ * Per frame, the mean absolute level is measured first (back on the 24-bit
+ * scale); it drives a level envelope (fast attack, slow release) and a noise
+ * floor tracker. The gain heads for target / envelope (instantly downwards, a
+ * little per frame upwards, not at all while gated) and is ramped across the
+ * frame while the samples are scaled. A frame whose peak would still clip
+ * lowers the gain on the spot.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include "hfp_agc.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#define AGC_TAG "HFP_AGC"
+
+#ifndef CONFIG_A2DPSINK_HFPHF_AGC_MAX_GAIN_DB
+#define CONFIG_A2DPSINK_HFPHF_AGC_MAX_GAIN_DB 18
+#endif
+
+#define AGC_UNITY          (1 << 16)          // Q16 gain
+#define AGC_MIN_GAIN       (AGC_UNITY / 4)    // -12 dB
+#define AGC_TARGET         (2000 << 8)        // mean |sample| of speech, 24-bit scale (about -20 dBFS)
+#define AGC_PEAK_MAX       (32000 << 8)       // highest peak let through, 24-bit scale
+#define AGC_GATE_MIN       (30 << 8)          // below this a frame is always silence
+#define AGC_RELEASE_SHIFT  6                  // envelope release: 1/64 per 120 samples at 16 kHz
+#define AGC_FLOOR_RISE     7                  // noise floor rises 1/128 per frame, falls at once
+
+// Headroom shift: the shifted input peak stays below half scale, and the shift
+// steps up only with 1.5 dB of gain and 6 dB of headroom to spare, at most
+// every AGC_SHIFT_HOLD_MS, since each step makes the AEC and NS rescale
+#define AGC_SHIFT_PEAK_MAX (1 << 22)          // 24-bit scale
+#define AGC_SHIFT_UP_GAIN  77935              // Q16, +1.5 dB
+#define AGC_SHIFT_HOLD_MS  500
+
+typedef struct {
+    bool active;
+    int rise_shift;            // gain rise: g += g >> rise_shift per frame (~9 dB/s)
+    int32_t max_gain;          // Q16
+    int32_t gain;              // Q16, gain at the end of the last frame
+    int32_t env;               // speech level envelope, 24-bit scale
+    int32_t floor;             // noise floor, 24-bit scale
+    int shift;                 // headroom shift hfp_agc_convert() applies
+    int max_shift;             // whole 6 dB steps within max_gain
+    int32_t in_peak;           // peak of the last converted frame, 24-bit scale
+    uint32_t hold;             // frames before the shift may step up again
+    uint32_t hold_frames;
+    uint32_t frames;
+    uint32_t gated;
+    uint32_t limited;
+    uint32_t shifts;
+} hfp_agc_t;
+
+static hfp_agc_t s_agc;
+
+// ============================================================================
+// INTERNAL
+// ============================================================================
+
+/**
+ * @brief Q16 gain to whole dB, without libm
+ */
+static int32_t agc_gain_db(int32_t gain)
+{
+    int32_t db = 0;
+    // 10^(1/20) ~= 1.1220
+    while (gain > AGC_UNITY * 11220LL / 10000 && db < 60) {
+        gain = (int32_t)(gain * 10000LL / 11220);
+        db++;
+    }
+    while (gain < AGC_UNITY * 10000LL / 11220 && db > -60) {
+        gain = (int32_t)(gain * 11220LL / 10000);
+        db--;
+    }
+    return db;
+}
+
+/**
+ * @brief Pick the gain for this frame from its level and peak (24-bit scale)
+ */
+static int32_t agc_next_gain(hfp_agc_t *a, int32_t level, int32_t peak)
+{
+    // Noise floor: follows dips at once, creeps up slowly
+    if (level < a->floor || a->frames == 0) {
+        a->floor = level;
+    } else {
+        a->floor += (level - a->floor) >> AGC_FLOOR_RISE;
+    }
+
+    int32_t gain = a->gain;
+    bool gated = (level < AGC_GATE_MIN) || (level < 2 * a->floor);
+    if (gated) {
+        a->gated++;
+    } else {
+        // Envelope: fast attack (half the gap per frame), slow release
+        if (level > a->env) {
+            a->env += (level - a->env) >> 1;
+        } else {
+            a->env -= (a->env - level) >> AGC_RELEASE_SHIFT;
+        }
+
+        int32_t want = (a->env > 0) ? (int32_t)(((int64_t)AGC_TARGET << 16) / a->env) : a->max_gain;
+        if (want > a->max_gain) {
+            want = a->max_gain;
+        } else if (want < AGC_MIN_GAIN) {
+            want = AGC_MIN_GAIN;
+        }
+        if (want < gain) {
+            gain = want;
+        } else {
+            int32_t up = gain + (gain >> a->rise_shift);
+            gain = (up < want) ? up : want;
+        }
+    }
+
+    // Never let the frame peak clip
+    if (peak > 0 && (int64_t)peak * gain > (int64_t)AGC_PEAK_MAX << 16) {
+        gain = (int32_t)(((int64_t)AGC_PEAK_MAX << 16) / peak);
+        a->limited++;
+    }
+    a->frames++;
+    return gain;
+}
+
+/**
+ * @brief Headroom shift for the next frame, from the gain just picked and the
+ * last input peak: down at once, up one step at a time
+ */
+static int agc_next_shift(hfp_agc_t *a)
+{
+    int s = a->shift;
+    while (s > 0 && (a->gain < (AGC_UNITY << s) || ((int64_t)a->in_peak << s) > AGC_SHIFT_PEAK_MAX)) {
+        s--;
+    }
+    if (a->hold > 0) {
+        a->hold--;
+    } else if (s < a->max_shift && a->gain >= ((int32_t)AGC_SHIFT_UP_GAIN << (s + 1)) &&
+               ((int64_t)a->in_peak << (s + 2)) <= AGC_SHIFT_PEAK_MAX) {
+        s++;
+        a->hold = a->hold_frames;
+    }
+    if (s != a->shift) {
+        a->shifts++;
+    }
+    return s;
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+void hfp_agc_start(int sample_rate)
+{
+    memset(&s_agc, 0, sizeof(s_agc));
+
+    s_agc.max_gain = AGC_UNITY;
+    for (int db = 0; db < CONFIG_A2DPSINK_HFPHF_AGC_MAX_GAIN_DB; db++) {
+        s_agc.max_gain = (int32_t)(s_agc.max_gain * 11220LL / 10000);
+    }
+    while ((AGC_UNITY << (s_agc.max_shift + 1)) <= s_agc.max_gain) {
+        s_agc.max_shift++;
+    }
+    // Narrowband frames are twice as long, so rise twice as much per frame
+    s_agc.rise_shift = (sample_rate >= 16000) ? 7 : 6;
+    // 120 samples per frame at either rate
+    s_agc.hold_frames = (uint32_t)(AGC_SHIFT_HOLD_MS * sample_rate / (1000 * 120));
+    s_agc.gain = AGC_UNITY;
+    s_agc.env = AGC_TARGET;
+    s_agc.active = true;
+
+    ESP_LOGI(AGC_TAG, "AGC started: up to +%d dB, %d dB of it while converting",
+             CONFIG_A2DPSINK_HFPHF_AGC_MAX_GAIN_DB, 6 * s_agc.max_shift);
+}
+
+void hfp_agc_stop(void)
+{
+    if (!s_agc.active) {
+        return;
+    }
+    s_agc.active = false;
+
+    uint32_t gated_pct = s_agc.frames ? (uint32_t)((uint64_t)s_agc.gated * 100 / s_agc.frames) : 0;
+    ESP_LOGI(AGC_TAG, "AGC stopped: gain %" PRId32 " dB, %" PRIu32 "%% of frames gated, %" PRIu32 " limited, "
+             "%" PRIu32 " headroom shifts", agc_gain_db(s_agc.gain), gated_pct, s_agc.limited, s_agc.shifts);
+    s_agc.shift = 0;
+}
+
+void hfp_agc_convert(const int32_t *i2s_data, int16_t *pcm, size_t frames)
+{
+    const int s = s_agc.active ? s_agc.shift : 0;
+    int32_t peak = 0;
+    for (size_t i = 0; i < frames; i++) {
+        int32_t x = i2s_data[i] >> 8;
+        int32_t a = (x < 0) ? -x : x;
+        if (a > peak) {
+            peak = a;
+        }
+        int32_t y = x >> (8 - s);
+        pcm[i] = (y > 32767) ? 32767 : (y < -32768) ? -32768 : (int16_t)y;
+    }
+    s_agc.in_peak = peak;
+}
+
+int hfp_agc_input_shift(void)
+{
+    return s_agc.active ? s_agc.shift : 0;
+}
+
+void hfp_agc_process(int16_t *pcm, size_t frames)
+{
+    if (!s_agc.active || frames == 0) {
+        return;
+    }
+    const int s = s_agc.shift;
+
+    // Pass 1: level and peak, back on the 24-bit scale
+    int32_t sum = 0;
+    int32_t peak = 0;
+    for (size_t i = 0; i < frames; i++) {
+        int32_t x = pcm[i];
+        x = (x < 0) ? -x : x;
+        sum += x;
+        if (x > peak) {
+            peak = x;
+        }
+    }
+    int32_t level = (sum / (int32_t)frames) << (8 - s);
+    peak <<= 8 - s;
+
+    int32_t g0 = s_agc.gain;
+    int32_t g1 = agc_next_gain(&s_agc, level, peak);
+    s_agc.gain = g1;
+    // A limited frame takes the lower gain from its first sample
+    if (g1 < g0 && (int64_t)peak * g0 > (int64_t)AGC_PEAK_MAX << 16) {
+        g0 = g1;
+    }
+
+    // Pass 2: scale by what the shift left of the gain, ramped from g0 to g1
+    int32_t step = (g1 - g0) / (int32_t)frames;
+    int32_t g = g0;
+    for (size_t i = 0; i < frames; i++) {
+        int32_t y = (int32_t)(((int64_t)pcm[i] * g) >> (16 + s));
+        pcm[i] = (y > 32767) ? 32767 : (y < -32768) ? -32768 : (int16_t)y;
+        g += step;
+    }
+
+    s_agc.shift = agc_next_shift(&s_agc);
+}
@@ -0,0 +1,342 @@
+/*
+ * hfp_mic.c - Microphone front end for the HFP uplink
+ *
+ * 32-bit formats are converted in one forward pass: shift (saturating), drop
+ * the invalid low bits, DC-blocking high-pass. 16-bit formats (16-bit I2S and
+ * PDM) are first widened back to front, which is what lets the conversion run
+ * in place, and then filtered front to back.
+ *
+ * The high-pass is y[n] = x[n] - x[n-1] + y[n-1] - y[n-1] / 2^k on the 24
+ * significant bits, with k picked per call so the corner stays at about 20 Hz.
+ *
+ * With two microphones the samples arrive interleaved (L, R). Each frame reads
+ * its two words and writes one, never ahead of what is still to be read, so
+ * the stereo kernels run in place front to back as well. The microphone the
+ * talker reaches first is delayed by the steering delay (whole samples through
+ * a short history ring, the fraction by linear interpolation) and added to the
+ * other at half level each, so nothing can overflow.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include "hfp_mic.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#define MIC_TAG "HFP_MIC"
+
+#ifndef CONFIG_A2DPSINK_HFPHF_MIC_SHIFT
+#define CONFIG_A2DPSINK_HFPHF_MIC_SHIFT 0
+#endif
+#ifndef CONFIG_A2DPSINK_HFPHF_MIC_HPF
+#define CONFIG_A2DPSINK_HFPHF_MIC_HPF 0
+#endif
+
+#if CONFIG_A2DPSINK_HFPHF_MIC_PDM
+#define MIC_FORMAT HFP_MIC_FORMAT_PDM
+#elif CONFIG_A2DPSINK_HFPHF_MIC_STD_16
+#define MIC_FORMAT HFP_MIC_FORMAT_STD_16
+#elif CONFIG_A2DPSINK_HFPHF_MIC_STD_32
+#define MIC_FORMAT HFP_MIC_FORMAT_STD_32
+#else
+#define MIC_FORMAT HFP_MIC_FORMAT_STD_24
+#endif
+
+#ifndef CONFIG_A2DPSINK_HFPHF_MIC_SPACING_MM
+#define CONFIG_A2DPSINK_HFPHF_MIC_SPACING_MM 40
+#endif
+#ifndef CONFIG_A2DPSINK_HFPHF_MIC_STEER_DEG
+#define CONFIG_A2DPSINK_HFPHF_MIC_STEER_DEG 0
+#endif
+
+#define MIC_SHIFT   CONFIG_A2DPSINK_HFPHF_MIC_SHIFT
+#define MIC_MAX_24  ((1 << 23) - 1)
+
+#define BEAM_HIST       16                 // history ring of the early microphone
+#define BEAM_HIST_MASK  (BEAM_HIST - 1)
+#define BEAM_MAX_DELAY  ((BEAM_HIST - 2) << 8)
+#define SPEED_OF_SOUND_MM_S 343000
+
+typedef struct {
+    int early;                 // 0: left reaches the talker's voice first, 1: right
+    int32_t delay_q8;          // steering delay in samples, Q8
+    int delay_int;
+    int32_t delay_frac;        // Q8
+    uint32_t pos;
+    int32_t hist[BEAM_HIST];   // early microphone, halved
+} mic_beam_t;
+
+typedef struct {
+    void (*kernel)(void *buf, size_t frames);
+    uint32_t mask;             // valid bits of a 32-bit word (after the shift)
+    int hpf_shift;             // k: pole at 1 - 2^-k
+    int32_t x1;                // last input, 24-bit scale
+    int32_t y1;                // last output, 24-bit scale
+    mic_beam_t beam;
+} hfp_mic_t;
+
+static hfp_mic_t s_mic;
+
+// ============================================================================
+// INTERNAL
+// ============================================================================
+
+static inline int32_t mic_shift(int32_t w)
+{
+#if MIC_SHIFT > 0
+    if (w > (INT32_MAX >> MIC_SHIFT)) {
+        return INT32_MAX;
+    }
+    if (w < (INT32_MIN >> MIC_SHIFT)) {
+        return INT32_MIN;
+    }
+    return (int32_t)((uint32_t)w << MIC_SHIFT);
+#else
+    return w;
+#endif
+}
+
+static inline int32_t mic_hpf_step(int32_t w, int32_t *x1, int32_t *y1, int k)
+{
+#if CONFIG_A2DPSINK_HFPHF_MIC_HPF
+    int32_t x = w >> 8;
+    int32_t y = x - *x1 + *y1 - (*y1 >> k);
+    *x1 = x;
+    y = (y > MIC_MAX_24) ? MIC_MAX_24 : (y < -MIC_MAX_24) ? -MIC_MAX_24 : y;
+    *y1 = y;
+    return (int32_t)((uint32_t)y << 8);
+#else
+    (void)x1;
+    (void)y1;
+    (void)k;
+    return w;
+#endif
+}
+
+/**
+ * @brief 24 or 32 valid bits in a 32-bit word: one pass
+ */
+static void mic_convert_32(void *buf, size_t frames)
+{
+    int32_t *w = (int32_t *)buf;
+    const uint32_t mask = s_mic.mask;
+    const int k = s_mic.hpf_shift;
+    int32_t x1 = s_mic.x1;
+    int32_t y1 = s_mic.y1;
+
+    for (size_t i = 0; i < frames; i++) {
+        int32_t v = (int32_t)((uint32_t)mic_shift(w[i]) & mask);
+        w[i] = mic_hpf_step(v, &x1, &y1, k);
+    }
+    s_mic.x1 = x1;
+    s_mic.y1 = y1;
+}
+
+/**
+ * @brief 16-bit samples (standard I2S or PDM): widen in place, then filter
+ */
+static void mic_convert_16(void *buf, size_t frames)
+{
+    const int16_t *in = (const int16_t *)buf;
+    int32_t *w = (int32_t *)buf;
+
+    // Back to front, so no sample is overwritten before it is read
+    for (size_t i = frames; i-- > 0;) {
+        w[i] = mic_shift((int32_t)((uint32_t)(int32_t)in[i] << 16));
+    }
+
+#if CONFIG_A2DPSINK_HFPHF_MIC_HPF
+    const int k = s_mic.hpf_shift;
+    int32_t x1 = s_mic.x1;
+    int32_t y1 = s_mic.y1;
+    for (size_t i = 0; i < frames; i++) {
+        w[i] = mic_hpf_step(w[i], &x1, &y1, k);
+    }
+    s_mic.x1 = x1;
+    s_mic.y1 = y1;
+#endif
+}
+
+/**
+ * @brief sin(deg) in Q15, without libm (Bhaskara's approximation, within 0.2%)
+ */
+static int32_t beam_sin_q15(int deg)
+{
+    int sign = 1;
+    if (deg < 0) {
+        deg = -deg;
+        sign = -1;
+    }
+    int32_t p = deg * (180 - deg);
+    return sign * (int32_t)(((int64_t)4 * p << 15) / (40500 - p));
+}
+
+/**
+ * @brief Steering delay for the configured geometry at a sample rate
+ */
+static void beam_setup(mic_beam_t *b, int sample_rate)
+{
+    int64_t num = (int64_t)CONFIG_A2DPSINK_HFPHF_MIC_SPACING_MM * beam_sin_q15(CONFIG_A2DPSINK_HFPHF_MIC_STEER_DEG) *
+                  sample_rate * 256;
+    int32_t delay = (int32_t)(num / ((int64_t)SPEED_OF_SOUND_MM_S << 15));
+
+    // Positive angles point at the left microphone: it hears the talker first
+    b->early = (delay >= 0) ? 0 : 1;
+    delay = (delay < 0) ? -delay : delay;
+    if (delay > BEAM_MAX_DELAY) {
+        delay = BEAM_MAX_DELAY;
+    }
+    b->delay_q8 = delay;
+    b->delay_int = delay >> 8;
+    b->delay_frac = delay & 0xFF;
+    b->pos = 0;
+    memset(b->hist, 0, sizeof(b->hist));
+}
+
+/**
+ * @brief Delay-and-sum of one frame (two left-justified words in, one out)
+ */
+static inline int32_t beam_step(mic_beam_t *b, const int32_t lr[2])
+{
+    b->hist[b->pos & BEAM_HIST_MASK] = lr[b->early] >> 1;
+    int32_t e0 = b->hist[(b->pos - b->delay_int) & BEAM_HIST_MASK];
+    int32_t e1 = b->hist[(b->pos - b->delay_int - 1) & BEAM_HIST_MASK];
+    b->pos++;
+    int32_t early = e0 + (int32_t)((((int64_t)e1 - e0) * b->delay_frac) >> 8);
+    return early + (lr[b->early ^ 1] >> 1);
+}
+
+/**
+ * @brief Two 24/32-bit microphones, interleaved: beamform and filter in one pass
+ */
+static void mic_convert_stereo_32(void *buf, size_t frames)
+{
+    int32_t *w = (int32_t *)buf;
+    const uint32_t mask = s_mic.mask;
+    const int k = s_mic.hpf_shift;
+    int32_t x1 = s_mic.x1;
+    int32_t y1 = s_mic.y1;
+
+    for (size_t i = 0; i < frames; i++) {
+        int32_t lr[2] = {
+            (int32_t)((uint32_t)mic_shift(w[2 * i]) & mask),
+            (int32_t)((uint32_t)mic_shift(w[2 * i + 1]) & mask),
+        };
+        w[i] = mic_hpf_step(beam_step(&s_mic.beam, lr), &x1, &y1, k);
+    }
+    s_mic.x1 = x1;
+    s_mic.y1 = y1;
+}
+
+/**
+ * @brief Two 16-bit microphones, interleaved: frame i's two samples are word i
+ */
+static void mic_convert_stereo_16(void *buf, size_t frames)
+{
+    const int16_t *in = (const int16_t *)buf;
+    int32_t *w = (int32_t *)buf;
+    const int k = s_mic.hpf_shift;
+    int32_t x1 = s_mic.x1;
+    int32_t y1 = s_mic.y1;
+
+    for (size_t i = 0; i < frames; i++) {
+        int32_t lr[2] = {
+            mic_shift((int32_t)((uint32_t)(int32_t)in[2 * i] << 16)),
+            mic_shift((int32_t)((uint32_t)(int32_t)in[2 * i + 1] << 16)),
+        };
+        w[i] = mic_hpf_step(beam_step(&s_mic.beam, lr), &x1, &y1, k);
+    }
+    s_mic.x1 = x1;
+    s_mic.y1 = y1;
+}
+
+static const char *mic_format_name(hfp_mic_format_t format)
+{
+    switch (format) {
+    case HFP_MIC_FORMAT_STD_16: return "I2S 16-bit";
+    case HFP_MIC_FORMAT_STD_24: return "I2S 24-bit";
+    case HFP_MIC_FORMAT_STD_32: return "I2S 32-bit";
+    case HFP_MIC_FORMAT_PDM:    return "PDM";
+    default:                    return "?";
+    }
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+void hfp_mic_init(void)
+{
+    memset(&s_mic, 0, sizeof(s_mic));
+    s_mic.hpf_shift = 7;
+
+    bool stereo = (hfp_mic_channels() == 2);
+    if (hfp_mic_sample_bytes() == 2) {
+        s_mic.kernel = stereo ? mic_convert_stereo_16 : mic_convert_16;
+        s_mic.mask = 0xFFFFFFFFu;
+    } else {
+        s_mic.kernel = stereo ? mic_convert_stereo_32 : mic_convert_32;
+        s_mic.mask = (MIC_FORMAT == HFP_MIC_FORMAT_STD_24) ? 0xFFFFFF00u : 0xFFFFFFFFu;
+    }
+
+    ESP_LOGI(MIC_TAG, "Microphone: %s, shift %d, high-pass %s", mic_format_name(MIC_FORMAT), MIC_SHIFT,
+             CONFIG_A2DPSINK_HFPHF_MIC_HPF ? "on" : "off");
+    if (stereo) {
+        ESP_LOGI(MIC_TAG, "Two microphones %d mm apart, beam steered to %d degrees",
+                 CONFIG_A2DPSINK_HFPHF_MIC_SPACING_MM, CONFIG_A2DPSINK_HFPHF_MIC_STEER_DEG);
+    }
+}
+
+hfp_mic_format_t hfp_mic_get_format(void)
+{
+    return MIC_FORMAT;
+}
+
+i2s_data_bit_width_t hfp_mic_dma_bit_width(void)
+{
+    // 24-bit data is read in a 32-bit slot, so the DMA layout is the same as for 32
+    return (hfp_mic_sample_bytes() == 2) ? I2S_DATA_BIT_WIDTH_16BIT : I2S_DATA_BIT_WIDTH_32BIT;
+}
+
+size_t hfp_mic_sample_bytes(void)
+{
+    return (MIC_FORMAT == HFP_MIC_FORMAT_STD_16 || MIC_FORMAT == HFP_MIC_FORMAT_PDM) ? 2 : 4;
+}
+
+size_t hfp_mic_channels(void)
+{
+#if CONFIG_A2DPSINK_HFPHF_MIC_STEREO
+    return 2;
+#else
+    return 1;
+#endif
+}
+
+i2s_slot_mode_t hfp_mic_slot_mode(void)
+{
+    return (hfp_mic_channels() == 2) ? I2S_SLOT_MODE_STEREO : I2S_SLOT_MODE_MONO;
+}
+
+void hfp_mic_start(int sample_rate)
+{
+    // About 20 Hz at either call rate
+    s_mic.hpf_shift = (sample_rate >= 16000) ? 7 : 6;
+    s_mic.x1 = 0;
+    s_mic.y1 = 0;
+
+    if (hfp_mic_channels() == 2) {
+        beam_setup(&s_mic.beam, sample_rate);
+        ESP_LOGI(MIC_TAG, "Beamformer: %s microphone delayed by %" PRId32 ".%02" PRId32 " samples",
+                 s_mic.beam.early ? "right" : "left", s_mic.beam.delay_q8 >> 8,
+                 (s_mic.beam.delay_q8 & 0xFF) * 100 / 256);
+    }
+}
+
+void hfp_mic_convert(void *buf, size_t frames)
+{
+    if (s_mic.kernel != NULL && frames > 0) {
+        s_mic.kernel(buf, frames);
+    }
+}
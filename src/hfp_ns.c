@@ -0,0 +1,305 @@
+/*
+ * hfp_ns.c - Spectral noise suppressor for the HFP microphone path
+ *
+ * Each 120 sample hop is joined with the previous one, windowed with a sqrt-Hann
+ * window, zero padded to 256 points and transformed with a fixed-point radix-2
+ * FFT. Per bin, a slowly rising / quickly falling noise floor is tracked and a
+ * spectral subtraction gain (with a floor, smoothed over time against musical
+ * noise) is applied. The inverse transform is windowed again and overlap-added,
+ * which reconstructs the input exactly when the gain is 1. Latency is one hop.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "hfp_ns.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#define NS_TAG "HFP_NS"
+
+#ifndef CONFIG_A2DPSINK_HFPHF_NS_LEVEL
+#define CONFIG_A2DPSINK_HFPHF_NS_LEVEL 2
+#endif
+
+#define NS_FFT_BITS   8
+#define NS_FFT_SIZE   (1 << NS_FFT_BITS)
+#define NS_WIN_SIZE   (2 * HFP_NS_HOP)
+#define NS_BINS       (NS_FFT_SIZE / 2 + 1)
+#define NS_NOISE_RISE 7      // noise floor rises by 1/128 of the difference per hop (~1 s)
+#define NS_NOISE_FALL 2      // and falls by 1/4 per hop
+
+// cos(2*pi*k/256) in Q15, k = 0..128; sin(2*pi*k/256) = cos(2*pi*|k-64|/256)
+static const int16_t s_ns_cos[129] = {
+     32767,  32757,  32728,  32678,  32609,  32521,  32412,  32285,  32137,  31971,  31785,  31580,
+     31356,  31113,  30852,  30571,  30273,  29956,  29621,  29268,  28898,  28510,  28105,  27683,
+     27245,  26790,  26319,  25832,  25329,  24811,  24279,  23731,  23170,  22594,  22005,  21403,
+     20787,  20159,  19519,  18868,  18204,  17530,  16846,  16151,  15446,  14732,  14010,  13279,
+     12539,  11793,  11039,  10278,   9512,   8739,   7962,   7179,   6393,   5602,   4808,   4011,
+      3212,   2410,   1608,    804,      0,   -804,  -1608,  -2410,  -3212,  -4011,  -4808,  -5602,
+     -6393,  -7179,  -7962,  -8739,  -9512, -10278, -11039, -11793, -12539, -13279, -14010, -14732,
+    -15446, -16151, -16846, -17530, -18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+    -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790, -27245, -27683, -28105, -28510,
+    -28898, -29268, -29621, -29956, -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+    -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757, -32767,
+};
+
+// sqrt-Hann analysis/synthesis window, sin(pi*(n+0.5)/240) in Q15, first half
+static const int16_t s_ns_win[HFP_NS_HOP] = {
+       214,    643,   1072,   1501,   1929,   2357,   2785,   3212,   3638,   4064,   4489,   4914,
+      5338,   5760,   6182,   6603,   7022,   7441,   7858,   8273,   8688,   9101,   9512,   9921,
+     10329,  10735,  11140,  11542,  11943,  12341,  12737,  13131,  13523,  13913,  14300,  14685,
+     15067,  15446,  15823,  16197,  16569,  16937,  17303,  17666,  18026,  18382,  18736,  19086,
+     19433,  19777,  20117,  20454,  20787,  21117,  21443,  21766,  22084,  22399,  22710,  23018,
+     23321,  23620,  23915,  24207,  24494,  24776,  25055,  25329,  25599,  25865,  26126,  26382,
+     26635,  26882,  27125,  27363,  27597,  27826,  28050,  28269,  28484,  28693,  28898,  29098,
+     29292,  29482,  29667,  29846,  30021,  30190,  30354,  30513,  30667,  30815,  30958,  31096,
+     31229,  31356,  31478,  31594,  31705,  31811,  31911,  32006,  32095,  32179,  32257,  32329,
+     32396,  32458,  32514,  32564,  32609,  32648,  32682,  32710,  32733,  32749,  32761,  32766,
+};
+
+// Over-subtraction (Q8) and gain floor (Q15) per level
+static const int16_t s_ns_over_q8[4] = { 0, 256, 384, 512 };
+static const int16_t s_ns_floor_q15[4] = { 32767, 16384, 8192, 4096 };  // 0, -6, -12, -18 dB
+
+typedef struct {
+    int16_t prev_in[HFP_NS_HOP];       // previous hop of input
+    int32_t ola[HFP_NS_HOP];           // second half of the previous output, to overlap-add
+    int32_t re[NS_FFT_SIZE];
+    int32_t im[NS_FFT_SIZE];
+    uint32_t psd[NS_BINS];             // smoothed power per bin
+    uint32_t noise[NS_BINS];           // noise power estimate per bin
+    int16_t gain[NS_BINS];             // last applied gain per bin (Q15)
+    bool primed;                       // noise estimate seeded from the first hop
+    int input_shift;                   // headroom shift the input was converted with
+    uint32_t frame_us_max;
+} hfp_ns_t;
+
+static hfp_ns_t *s_ns = NULL;
+static volatile int s_ns_level = CONFIG_A2DPSINK_HFPHF_NS_LEVEL;
+
+// ============================================================================
+// INTERNAL
+// ============================================================================
+
+static inline int32_t ns_cos(int k)
+{
+    return s_ns_cos[k];
+}
+
+static inline int32_t ns_sin(int k)
+{
+    return s_ns_cos[(k >= 64) ? k - 64 : 64 - k];
+}
+
+static inline int32_t ns_window(int n)
+{
+    return s_ns_win[(n < HFP_NS_HOP) ? n : NS_WIN_SIZE - 1 - n];
+}
+
+/**
+ * @brief In-place radix-2 FFT (unscaled: outputs grow by up to NS_FFT_SIZE)
+ */
+static void ns_fft(int32_t *re, int32_t *im)
+{
+    for (int i = 1, j = 0; i < NS_FFT_SIZE; i++) {
+        int bit = NS_FFT_SIZE >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            int32_t t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for (int len = 2; len <= NS_FFT_SIZE; len <<= 1) {
+        const int half = len >> 1;
+        const int step = NS_FFT_SIZE / len;
+        for (int i = 0; i < NS_FFT_SIZE; i += len) {
+            for (int k = 0; k < half; k++) {
+                const int32_t wr = ns_cos(k * step);
+                const int32_t wi = -ns_sin(k * step);
+                const int a = i + k;
+                const int b = a + half;
+                int32_t tr = (int32_t)(((int64_t)re[b] * wr - (int64_t)im[b] * wi) >> 15);
+                int32_t ti = (int32_t)(((int64_t)re[b] * wi + (int64_t)im[b] * wr) >> 15);
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Compute and apply the suppression gain for every bin
+ */
+static void ns_apply_gain(hfp_ns_t *ns, int level)
+{
+    const int64_t over_q8 = s_ns_over_q8[level];
+    const int32_t floor_q15 = s_ns_floor_q15[level];
+
+    for (int k = 0; k < NS_BINS; k++) {
+        // Power in Q-16 so it fits 32 bits (bins reach 2^23)
+        int64_t p64 = ((int64_t)ns->re[k] * ns->re[k] + (int64_t)ns->im[k] * ns->im[k]) >> 16;
+        uint32_t p = (p64 > UINT32_MAX) ? UINT32_MAX : (uint32_t)p64;
+
+        // Smooth the power over two hops, then let the noise estimate follow
+        // its dips quickly and its rises slowly, so speech does not leak in
+        uint32_t ps = ns->psd[k];
+        uint32_t n = ns->noise[k];
+        if (!ns->primed) {
+            ps = p;
+            n = p;
+        } else {
+            ps = (p > ps) ? ps + ((p - ps) >> 1) : ps - ((ps - p) >> 1);
+            if (ps < n) {
+                n -= (n - ps) >> NS_NOISE_FALL;
+            } else {
+                n += (ps - n) >> NS_NOISE_RISE;
+            }
+        }
+        ns->psd[k] = ps;
+        ns->noise[k] = n;
+        p = ps;
+
+        // Spectral subtraction: g = 1 - over * noise / power, limited to the floor.
+        // The tracker sits near the dips of the noise, so it is counted twice
+        int32_t g = floor_q15;
+        if (p > 0) {
+            int64_t ratio_q15 = (over_q8 * n << 8) / p;
+            g = (ratio_q15 >= 32767) ? 0 : 32767 - (int32_t)ratio_q15;
+            if (g < floor_q15) {
+                g = floor_q15;
+            }
+        }
+        g = (g + ns->gain[k]) >> 1;
+        ns->gain[k] = (int16_t)g;
+
+        ns->re[k] = (int32_t)(((int64_t)ns->re[k] * g) >> 15);
+        ns->im[k] = (int32_t)(((int64_t)ns->im[k] * g) >> 15);
+        if (k > 0 && k < NS_FFT_SIZE / 2) {
+            const int m = NS_FFT_SIZE - k;
+            ns->re[m] = (int32_t)(((int64_t)ns->re[m] * g) >> 15);
+            ns->im[m] = (int32_t)(((int64_t)ns->im[m] * g) >> 15);
+        }
+    }
+    ns->primed = true;
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+esp_err_t hfp_ns_start(void)
+{
+    hfp_ns_stop();
+
+    hfp_ns_t *ns = calloc(1, sizeof(hfp_ns_t));
+    if (ns == NULL) {
+        ESP_LOGE(NS_TAG, "Failed to allocate noise suppressor state");
+        return ESP_ERR_NO_MEM;
+    }
+    for (int k = 0; k < NS_BINS; k++) {
+        ns->gain[k] = 32767;
+    }
+    s_ns = ns;
+
+    ESP_LOGI(NS_TAG, "Noise suppressor started (level %d)", s_ns_level);
+    return ESP_OK;
+}
+
+void hfp_ns_stop(void)
+{
+    if (s_ns == NULL) {
+        return;
+    }
+    ESP_LOGI(NS_TAG, "Noise suppressor stopped: worst frame %" PRIu32 " us", s_ns->frame_us_max);
+    free(s_ns);
+    s_ns = NULL;
+}
+
+void hfp_ns_set_level(int level)
+{
+    if (level < 0) {
+        level = 0;
+    } else if (level > 3) {
+        level = 3;
+    }
+    s_ns_level = level;
+}
+
+void hfp_ns_set_input_shift(int shift)
+{
+    hfp_ns_t *ns = s_ns;
+    if (ns == NULL) {
+        return;
+    }
+    int d = shift - ns->input_shift;
+    ns->input_shift = shift;
+    if (d == 0) {
+        return;
+    }
+    // Keep the noise estimate and the overlap in step with the new input level
+    for (int n = 0; n < HFP_NS_HOP; n++) {
+        int32_t v = (d > 0) ? ns->prev_in[n] * (1 << d) : ns->prev_in[n] >> -d;
+        ns->prev_in[n] = (v > 32767) ? 32767 : (v < -32768) ? -32768 : (int16_t)v;
+        ns->ola[n] = (d > 0) ? ns->ola[n] * (1 << d) : ns->ola[n] >> -d;
+    }
+    for (int k = 0; k < NS_BINS; k++) {
+        uint64_t p = (d > 0) ? (uint64_t)ns->psd[k] << (2 * d) : ns->psd[k] >> (-2 * d);
+        uint64_t n = (d > 0) ? (uint64_t)ns->noise[k] << (2 * d) : ns->noise[k] >> (-2 * d);
+        ns->psd[k] = (p > UINT32_MAX) ? UINT32_MAX : (uint32_t)p;
+        ns->noise[k] = (n > UINT32_MAX) ? UINT32_MAX : (uint32_t)n;
+    }
+}
+
+void hfp_ns_process(int16_t *pcm, size_t frames)
+{
+    hfp_ns_t *ns = s_ns;
+    const int level = s_ns_level;
+    if (ns == NULL || level == 0 || frames != HFP_NS_HOP) {
+        return;
+    }
+    int64_t t0 = esp_timer_get_time();
+
+    // Window [previous hop, this hop] and zero pad
+    for (int n = 0; n < HFP_NS_HOP; n++) {
+        ns->re[n] = (ns->prev_in[n] * ns_window(n)) >> 15;
+        ns->re[n + HFP_NS_HOP] = (pcm[n] * ns_window(n + HFP_NS_HOP)) >> 15;
+    }
+    memset(&ns->re[NS_WIN_SIZE], 0, (NS_FFT_SIZE - NS_WIN_SIZE) * sizeof(int32_t));
+    memset(ns->im, 0, sizeof(ns->im));
+    memcpy(ns->prev_in, pcm, sizeof(ns->prev_in));
+
+    ns_fft(ns->re, ns->im);
+    ns_apply_gain(ns, level);
+
+    // Inverse transform as conj(fft(conj(X))) / N; only the real part is needed.
+    // Halve the spectrum first for one bit of headroom in the inverse.
+    for (int k = 0; k < NS_FFT_SIZE; k++) {
+        ns->re[k] >>= 1;
+        ns->im[k] = -(ns->im[k] >> 1);
+    }
+    ns_fft(ns->re, ns->im);
+
+    // Synthesis window and overlap-add: output the first half, keep the second
+    for (int n = 0; n < HFP_NS_HOP; n++) {
+        int32_t first = ((ns->re[n] >> (NS_FFT_BITS - 1)) * ns_window(n)) >> 15;
+        int32_t second = ((ns->re[n + HFP_NS_HOP] >> (NS_FFT_BITS - 1)) * ns_window(n + HFP_NS_HOP)) >> 15;
+        int32_t v = first + ns->ola[n];
+        pcm[n] = (v > 32767) ? 32767 : (v < -32768) ? -32768 : (int16_t)v;
+        ns->ola[n] = second;
+    }
+
+    uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+    if (us > ns->frame_us_max) {
+        ns->frame_us_max = us;
+    }
+}
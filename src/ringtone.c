@@ -1,92 +1,447 @@
 /*
- * ringtone.c - Simple 2-second ringtone beep
+ * ringtone.c - Ringtone for incoming calls
+ *
+ * The built-in ringtone is a dual tone from a fixed-point wavetable oscillator.
+ * Optionally a ringtone file on SPIFFS is played instead (16-bit PCM WAV, raw
+ * 16 kHz mono PCM or an SBC stream); it is streamed in small chunks and never
+ * loaded into RAM as a whole.
  */
 
 #include "ringtone.h"
 #include "bt_i2s.h"
+#include "audio_mixer.h"
+#include "codec.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "driver/i2s_std.h"
-#include <math.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 #define TAG "RINGTONE"
 #define RINGTONE_SAMPLE_RATE 16000
 #define RINGTONE_BUFFER_SIZE 1600  // 100ms of audio
 #define RINGTONE_DURATION_MS 2000   // 2 seconds
+#define RINGTONE_BUFFER_BYTES (RINGTONE_BUFFER_SIZE * sizeof(int16_t))
+#define RINGTONE_FILE_CHUNK 512     // SBC bytes read from flash per refill
+#define RINGTONE_PATH_MAX 64
+#define RINGTONE_STOP_TIMEOUT_MS 300  // a stop is seen after at most one buffer write
+#define RINGTONE_SBC_SYNCWORD 0x9C
+
+#ifndef CONFIG_A2DPSINK_HFPHF_RINGTONE_FILE
+#define CONFIG_A2DPSINK_HFPHF_RINGTONE_FILE ""
+#endif
+
+/**
+ * @brief Wavetable oscillator; the top 8 bits of the phase index the table,
+ *        the next 15 bits interpolate between neighbouring entries
+ */
+typedef struct {
+    uint32_t phase;
+    uint32_t step;   // phase increment per sample (freq * 2^32 / rate)
+    int16_t amp;     // Q15 amplitude
+} ringtone_osc_t;
+
+typedef enum {
+    RINGTONE_FILE_PCM = 0,
+    RINGTONE_FILE_SBC,
+} ringtone_file_fmt_t;
+
+typedef struct {
+    FILE *f;
+    ringtone_file_fmt_t fmt;
+    int sample_rate;
+    int channels;
+    long data_left;  // bytes of PCM left in a WAV data chunk, -1 = until EOF
+} ringtone_file_t;
+
+// One full sine period, Q15
+static const int16_t s_sine_table[256] = {
+         0,    804,   1608,   2410,   3212,   4011,   4808,   5602,
+      6393,   7179,   7962,   8739,   9512,  10278,  11039,  11793,
+     12539,  13279,  14010,  14732,  15446,  16151,  16846,  17530,
+     18204,  18868,  19519,  20159,  20787,  21403,  22005,  22594,
+     23170,  23731,  24279,  24811,  25329,  25832,  26319,  26790,
+     27245,  27683,  28105,  28510,  28898,  29268,  29621,  29956,
+     30273,  30571,  30852,  31113,  31356,  31580,  31785,  31971,
+     32137,  32285,  32412,  32521,  32609,  32678,  32728,  32757,
+     32767,  32757,  32728,  32678,  32609,  32521,  32412,  32285,
+     32137,  31971,  31785,  31580,  31356,  31113,  30852,  30571,
+     30273,  29956,  29621,  29268,  28898,  28510,  28105,  27683,
+     27245,  26790,  26319,  25832,  25329,  24811,  24279,  23731,
+     23170,  22594,  22005,  21403,  20787,  20159,  19519,  18868,
+     18204,  17530,  16846,  16151,  15446,  14732,  14010,  13279,
+     12539,  11793,  11039,  10278,   9512,   8739,   7962,   7179,
+      6393,   5602,   4808,   4011,   3212,   2410,   1608,    804,
+         0,   -804,  -1608,  -2410,  -3212,  -4011,  -4808,  -5602,
+     -6393,  -7179,  -7962,  -8739,  -9512, -10278, -11039, -11793,
+    -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530,
+    -18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+    -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+    -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956,
+    -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+    -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+    -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285,
+    -32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571,
+    -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+    -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731,
+    -23170, -22594, -22005, -21403, -20787, -20159, -19519, -18868,
+    -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+    -12539, -11793, -11039, -10278,  -9512,  -8739,  -7962,  -7179,
+     -6393,  -5602,  -4808,  -4011,  -3212,  -2410,  -1608,   -804,
+};
+
+static const int s_sbc_sample_rates[4] = { 16000, 32000, 44100, 48000 };
 
 static TaskHandle_t ringtone_task_handle = NULL;
+static TaskHandle_t volatile ringtone_stop_waiter = NULL;  // notified when the task has exited
 static volatile bool ringtone_stop_requested = false;
+static char s_ringtone_file[RINGTONE_PATH_MAX] = CONFIG_A2DPSINK_HFPHF_RINGTONE_FILE;
+
+// ============================================================================
+// BUILT-IN TONE
+// ============================================================================
+
+static void ringtone_osc_init(ringtone_osc_t *osc, uint32_t freq_hz, int16_t amp)
+{
+    osc->phase = 0;
+    osc->step = (uint32_t)(((uint64_t)freq_hz << 32) / RINGTONE_SAMPLE_RATE);
+    osc->amp = amp;
+}
+
+static inline int32_t ringtone_osc_next(ringtone_osc_t *osc)
+{
+    uint32_t idx = osc->phase >> 24;
+    int32_t frac = (int32_t)((osc->phase >> 9) & 0x7FFF);
+    int32_t a = s_sine_table[idx];
+    int32_t b = s_sine_table[(idx + 1) & 0xFF];
+    osc->phase += osc->step;
+
+    int32_t s = a + (((b - a) * frac) >> 15);
+    return (s * osc->amp) >> 15;
+}
 
 // Generate dual-tone ringtone
-static void generate_ringtone_buffer(int16_t *buffer, size_t samples, uint32_t phase)
+static void generate_ringtone_buffer(int16_t *buffer, size_t samples, ringtone_osc_t osc[2])
 {
-    const float freq1 = 440.0f;  // Hz - A note
-    const float freq2 = 880.0f;  // Hz - A note, one octave up
-    const float sample_rate = RINGTONE_SAMPLE_RATE;
-    
     for (size_t i = 0; i < samples; i++) {
-        float t = (phase + i) / sample_rate;
-        
-        // Mix two frequencies
-        float sample1 = sinf(2.0f * M_PI * freq1 * t);
-        float sample2 = sinf(2.0f * M_PI * freq2 * t);
-        float mixed = (sample1 + sample2 * 0.5f) / 1.5f;
-        
-        // Apply amplitude (30% volume)
-        buffer[i] = (int16_t)(mixed * 32767.0f * 0.3f);
+        buffer[i] = (int16_t)(ringtone_osc_next(&osc[0]) + ringtone_osc_next(&osc[1]));
     }
 }
 
-static void ringtone_beep_task(void *arg)
+// ============================================================================
+// MIXER SOURCE
+// ============================================================================
+
+static audio_mixer_source_t *ringtone_source_create(int sample_rate, int channels)
 {
-    int16_t *buffer = (int16_t *)malloc(RINGTONE_BUFFER_SIZE * sizeof(int16_t));
-    if (buffer == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate ringtone buffer");
-        ringtone_task_handle = NULL;
-        vTaskDelete(NULL);
+    // The ringtone is its own mixer source, so it plays over (and ducks) whatever is streaming
+    audio_mixer_source_cfg_t src_cfg = {
+        .name = "ringtone",
+        .sample_rate = sample_rate,
+        .channels = channels,
+        .buffer_bytes = 3 * RINGTONE_BUFFER_BYTES,
+        .prefetch_bytes = RINGTONE_BUFFER_BYTES,
+        .duck_others = true,
+    };
+    audio_mixer_source_t *source = audio_mixer_source_create(&src_cfg);
+    if (source == NULL) {
+        ESP_LOGE(TAG, "Failed to create ringtone mixer source");
+    }
+    return source;
+}
+
+static void ringtone_source_finish(audio_mixer_source_t *source)
+{
+    if (ringtone_stop_requested) {
+        audio_mixer_source_flush(source);
+    } else {
+        audio_mixer_source_drain(source, pdMS_TO_TICKS(500));
+    }
+    audio_mixer_source_destroy(source);
+}
+
+// Blocks while the source is full, which paces the producer to real time
+static bool ringtone_source_write(audio_mixer_source_t *source, const void *data, size_t bytes)
+{
+    if (audio_mixer_source_write(source, data, bytes, pdMS_TO_TICKS(500)) == 0) {
+        ESP_LOGW(TAG, "Ringtone source stalled");
+        return false;
+    }
+    return true;
+}
+
+static void ringtone_play_tone(int16_t *buffer)
+{
+    audio_mixer_source_t *source = ringtone_source_create(RINGTONE_SAMPLE_RATE, 1);
+    if (source == NULL) {
         return;
     }
-    
-    uint32_t phase = 0;
-    size_t bytes_written;
+
+    // 440 Hz + 880 Hz at half level, 30% overall
+    ringtone_osc_t osc[2];
+    ringtone_osc_init(&osc[0], 440, 6554);
+    ringtone_osc_init(&osc[1], 880, 3277);
     uint32_t elapsed_ms = 0;
-    
+
     ESP_LOGI(TAG, "Playing ringtone beep");
-    
+
     // Play for 2 seconds or until stop requested
     while (elapsed_ms < RINGTONE_DURATION_MS && !ringtone_stop_requested) {
-        // Generate tone
-        generate_ringtone_buffer(buffer, RINGTONE_BUFFER_SIZE, phase);
-        phase += RINGTONE_BUFFER_SIZE;
-        
-        // Write to I2S
-        if (bt_i2s_get_tx_chan() != NULL) {
-            esp_err_t ret = i2s_channel_write(bt_i2s_get_tx_chan(), buffer, 
-                                              RINGTONE_BUFFER_SIZE * sizeof(int16_t), 
-                                              &bytes_written, pdMS_TO_TICKS(100));
-            if (ret != ESP_OK) {
-                ESP_LOGW(TAG, "Failed to write to I2S: %d", ret);
-                break;
-            }
+        generate_ringtone_buffer(buffer, RINGTONE_BUFFER_SIZE, osc);
+        if (!ringtone_source_write(source, buffer, RINGTONE_BUFFER_BYTES)) {
+            break;
         }
-        
         elapsed_ms += 100;  // 100ms per buffer
-        vTaskDelay(1);
     }
-    
-    // Send brief silence to clean up
-    memset(buffer, 0, RINGTONE_BUFFER_SIZE * sizeof(int16_t));
-    if (bt_i2s_get_tx_chan() != NULL) {
-        i2s_channel_write(bt_i2s_get_tx_chan(), buffer, RINGTONE_BUFFER_SIZE * sizeof(int16_t), 
-                         &bytes_written, pdMS_TO_TICKS(100));
+
+    ringtone_source_finish(source);
+}
+
+// ============================================================================
+// RINGTONE FILE
+// ============================================================================
+
+static inline uint16_t rd_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t rd_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Walk the RIFF chunks up to the start of the data chunk
+ */
+static bool ringtone_wav_parse(ringtone_file_t *rf)
+{
+    bool have_fmt = false;
+    uint8_t chunk[8];
+
+    while (fread(chunk, 1, sizeof(chunk), rf->f) == sizeof(chunk)) {
+        uint32_t size = rd_le32(chunk + 4);
+        uint32_t skip = size + (size & 1);  // chunks are word aligned
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            uint8_t fmt[16];
+            if (size < sizeof(fmt) || fread(fmt, 1, sizeof(fmt), rf->f) != sizeof(fmt)) {
+                return false;
+            }
+            uint16_t format = rd_le16(fmt);
+            uint16_t channels = rd_le16(fmt + 2);
+            uint32_t sample_rate = rd_le32(fmt + 4);
+            uint16_t bits = rd_le16(fmt + 14);
+            if (format != 1 || bits != 16 || channels < 1 || channels > 2 ||
+                sample_rate < 8000 || sample_rate > 48000) {
+                ESP_LOGW(TAG, "Unsupported WAV format (fmt %u, %u ch, %" PRIu32 " Hz, %u bit)",
+                         format, channels, sample_rate, bits);
+                return false;
+            }
+            rf->sample_rate = (int)sample_rate;
+            rf->channels = channels;
+            have_fmt = true;
+            skip -= sizeof(fmt);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            rf->data_left = (long)size;
+            return have_fmt;
+        }
+
+        if (fseek(rf->f, (long)skip, SEEK_CUR) != 0) {
+            return false;
+        }
     }
-    
+    return false;
+}
+
+/**
+ * @brief Open a ringtone file and work out its format from its header
+ *
+ * WAV and SBC files are recognised by their header; files without one are
+ * only accepted as raw 16 kHz mono PCM when named *.pcm or *.raw.
+ */
+static bool ringtone_file_open(const char *path, ringtone_file_t *rf)
+{
+    memset(rf, 0, sizeof(*rf));
+    rf->data_left = -1;
+
+    rf->f = fopen(path, "rb");
+    if (rf->f == NULL) {
+        ESP_LOGW(TAG, "Cannot open ringtone file %s", path);
+        return false;
+    }
+
+    uint8_t hdr[12];
+    size_t n = fread(hdr, 1, sizeof(hdr), rf->f);
+    const char *ext = strrchr(path, '.');
+    bool ok = false;
+
+    if (n == sizeof(hdr) && memcmp(hdr, "RIFF", 4) == 0 && memcmp(hdr + 8, "WAVE", 4) == 0) {
+        rf->fmt = RINGTONE_FILE_PCM;
+        ok = ringtone_wav_parse(rf);
+    } else if (n >= 2 && hdr[0] == RINGTONE_SBC_SYNCWORD) {
+        rf->fmt = RINGTONE_FILE_SBC;
+        rf->sample_rate = s_sbc_sample_rates[hdr[1] >> 6];
+        rf->channels = (((hdr[1] >> 2) & 0x03) == 0) ? 1 : 2;
+        ok = (fseek(rf->f, 0, SEEK_SET) == 0);
+    } else if (ext != NULL && (strcasecmp(ext, ".pcm") == 0 || strcasecmp(ext, ".raw") == 0)) {
+        rf->fmt = RINGTONE_FILE_PCM;
+        rf->sample_rate = RINGTONE_SAMPLE_RATE;
+        rf->channels = 1;
+        ok = (fseek(rf->f, 0, SEEK_SET) == 0);
+    } else {
+        ESP_LOGW(TAG, "Unrecognised ringtone file format: %s", path);
+    }
+
+    if (!ok) {
+        fclose(rf->f);
+        rf->f = NULL;
+    }
+    return ok;
+}
+
+static void ringtone_stream_pcm(ringtone_file_t *rf, audio_mixer_source_t *source, int16_t *buffer)
+{
+    const size_t frame_bytes = (size_t)rf->channels * sizeof(int16_t);
+
+    while (!ringtone_stop_requested) {
+        size_t want = RINGTONE_BUFFER_BYTES;
+        if (rf->data_left >= 0 && (size_t)rf->data_left < want) {
+            want = (size_t)rf->data_left;
+        }
+        size_t got = fread(buffer, 1, want, rf->f);
+        got -= got % frame_bytes;
+        if (got == 0) {
+            break;
+        }
+        if (rf->data_left >= 0) {
+            rf->data_left -= (long)got;
+        }
+        if (!ringtone_source_write(source, buffer, got)) {
+            break;
+        }
+    }
+}
+
+static void ringtone_stream_sbc(ringtone_file_t *rf, audio_mixer_source_t *source, int16_t *buffer)
+{
+    codec_cfg_t cfg = {
+        .sample_rate = rf->sample_rate,
+        .channels = rf->channels,
+    };
+    codec_ctx_t *dec = sbc_dec_create(&cfg);
+    uint8_t *in = (uint8_t *)malloc(RINGTONE_FILE_CHUNK);
+    if (dec == NULL || in == NULL) {
+        ESP_LOGE(TAG, "Failed to set up SBC ringtone decoder");
+        free(in);
+        codec_destroy(dec);
+        return;
+    }
+
+    size_t in_len = 0;
+    bool eof = false;
+
+    while (!ringtone_stop_requested) {
+        if (!eof && in_len < RINGTONE_FILE_CHUNK) {
+            size_t got = fread(in + in_len, 1, RINGTONE_FILE_CHUNK - in_len, rf->f);
+            eof = (got == 0);
+            in_len += got;
+        }
+        if (in_len == 0) {
+            break;
+        }
+
+        size_t out_len = 0;
+        size_t consumed = 0;
+        if (codec_process(dec, in, in_len, (uint8_t *)buffer, RINGTONE_BUFFER_BYTES,
+                          &out_len, &consumed) != 0 || consumed == 0) {
+            // A truncated last frame is expected at EOF; anything else is a corrupt file
+            if (!eof) {
+                ESP_LOGW(TAG, "SBC ringtone decode failed");
+            }
+            break;
+        }
+        in_len -= consumed;
+        memmove(in, in + consumed, in_len);
+
+        if (out_len > 0 && !ringtone_source_write(source, buffer, out_len)) {
+            break;
+        }
+    }
+
+    free(in);
+    codec_destroy(dec);
+}
+
+/**
+ * @brief Play the configured ringtone file once
+ *
+ * @return false if the file could not be opened or parsed (caller falls back to the beep)
+ */
+static bool ringtone_play_file(const char *path, int16_t *buffer)
+{
+    ringtone_file_t rf;
+    if (!ringtone_file_open(path, &rf)) {
+        return false;
+    }
+
+    audio_mixer_source_t *source = ringtone_source_create(rf.sample_rate, rf.channels);
+    if (source == NULL) {
+        fclose(rf.f);
+        return true;
+    }
+
+    ESP_LOGI(TAG, "Playing ringtone %s (%s, %d Hz, %d ch)", path,
+             rf.fmt == RINGTONE_FILE_SBC ? "SBC" : "PCM", rf.sample_rate, rf.channels);
+
+    if (rf.fmt == RINGTONE_FILE_SBC) {
+        ringtone_stream_sbc(&rf, source, buffer);
+    } else {
+        ringtone_stream_pcm(&rf, source, buffer);
+    }
+
+    ringtone_source_finish(source);
+    fclose(rf.f);
+    return true;
+}
+
+// ============================================================================
+// TASK & PUBLIC API
+// ============================================================================
+
+static void ringtone_beep_task(void *arg)
+{
+    // Large enough for one 100ms tone buffer and for one decoded SBC frame
+    int16_t *buffer = (int16_t *)malloc(RINGTONE_BUFFER_BYTES);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate ringtone buffer");
+        ringtone_task_handle = NULL;
+        vTaskDelete(NULL);
+        return;
+    }
+
+    bt_i2s_output_acquire();
+
+    char path[RINGTONE_PATH_MAX] = {0};
+    strncpy(path, s_ringtone_file, sizeof(path) - 1);
+    if (path[0] == '\0' || !ringtone_play_file(path, buffer)) {
+        ringtone_play_tone(buffer);
+    }
+
+    bt_i2s_output_release();
+
     free(buffer);
-    ESP_LOGD(TAG, "Ringtone beep finished");
-    
+    ESP_LOGD(TAG, "Ringtone finished");
+
     ringtone_stop_requested = false;
     ringtone_task_handle = NULL;
+    TaskHandle_t waiter = ringtone_stop_waiter;
+    if (waiter != NULL) {
+        xTaskNotifyGive(waiter);
+    }
     vTaskDelete(NULL);
 }
 
@@ -101,19 +456,40 @@ void ringtone_play_beep(void)
     ringtone_stop_requested = false;
     
     BaseType_t ret = xTaskCreate(ringtone_beep_task, "ringtone_beep", 
-                                  3072, NULL, 5, &ringtone_task_handle);
+                                  4096, NULL, 5, &ringtone_task_handle);
     if (ret != pdPASS) {
         ESP_LOGE(TAG, "Failed to create ringtone task");
     }
 }
 
+esp_err_t ringtone_set_file(const char *path)
+{
+    if (path == NULL) {
+        s_ringtone_file[0] = '\0';
+        return ESP_OK;
+    }
+    if (strlen(path) >= sizeof(s_ringtone_file)) {
+        ESP_LOGE(TAG, "Ringtone path too long: %s", path);
+        return ESP_ERR_INVALID_ARG;
+    }
+    strncpy(s_ringtone_file, path, sizeof(s_ringtone_file) - 1);
+    s_ringtone_file[sizeof(s_ringtone_file) - 1] = '\0';
+    return ESP_OK;
+}
+
 void ringtone_stop(void)
 {
     if (ringtone_task_handle != NULL) {
         ESP_LOGI(TAG, "Stopping ringtone");
+        xTaskNotifyStateClear(NULL);
+        ringtone_stop_waiter = xTaskGetCurrentTaskHandle();
         ringtone_stop_requested = true;
         
-        // Wait briefly for task to stop
-        vTaskDelay(pdMS_TO_TICKS(50));
+        // Wait until the task has released the output (it notifies on its way out)
+        if (ringtone_task_handle != NULL &&
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RINGTONE_STOP_TIMEOUT_MS)) == 0) {
+            ESP_LOGW(TAG, "Ringtone task did not stop in time");
+        }
+        ringtone_stop_waiter = NULL;
     }
 }
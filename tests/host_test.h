@@ -0,0 +1,65 @@
+/*
+ * Helpers shared by the host tests
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define CHECK(cond, fmt, ...)                                               \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "FAIL %s:%d: " fmt "\n", __FILE__, __LINE__,   \
+                    ##__VA_ARGS__);                                         \
+            exit(1);                                                        \
+        }                                                                   \
+    } while (0)
+
+/** Deterministic noise in [-1, 1) so runs are reproducible */
+static inline double test_rand(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (double)(int32_t)*state / 2147483648.0;
+}
+
+static inline int16_t test_sat16(double v)
+{
+    if (v > 32767.0) return 32767;
+    if (v < -32768.0) return -32768;
+    return (int16_t)lrint(v);
+}
+
+static inline double test_energy(const int16_t *x, size_t n)
+{
+    double e = 0;
+    for (size_t i = 0; i < n; i++) e += (double)x[i] * x[i];
+    return e;
+}
+
+/**
+ * Read a raw 16-bit little-endian file (as written by e.g. `sox ... -t raw -e signed -b 16`)
+ * @return Sample count; *out is malloc'd
+ */
+static inline size_t test_read_raw(const char *path, int16_t **out)
+{
+    FILE *f = fopen(path, "rb");
+    CHECK(f, "cannot open %s", path);
+    fseek(f, 0, SEEK_END);
+    long bytes = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *out = malloc(bytes > 0 ? (size_t)bytes : 1);
+    CHECK(*out, "out of memory");
+    size_t n = fread(*out, sizeof(int16_t), (size_t)bytes / sizeof(int16_t), f);
+    fclose(f);
+    return n;
+}
+
+static inline void test_write_raw(const char *path, const int16_t *x, size_t n)
+{
+    FILE *f = fopen(path, "wb");
+    CHECK(f, "cannot create %s", path);
+    fwrite(x, sizeof(int16_t), n, f);
+    fclose(f);
+}
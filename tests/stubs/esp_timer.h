@@ -0,0 +1,11 @@
+/*
+ * Host build stand-in for the ESP-IDF header of the same name
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Microseconds from a monotonic clock (esp_timer.c)
+ */
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,5 @@
+/*
+ * Host build configuration. The modules under test fall back to their
+ * menuconfig defaults; a test target sets an option with a compile definition.
+ */
+#pragma once
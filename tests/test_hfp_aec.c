@@ -0,0 +1,168 @@
+/*
+ * Host test of the echo canceller: echo return loss enhancement (ERLE)
+ *
+ * Without arguments a far-end talker is played through a simulated room
+ * (delay, decaying impulse response, near-end noise floor), then the near end
+ * talks over it, then the far end talks alone again. The canceller has to
+ * converge, hold still during double talk, and keep cancelling afterwards.
+ *
+ * With arguments it runs a recorded call instead and reports ERLE per second:
+ *   test_hfp_aec <ref.raw> <mic.raw> [out.raw]
+ * ref.raw is what was sent to the speaker, mic.raw what the microphone picked
+ * up, both 16-bit mono at 16 kHz and sample aligned at the start. The
+ * cancelled microphone signal is written to out.raw if given.
+ */
+
+#include <string.h>
+#include "host_test.h"
+#include "hfp_aec.h"
+
+#define RATE        16000
+#define FRAME       120                 // one mSBC frame, as the RX task delivers it
+#define ECHO_DELAY  40                  // acoustic + converter delay (samples)
+#define ECHO_LEN    96                  // impulse response tail (samples)
+#define ECHO_GAIN   0.3                 // speaker-to-microphone coupling
+#define NOISE_AMP   20.0                // microphone noise floor
+
+#define FAR_SECONDS     4               // far end alone, convergence
+#define DT_SECONDS      1               // both talk
+#define AFTER_SECONDS   2               // far end alone again
+
+#define ERLE_MIN_DB     20.0            // after convergence
+#define ERLE_DT_MIN_DB  15.0            // after double talk (no divergence)
+
+/** Speech-like source: coloured noise under a syllable-rate envelope */
+typedef struct {
+    uint32_t seed;
+    double lp;
+    double phase;
+    double rate_hz;
+    double amp;
+} talker_t;
+
+static int16_t talker_next(talker_t *t)
+{
+    t->lp = 0.7 * t->lp + 0.3 * test_rand(&t->seed);
+    t->phase += t->rate_hz / RATE;
+    double env = sin(M_PI * t->phase);
+    env = (env > 0) ? env : 0.1 * -env;
+    return test_sat16(t->amp * 2.5 * env * t->lp);
+}
+
+static double erle_db(double in, double out)
+{
+    return 10.0 * log10(in / (out > 1 ? out : 1));
+}
+
+static int run_simulation(void)
+{
+    double h[ECHO_LEN];
+    uint32_t seed = 0x5eed;
+    for (int k = 0; k < ECHO_LEN; k++) {
+        h[k] = ECHO_GAIN * exp(-k / 16.0) * (k == 0 ? 1.0 : 0.5 * test_rand(&seed));
+    }
+
+    const size_t total = (size_t)(FAR_SECONDS + DT_SECONDS + AFTER_SECONDS) * RATE;
+    const size_t dt_start = (size_t)FAR_SECONDS * RATE;
+    const size_t dt_end = dt_start + (size_t)DT_SECONDS * RATE;
+    int16_t *ref = calloc(total, sizeof(int16_t));
+    int16_t *mic = calloc(total, sizeof(int16_t));
+    int16_t *echo = calloc(total, sizeof(int16_t));
+    CHECK(ref && mic && echo, "out of memory");
+
+    talker_t far = { .seed = 1, .rate_hz = 4.0, .amp = 8000 };
+    talker_t near = { .seed = 2, .rate_hz = 3.3, .amp = 6000 };
+    for (size_t n = 0; n < total; n++) {
+        ref[n] = talker_next(&far);
+        double y = 0;
+        for (int k = 0; k < ECHO_LEN && n >= (size_t)(ECHO_DELAY + k); k++) {
+            y += h[k] * ref[n - ECHO_DELAY - k];
+        }
+        echo[n] = test_sat16(y);
+        double v = y + NOISE_AMP * test_rand(&seed);
+        if (n >= dt_start && n < dt_end) {
+            v += talker_next(&near);
+        }
+        mic[n] = test_sat16(v);
+    }
+
+    CHECK(hfp_aec_start(RATE, 0) == ESP_OK, "hfp_aec_start failed");
+    for (size_t n = 0; n + FRAME <= total; n += FRAME) {
+        hfp_aec_push_reference(&ref[n], FRAME, 1);
+        hfp_aec_process(&mic[n], FRAME);
+    }
+    hfp_aec_stats_t stats;
+    hfp_aec_get_stats(&stats);
+    hfp_aec_stop();
+
+    // Residual echo over the last second of each far-end-only stretch. The
+    // near-end noise is in the output too, so this is the ERLE the far end hears.
+    const size_t conv = dt_start - RATE;
+    const size_t after = total - RATE;
+    double erle_conv = erle_db(test_energy(&echo[conv], RATE), test_energy(&mic[conv], RATE));
+    double erle_after = erle_db(test_energy(&echo[after], RATE), test_energy(&mic[after], RATE));
+
+    printf("ERLE converged %.1f dB, after double talk %.1f dB, reported %d dB, "
+           "worst frame %u us, %u realigns\n",
+           erle_conv, erle_after, (int)stats.erle_db, (unsigned)stats.frame_us_max, (unsigned)stats.realigns);
+
+    CHECK(erle_conv >= ERLE_MIN_DB, "ERLE %.1f dB after convergence, want >= %.1f", erle_conv, ERLE_MIN_DB);
+    CHECK(erle_after >= ERLE_DT_MIN_DB, "ERLE %.1f dB after double talk, want >= %.1f", erle_after, ERLE_DT_MIN_DB);
+    CHECK(stats.erle_db > 0, "reported ERLE %d dB", (int)stats.erle_db);
+    CHECK(stats.realigns == 0, "%u realigns with a steady reference", (unsigned)stats.realigns);
+
+    free(ref);
+    free(mic);
+    free(echo);
+    return 0;
+}
+
+static int run_recording(const char *ref_path, const char *mic_path, const char *out_path)
+{
+    int16_t *ref, *mic;
+    size_t n_ref = test_read_raw(ref_path, &ref);
+    size_t n_mic = test_read_raw(mic_path, &mic);
+    size_t total = (n_ref < n_mic) ? n_ref : n_mic;
+    total -= total % FRAME;
+    CHECK(total > 0, "empty recording");
+
+    int16_t *out = malloc(total * sizeof(int16_t));
+    CHECK(out, "out of memory");
+    memcpy(out, mic, total * sizeof(int16_t));
+
+    CHECK(hfp_aec_start(RATE, 0) == ESP_OK, "hfp_aec_start failed");
+    for (size_t n = 0; n < total; n += FRAME) {
+        hfp_aec_push_reference(&ref[n], FRAME, 1);
+        hfp_aec_process(&out[n], FRAME);
+    }
+    hfp_aec_stats_t stats;
+    hfp_aec_get_stats(&stats);
+    hfp_aec_stop();
+
+    for (size_t s = 0; s + RATE <= total; s += RATE) {
+        printf("%3zu s: ERLE %5.1f dB\n", s / RATE,
+               erle_db(test_energy(&mic[s], RATE), test_energy(&out[s], RATE)));
+    }
+    printf("reported ERLE %d dB, worst frame %u us, %u realigns\n",
+           (int)stats.erle_db, (unsigned)stats.frame_us_max, (unsigned)stats.realigns);
+
+    if (out_path != NULL) {
+        test_write_raw(out_path, out, total);
+    }
+    free(ref);
+    free(mic);
+    free(out);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3) {
+        return run_recording(argv[1], argv[2], argc > 3 ? argv[3] : NULL);
+    }
+    if (argc != 1) {
+        fprintf(stderr, "usage: %s [<ref.raw> <mic.raw> [out.raw]]\n", argv[0]);
+        return 2;
+    }
+    return run_simulation();
+}
@@ -0,0 +1,221 @@
+/*
+ * Host test of the microphone AGC and its headroom shift
+ *
+ * Without arguments it checks
+ *   - that a quiet talker, converted from 24-bit words and levelled, keeps more
+ *     precision than the plain top-16-bit conversion allows
+ *   - that the echo canceller and the noise suppressor carry on undisturbed
+ *     when the shift steps
+ *
+ * With arguments it levels a recording instead and reports the gain split:
+ *   test_hfp_agc <in.raw> <out.raw>
+ * in.raw is 16-bit mono at 16 kHz; it is played as a 24-bit microphone 24 dB
+ * down, to stand for a quiet talker.
+ */
+
+#include <string.h>
+#include "host_test.h"
+#include "hfp_agc.h"
+#include "hfp_aec.h"
+#include "hfp_ns.h"
+
+#define RATE            16000
+#define FRAME           120             // one RX task read
+#define SECONDS         8
+#define QUIET_AMP       400.0           // talker peak, 16-bit scale: quiet enough for the full gain
+
+#define PRECISION_MIN_DB    6.0         // output SNR over the plain conversion's
+#define SHIFT_ERLE_MIN_DB   15.0        // first 100 ms after the shift steps (2.6 dB without the rescale)
+#define SHIFT_NS_TOL_DB     1.5         // noise output step against the 12 dB input step (18.3 dB without)
+
+/** Speech-like source (as in test_hfp_aec), exact before quantisation */
+typedef struct {
+    uint32_t seed;
+    double lp;
+    double phase;
+    double rate_hz;
+} talker_t;
+
+static double talker_next(talker_t *t)
+{
+    t->lp = 0.7 * t->lp + 0.3 * test_rand(&t->seed);
+    t->phase += t->rate_hz / RATE;
+    double env = sin(M_PI * t->phase);
+    env = (env > 0) ? env : 0.1 * -env;
+    return 2.5 * env * t->lp;
+}
+
+/** 24 valid bits, left-justified in the 32-bit slot, from a 16-bit scale value */
+static int32_t to_i2s(double v)
+{
+    return (int32_t)((uint32_t)(int32_t)lrint(v * 256.0) << 8);
+}
+
+/** SNR (dB) of y against x scaled by their least-squares gain */
+static double fit_snr_db(const double *x, const int16_t *y, size_t n, double *gain)
+{
+    double xy = 0, xx = 0;
+    for (size_t i = 0; i < n; i++) {
+        xy += x[i] * y[i];
+        xx += x[i] * x[i];
+    }
+    double g = xy / xx, e = 0, s = 0;
+    for (size_t i = 0; i < n; i++) {
+        double d = y[i] - g * x[i];
+        e += d * d;
+        s += g * x[i] * g * x[i];
+    }
+    *gain = g;
+    return 10.0 * log10(s / (e > 1e-12 ? e : 1e-12));
+}
+
+static int run_precision(void)
+{
+    const size_t total = (size_t)SECONDS * RATE / FRAME * FRAME;
+    double *ideal = malloc(total * sizeof(double));
+    int16_t *plain = malloc(total * sizeof(int16_t));
+    int16_t *out = malloc(total * sizeof(int16_t));
+    CHECK(ideal && plain && out, "out of memory");
+
+    talker_t t = { .seed = 7, .rate_hz = 3.7 };
+    int32_t buf[FRAME];
+    hfp_agc_start(RATE);
+    for (size_t n0 = 0; n0 < total; n0 += FRAME) {
+        for (size_t i = 0; i < FRAME; i++) {
+            ideal[n0 + i] = QUIET_AMP * talker_next(&t);
+            buf[i] = to_i2s(ideal[n0 + i]);
+            plain[n0 + i] = (int16_t)(buf[i] >> 16);
+        }
+        hfp_agc_convert(buf, &out[n0], FRAME);
+        hfp_agc_process(&out[n0], FRAME);
+    }
+    const int shift = hfp_agc_input_shift();
+    hfp_agc_stop();
+
+    // The quiet talker holds the gain at its maximum once it has risen
+    const size_t tail = total - 2 * RATE;
+    double g_plain, g_out;
+    double snr_plain = fit_snr_db(&ideal[tail], &plain[tail], 2 * RATE, &g_plain);
+    double snr_out = fit_snr_db(&ideal[tail], &out[tail], 2 * RATE, &g_out);
+    printf("quiet talker: plain conversion %.1f dB SNR, levelled %.1f dB SNR at %+.1f dB gain, "
+           "%d dB of it while converting\n", snr_plain, snr_out, 20 * log10(g_out), 6 * shift);
+
+    CHECK(shift > 0, "no headroom shift for a quiet talker");
+    CHECK(snr_out >= snr_plain + PRECISION_MIN_DB, "levelled SNR %.1f dB, plain %.1f dB", snr_out, snr_plain);
+
+    free(ideal);
+    free(plain);
+    free(out);
+    return 0;
+}
+
+/** Echo canceller converged on shift 0, then the microphone steps up 12 dB */
+static int run_aec_shift(void)
+{
+    // Lengths in whole frames, the shift steps on a frame boundary as in the RX task
+    const size_t total = 5 * RATE / FRAME * FRAME, step = 4 * RATE / FRAME * FRAME;
+    int16_t *ref = malloc(total * sizeof(int16_t));
+    int16_t *mic = malloc(total * sizeof(int16_t));
+    int16_t *echo = malloc(total * sizeof(int16_t));
+    CHECK(ref && mic && echo, "out of memory");
+
+    talker_t far = { .seed = 1, .rate_hz = 4.0 };
+    uint32_t seed = 0x5eed;
+    double delay_line[64] = { 0 };
+    for (size_t n = 0; n < total; n++) {
+        ref[n] = test_sat16(8000 * talker_next(&far));
+        memmove(&delay_line[1], delay_line, sizeof(delay_line) - sizeof(double));
+        delay_line[0] = ref[n];
+        double y = 0.3 * delay_line[40] + 0.1 * delay_line[48] - 0.05 * delay_line[63];
+        y *= (n >= step) ? 4 : 1;
+        echo[n] = test_sat16(y);
+        mic[n] = test_sat16(y + 20.0 * test_rand(&seed));
+    }
+
+    CHECK(hfp_aec_start(RATE, 0) == ESP_OK, "hfp_aec_start failed");
+    for (size_t n = 0; n < total; n += FRAME) {
+        hfp_aec_set_input_shift((n >= step) ? 2 : 0);
+        hfp_aec_push_reference(&ref[n], FRAME, 1);
+        hfp_aec_process(&mic[n], FRAME);
+    }
+    hfp_aec_stop();
+
+    const size_t win = RATE / 10;
+    double before = 10 * log10(test_energy(&echo[step - win], win) / test_energy(&mic[step - win], win));
+    double after = 10 * log10(test_energy(&echo[step], win) / test_energy(&mic[step], win));
+    printf("echo canceller: ERLE %.1f dB before the shift, %.1f dB in the 100 ms after\n", before, after);
+    CHECK(after >= SHIFT_ERLE_MIN_DB, "ERLE %.1f dB after the shift", after);
+
+    free(ref);
+    free(mic);
+    free(echo);
+    return 0;
+}
+
+/** Noise suppressor settled on shift 0, then the noise steps up 12 dB */
+static int run_ns_shift(void)
+{
+    const size_t total = 3 * RATE / HFP_NS_HOP * HFP_NS_HOP, step = 2 * RATE / HFP_NS_HOP * HFP_NS_HOP;
+    int16_t *pcm = malloc(total * sizeof(int16_t));
+    CHECK(pcm, "out of memory");
+    uint32_t seed = 11;
+    for (size_t n = 0; n < total; n++) {
+        pcm[n] = test_sat16(((n >= step) ? 4 : 1) * 400.0 * test_rand(&seed));
+    }
+
+    hfp_ns_set_level(2);
+    CHECK(hfp_ns_start() == ESP_OK, "hfp_ns_start failed");
+    for (size_t n = 0; n < total; n += HFP_NS_HOP) {
+        hfp_ns_set_input_shift((n >= step) ? 2 : 0);
+        hfp_ns_process(&pcm[n], HFP_NS_HOP);
+    }
+    hfp_ns_stop();
+
+    // The output lags one hop, but is on the new scale from the step on, as
+    // the AGC expects: compare the 50 ms either side of it
+    const size_t win = RATE / 20;
+    double db = 10 * log10(test_energy(&pcm[step], win) / test_energy(&pcm[step - win], win));
+    printf("noise suppressor: output up %.1f dB for a 12.0 dB input step\n", db);
+    CHECK(fabs(db - 12.04) <= SHIFT_NS_TOL_DB, "output stepped %.1f dB", db);
+
+    free(pcm);
+    return 0;
+}
+
+static int run_recording(const char *in_path, const char *out_path)
+{
+    int16_t *pcm;
+    size_t total = test_read_raw(in_path, &pcm);
+    total -= total % FRAME;
+    CHECK(total > 0, "empty recording");
+
+    int32_t buf[FRAME];
+    int shift_sum = 0;
+    hfp_agc_start(RATE);
+    for (size_t n0 = 0; n0 < total; n0 += FRAME) {
+        for (size_t i = 0; i < FRAME; i++) {
+            buf[i] = to_i2s(pcm[n0 + i] / 16.0);
+        }
+        hfp_agc_convert(buf, &pcm[n0], FRAME);
+        shift_sum += hfp_agc_input_shift();
+        hfp_agc_process(&pcm[n0], FRAME);
+    }
+    hfp_agc_stop();
+    printf("average %.1f dB of the gain while converting\n", 6.0 * shift_sum / (total / FRAME));
+
+    test_write_raw(out_path, pcm, total);
+    free(pcm);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3) {
+        return run_recording(argv[1], argv[2]);
+    }
+    if (argc != 1) {
+        fprintf(stderr, "usage: %s [<in.raw> <out.raw>]\n", argv[0]);
+        return 2;
+    }
+    return run_precision() || run_aec_shift() || run_ns_shift();
+}
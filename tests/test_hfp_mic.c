@@ -0,0 +1,274 @@
+/*
+ * Host test of the two-microphone beamformer in the microphone front end
+ *
+ * Built with CONFIG_A2DPSINK_HFPHF_MIC_STEREO and a fixed spacing and steering
+ * angle (see CMakeLists.txt). Without arguments it feeds the front end a talker
+ * arriving from the steering angle as an exact fractional-delay pair, and checks
+ *   - the delay the beamformer applies against the geometry, at both call rates
+ *   - the delay-and-sum output against the ideal delayed talker
+ *   - the response to a tone from other angles against the delay-and-sum
+ *     pattern
+ *
+ * With arguments it runs a recorded capture instead and reports the delay
+ * between the two microphones and the beamformer's output level:
+ *   test_hfp_mic <capture.raw> [out.raw]
+ * capture.raw is interleaved 16-bit stereo at 16 kHz, left microphone first;
+ * out.raw gets the beamformed 16-bit mono signal.
+ */
+
+#include <string.h>
+#include "host_test.h"
+#include "hfp_mic.h"
+
+#if !CONFIG_A2DPSINK_HFPHF_MIC_STEREO || !defined(CONFIG_A2DPSINK_HFPHF_MIC_SPACING_MM) || \
+    !defined(CONFIG_A2DPSINK_HFPHF_MIC_STEER_DEG)
+#error "build with the two-microphone options set"
+#endif
+
+#define FRAME           120             // one RX task read
+#define SPEED_MM_S      343000.0
+#define TONES           40
+#define SECONDS         1
+
+#define DELAY_TOL       0.05            // samples
+// Output against the ideal delayed talker. Linear interpolation rolls off towards
+// Nyquist, which the 3.4 kHz talker nearly reaches on an 8 kHz call.
+#define DAS_SNR_MIN_DB_WB   30.0
+#define DAS_SNR_MIN_DB_NB   12.0
+#define PATTERN_TOL     0.05            // linear gain
+#define PATTERN_HZ      2000.0
+
+/** Inter-microphone delay in samples of a source at deg; positive: left hears it first */
+static double geometry_delay(double deg, int rate)
+{
+    return CONFIG_A2DPSINK_HFPHF_MIC_SPACING_MM * sin(deg * M_PI / 180.0) * rate / SPEED_MM_S;
+}
+
+/** Band-limited talker (random tones, 200 Hz - 3.4 kHz), exact at any fractional time */
+typedef struct {
+    double f[TONES], a[TONES], ph[TONES];
+} talker_t;
+
+static void talker_init(talker_t *t)
+{
+    uint32_t seed = 3;
+    for (int i = 0; i < TONES; i++) {
+        t->f[i] = 200.0 + 3200.0 * (test_rand(&seed) + 1) / 2;
+        t->a[i] = 0.4 / sqrt(TONES) * (0.5 + (test_rand(&seed) + 1) / 4);
+        t->ph[i] = M_PI * test_rand(&seed);
+    }
+}
+
+static double talker_at(const talker_t *t, double n, int rate)
+{
+    double v = 0;
+    for (int i = 0; i < TONES; i++) {
+        v += t->a[i] * sin(2 * M_PI * t->f[i] * n / rate + t->ph[i]);
+    }
+    return v;
+}
+
+/** Pack one frame of the pair the way the RX DMA delivers it */
+static void pack(void *buf, size_t i, double left, double right)
+{
+    if (hfp_mic_sample_bytes() == 2) {
+        int16_t *s = buf;
+        s[2 * i] = test_sat16(left * 32768.0);
+        s[2 * i + 1] = test_sat16(right * 32768.0);
+    } else {
+        // 24 valid bits, left-justified in the 32-bit slot
+        int32_t *w = buf;
+        w[2 * i] = (int32_t)((uint32_t)(int32_t)lrint(left * 8388607.0) << 8);
+        w[2 * i + 1] = (int32_t)((uint32_t)(int32_t)lrint(right * 8388607.0) << 8);
+    }
+}
+
+/**
+ * Run source(n) arriving with inter-microphone delay src_delay through the
+ * front end; out gets the beamformed signal scaled to +-1
+ */
+typedef double (*source_fn)(const void *ctx, double n, int rate);
+
+static void run_pair(source_fn source, const void *ctx, double src_delay, int rate, double *out, size_t total)
+{
+    int32_t buf[2 * FRAME];
+    hfp_mic_start(rate);
+    for (size_t n0 = 0; n0 < total; n0 += FRAME) {
+        for (size_t i = 0; i < FRAME; i++) {
+            double n = (double)(n0 + i);
+            // The mic the source reaches first hears it src_delay samples before the other
+            double left = source(ctx, (src_delay >= 0) ? n : n + src_delay, rate);
+            double right = source(ctx, (src_delay >= 0) ? n - src_delay : n, rate);
+            pack(buf, i, left, right);
+        }
+        hfp_mic_convert(buf, FRAME);
+        for (size_t i = 0; i < FRAME; i++) {
+            out[n0 + i] = buf[i] / 2147483648.0;
+        }
+    }
+}
+
+static double talker_source(const void *ctx, double n, int rate)
+{
+    return talker_at(ctx, n, rate);
+}
+
+static double tone_source(const void *ctx, double n, int rate)
+{
+    (void)ctx;
+    return 0.5 * sin(2 * M_PI * PATTERN_HZ * n / rate);
+}
+
+/**
+ * Energy ratio (dB) of the talker as the late microphone hears it, shifted by
+ * d more samples, to the output's difference from it
+ */
+static double match_db(const talker_t *t, const double *out, size_t total, double d, int rate, double src_delay)
+{
+    double e_ref = 0, e_err = 0;
+    for (size_t n = (size_t)rate / 10; n < total; n++) {
+        double ref = talker_at(t, (double)n - fabs(src_delay) - d, rate);
+        double e = out[n] - ref;
+        e_ref += ref * ref;
+        e_err += e * e;
+    }
+    return 10.0 * log10(e_ref / (e_err > 1e-20 ? e_err : 1e-20));
+}
+
+static int run_synthetic(void)
+{
+    talker_t talker;
+    talker_init(&talker);
+    const int rates[] = { 16000, 8000 };
+
+    for (int r = 0; r < 2; r++) {
+        const int rate = rates[r];
+        const size_t total = (size_t)SECONDS * rate / FRAME * FRAME;
+        double *out = malloc(total * sizeof(double));
+        CHECK(out, "out of memory");
+
+        // Talker in the steering direction: the early microphone is delayed onto the late one
+        const double tau = geometry_delay(CONFIG_A2DPSINK_HFPHF_MIC_STEER_DEG, rate);
+        run_pair(talker_source, &talker, tau, rate, out, total);
+
+        // The output is the talker as the late microphone hears it. Find the delay
+        // that matches it best: the beamformer adds none to the late microphone.
+        double best_d = 0, best_db = -1e9;
+        for (double step = 0.1, lo = -1.0, hi = 1.0; step >= 0.004; step /= 5) {
+            for (double d = lo; d <= hi + 1e-9; d += step) {
+                double db = match_db(&talker, out, total, d, rate, tau);
+                if (db > best_db) {
+                    best_db = db;
+                    best_d = d;
+                }
+            }
+            lo = best_d - step;
+            hi = best_d + step;
+        }
+        printf("%d Hz: steering delay %.3f samples, output matches the aligned talker to %.1f dB "
+               "(residual misalignment %+.3f samples)\n", rate, fabs(tau), best_db, best_d);
+        CHECK(fabs(best_d) <= DELAY_TOL, "%d Hz: beam misaligned by %.3f samples", rate, best_d);
+        const double min_db = (rate >= 16000) ? DAS_SNR_MIN_DB_WB : DAS_SNR_MIN_DB_NB;
+        CHECK(best_db >= min_db, "%d Hz: delay-and-sum output %.1f dB from ideal", rate, best_db);
+        free(out);
+    }
+
+    // Delay-and-sum pattern: a tone from deg reaches the output with gain
+    // |cos(w * (tau_src - tau_beam) / 2)|
+    const int rate = 16000;
+    const size_t total = (size_t)rate / 2 / FRAME * FRAME;
+    double *out = malloc(total * sizeof(double));
+    CHECK(out, "out of memory");
+    const double w = 2 * M_PI * PATTERN_HZ / rate;
+    const double tau_beam = geometry_delay(CONFIG_A2DPSINK_HFPHF_MIC_STEER_DEG, rate);
+    for (int deg = -90; deg <= 90; deg += 30) {
+        const double tau_src = geometry_delay(deg, rate);
+        run_pair(tone_source, NULL, tau_src, rate, out, total);
+        double e = 0;
+        for (size_t n = total / 2; n < total; n++) {
+            e += out[n] * out[n];
+        }
+        double gain = sqrt(e / (total - total / 2)) / (0.5 / sqrt(2.0));
+        double want = fabs(cos(w * (tau_src - tau_beam) / 2));
+        printf("%5.0f Hz from %+3d deg: gain %.3f (%+.1f dB), delay-and-sum %.3f\n",
+               PATTERN_HZ, deg, gain, 20 * log10(gain), want);
+        CHECK(fabs(gain - want) <= PATTERN_TOL, "%+d deg: gain %.3f, want %.3f", deg, gain, want);
+    }
+    free(out);
+    return 0;
+}
+
+/** Delay of right against left (positive: left first), from the cross-correlation peak */
+static double capture_delay(const int16_t *pcm, size_t frames)
+{
+    double best = -1e300, c[9];
+    int best_lag = 0;
+    for (int lag = -4; lag <= 4; lag++) {
+        double acc = 0;
+        for (size_t n = 4; n + 4 < frames; n++) {
+            acc += (double)pcm[2 * n] * pcm[2 * (n + lag) + 1];
+        }
+        c[lag + 4] = acc;
+        if (acc > best) {
+            best = acc;
+            best_lag = lag;
+        }
+    }
+    if (best_lag == -4 || best_lag == 4) {
+        return best_lag;
+    }
+    // Parabolic interpolation around the peak
+    double ym = c[best_lag + 3], y0 = c[best_lag + 4], yp = c[best_lag + 5];
+    double den = ym - 2 * y0 + yp;
+    return best_lag + ((den != 0) ? 0.5 * (ym - yp) / den : 0);
+}
+
+static int run_capture(const char *in_path, const char *out_path)
+{
+    int16_t *pcm;
+    size_t frames = test_read_raw(in_path, &pcm) / 2;
+    frames -= frames % FRAME;
+    CHECK(frames > 0, "empty capture");
+
+    double d = capture_delay(pcm, frames);
+    double s = d * SPEED_MM_S / (CONFIG_A2DPSINK_HFPHF_MIC_SPACING_MM * 16000.0);
+    s = (s > 1) ? 1 : (s < -1) ? -1 : s;
+    printf("inter-microphone delay %+.2f samples: strongest source at %+.0f deg (beam steered to %+d)\n",
+           d, asin(s) * 180.0 / M_PI, CONFIG_A2DPSINK_HFPHF_MIC_STEER_DEG);
+
+    int16_t *mono = malloc(frames * sizeof(int16_t));
+    int32_t buf[2 * FRAME];
+    CHECK(mono, "out of memory");
+    double e_in = 0, e_out = 0;
+    hfp_mic_start(16000);
+    for (size_t n0 = 0; n0 < frames; n0 += FRAME) {
+        for (size_t i = 0; i < FRAME; i++) {
+            const int16_t *lr = &pcm[2 * (n0 + i)];
+            pack(buf, i, lr[0] / 32768.0, lr[1] / 32768.0);
+            e_in += ((double)lr[0] * lr[0] + (double)lr[1] * lr[1]) / 2;
+        }
+        hfp_mic_convert(buf, FRAME);
+        for (size_t i = 0; i < FRAME; i++) {
+            mono[n0 + i] = (int16_t)(buf[i] >> 16);
+            e_out += (double)mono[n0 + i] * mono[n0 + i];
+        }
+    }
+    printf("beamformed output %+.1f dB against the microphone average\n", 10 * log10(e_out / (e_in > 1 ? e_in : 1)));
+
+    if (out_path != NULL) {
+        test_write_raw(out_path, mono, frames);
+    }
+    free(pcm);
+    free(mono);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    hfp_mic_init();
+    CHECK(hfp_mic_channels() == 2, "built without two microphones");
+    if (argc >= 2) {
+        return run_capture(argv[1], argc > 2 ? argv[2] : NULL);
+    }
+    return run_synthetic();
+}
@@ -0,0 +1,190 @@
+/*
+ * Host test and benchmark of the noise suppressor
+ *
+ * Without arguments a speech-like talker with pauses is mixed with stationary
+ * low-frequency noise (road/fan) and run through every suppression level. For
+ * each level it reports how far the noise drops in the pauses and how the
+ * signal-to-noise-plus-distortion ratio changes against the clean talker.
+ *
+ *   test_hfp_ns --bench [seconds]            time hfp_ns_process() per hop
+ *   test_hfp_ns <in.raw> <out.raw> [level]   suppress a recording (16-bit mono 16 kHz raw)
+ */
+
+#include <string.h>
+#include "host_test.h"
+#include "hfp_ns.h"
+#include "esp_timer.h"
+
+#define RATE        16000
+#define SECONDS     8
+#define SETTLE      RATE                // noise estimate converges within a second
+#define TALK_AMP    6000.0
+#define NOISE_AMP   2500.0
+
+#define NR_MIN_DB       8.0             // noise reduction in the pauses at level 2
+#define SNR_GAIN_MIN_DB 3.0             // SNR improvement at level 2
+
+/** Speech-like talker: coloured noise in syllables, with pauses between phrases */
+static void make_talker(int16_t *clean, uint8_t *talking, size_t n)
+{
+    uint32_t seed = 7;
+    double lp = 0, bp = 0;
+    for (size_t i = 0; i < n; i++) {
+        double t = (double)i / RATE;
+        double syl = sin(2 * M_PI * 2.0 * t);
+        double phrase = fmod(t, 2.0) < 1.2;     // 1.2 s phrase, 0.8 s pause
+        double env = (syl > 0 ? syl : 0) * phrase;
+        lp = 0.6 * lp + 0.4 * test_rand(&seed);
+        bp = 0.5 * bp + lp;                     // a little more low-mid weight, like voice
+        clean[i] = test_sat16(TALK_AMP * env * bp);
+        talking[i] = phrase > 0;
+    }
+}
+
+/** Stationary rumble: heavily low-passed noise plus a fan hum */
+static void make_noise(int16_t *noise, size_t n)
+{
+    uint32_t seed = 11;
+    double lp = 0;
+    for (size_t i = 0; i < n; i++) {
+        lp = 0.95 * lp + 0.05 * test_rand(&seed);
+        double hum = 0.2 * sin(2 * M_PI * 120.0 * i / RATE);
+        noise[i] = test_sat16(NOISE_AMP * (4.0 * lp + hum));
+    }
+}
+
+static void run_ns(int16_t *pcm, size_t n, int level)
+{
+    hfp_ns_set_level(level);
+    CHECK(hfp_ns_start() == ESP_OK, "hfp_ns_start failed");
+    for (size_t i = 0; i + HFP_NS_HOP <= n; i += HFP_NS_HOP) {
+        hfp_ns_process(&pcm[i], HFP_NS_HOP);
+    }
+    hfp_ns_stop();
+}
+
+static double db(double num, double den)
+{
+    return 10.0 * log10(num / (den > 1 ? den : 1));
+}
+
+static int run_quality(void)
+{
+    const size_t n = (size_t)SECONDS * RATE;
+    int16_t *clean = malloc(n * sizeof(int16_t));
+    int16_t *noise = malloc(n * sizeof(int16_t));
+    int16_t *mix = malloc(n * sizeof(int16_t));
+    int16_t *out = malloc(n * sizeof(int16_t));
+    uint8_t *talking = malloc(n);
+    CHECK(clean && noise && mix && out && talking, "out of memory");
+
+    make_talker(clean, talking, n);
+    make_noise(noise, n);
+    for (size_t i = 0; i < n; i++) {
+        mix[i] = test_sat16((double)clean[i] + noise[i]);
+    }
+
+    // Input SNR, and noise energy in the pauses, after the settling second
+    double e_clean = 0, e_in_err = 0, e_in_pause = 0;
+    for (size_t i = SETTLE; i < n - HFP_NS_HOP; i++) {
+        double d = (double)mix[i] - clean[i];
+        e_clean += (double)clean[i] * clean[i];
+        e_in_err += d * d;
+        if (!talking[i]) {
+            e_in_pause += (double)mix[i] * mix[i];
+        }
+    }
+    const double snr_in = db(e_clean, e_in_err);
+    printf("input SNR %.1f dB\n", snr_in);
+
+    double nr2 = 0, gain2 = 0;
+    for (int level = 0; level <= 3; level++) {
+        memcpy(out, mix, n * sizeof(int16_t));
+        run_ns(out, n, level);
+
+        // Overlap-add delays the output by one hop (not at level 0, which passes through)
+        const size_t lag = (level > 0) ? HFP_NS_HOP : 0;
+        double e_err = 0, e_pause = 0;
+        for (size_t i = SETTLE; i < n - HFP_NS_HOP; i++) {
+            double y = out[i + lag];
+            double d = y - clean[i];
+            e_err += d * d;
+            if (!talking[i]) {
+                e_pause += y * y;
+            }
+        }
+        double nr = db(e_in_pause, e_pause);
+        double snr = db(e_clean, e_err);
+        printf("level %d: noise reduction %5.1f dB, SNR %5.1f dB (%+.1f dB)\n", level, nr, snr, snr - snr_in);
+        if (level == 0) {
+            CHECK(memcmp(out, mix, n * sizeof(int16_t)) == 0, "level 0 must pass the signal through");
+        }
+        if (level == 2) {
+            nr2 = nr;
+            gain2 = snr - snr_in;
+        }
+    }
+
+    CHECK(nr2 >= NR_MIN_DB, "noise reduction %.1f dB at level 2, want >= %.1f", nr2, NR_MIN_DB);
+    CHECK(gain2 >= SNR_GAIN_MIN_DB, "SNR gain %.1f dB at level 2, want >= %.1f", gain2, SNR_GAIN_MIN_DB);
+
+    free(clean);
+    free(noise);
+    free(mix);
+    free(out);
+    free(talking);
+    return 0;
+}
+
+static int run_bench(int seconds)
+{
+    const size_t hops = (size_t)seconds * RATE / HFP_NS_HOP;
+    int16_t *pcm = malloc(hops * HFP_NS_HOP * sizeof(int16_t));
+    uint8_t *talking = malloc(hops * HFP_NS_HOP);
+    CHECK(pcm && talking, "out of memory");
+    make_talker(pcm, talking, hops * HFP_NS_HOP);
+
+    hfp_ns_set_level(2);
+    CHECK(hfp_ns_start() == ESP_OK, "hfp_ns_start failed");
+    int64_t total = 0, worst = 0;
+    for (size_t h = 0; h < hops; h++) {
+        int64_t t0 = esp_timer_get_time();
+        hfp_ns_process(&pcm[h * HFP_NS_HOP], HFP_NS_HOP);
+        int64_t us = esp_timer_get_time() - t0;
+        total += us;
+        worst = (us > worst) ? us : worst;
+    }
+    hfp_ns_stop();
+
+    // A hop is 7.5 ms of audio at 16 kHz
+    printf("%zu hops: mean %.2f us, worst %lld us per hop (%.3f%% of real time on this host)\n",
+           hops, (double)total / hops, (long long)worst, 100.0 * total / (hops * 7500.0));
+    free(pcm);
+    free(talking);
+    return 0;
+}
+
+static int run_file(const char *in_path, const char *out_path, int level)
+{
+    int16_t *pcm;
+    size_t n = test_read_raw(in_path, &pcm);
+    run_ns(pcm, n, level);
+    test_write_raw(out_path, pcm, n);
+    free(pcm);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 1) {
+        return run_quality();
+    }
+    if (strcmp(argv[1], "--bench") == 0) {
+        return run_bench(argc > 2 ? atoi(argv[2]) : 60);
+    }
+    if (argc >= 3) {
+        return run_file(argv[1], argv[2], argc > 3 ? atoi(argv[3]) : 2);
+    }
+    fprintf(stderr, "usage: %s [--bench [seconds] | <in.raw> <out.raw> [level]]\n", argv[0]);
+    return 2;
+}